@@ -68,6 +68,7 @@
 typedef struct {
 	int							apiContextIndex;	// API-specific index into an array of display contexts.
 	ARParam						ARTCparam;			// Camera parameter.
+	ARHandle					*ARTHandle;			// Detection context of this camera.
 	AR2VideoParamT				*ARTVideo;			// Video parameters
 	ARUint8						*ARTImage;			// Most recent image.
 	int							ARTThreshhold;		// Threshold for marker detection.
@@ -190,7 +191,7 @@ static int DrawCubeFinal(void)
 	return (TRUE);	
 }
 
-// Sets up fields ARTVideo, ARTCparam of gContextsActive[0] through gContextsActive[cameraCount - 1].
+// Sets up fields ARTVideo, ARTCparam, ARTHandle of gContextsActive[0] through gContextsActive[cameraCount - 1].
 static int setupCameras(const int cameraCount, const char *cparam_names[], char *vconfs[])
 {
 	int i;
@@ -215,7 +216,10 @@ static int setupCameras(const int cameraCount, const char *cparam_names[], char
 			return (FALSE);
 		}
 		arParamChangeSize(&wparam, xsize, ysize, &(gContextsActive[i].ARTCparam));
-		arInitCparam(&(gContextsActive[i].ARTCparam));
+		if ((gContextsActive[i].ARTHandle = arCreateHandle(&(gContextsActive[i].ARTCparam))) == NULL) {
+			fprintf(stderr, "setupCameras(): Unable to create detection context for camera %d.\n", i + 1);
+			return (FALSE);
+		}
 		fprintf(stderr, "*** Camera %d parameter ***\n", i + 1);
 		arParamDisp(&(gContextsActive[i].ARTCparam));
 		gContextsActive[i].ARTThreshhold = 100;
@@ -301,6 +305,7 @@ static void Quit(void)
 		}
 		ar2VideoCapStop(gContextsActive[i].ARTVideo);
 		ar2VideoClose(gContextsActive[i].ARTVideo);
+		arDeleteHandle(gContextsActive[i].ARTHandle);
 	}
 	gContextsActiveCount = 0;
 	
@@ -393,7 +398,7 @@ static void mainLoop(void)
 			//fprintf(stderr, "mainLoop(): Got image #%ld from cam %d on attempt #%ld.\n", gContextsActive[i].callCountMarkerDetect, i + 1, gCallCountGetImage);
 			
 			// Detect the markers in the video frame.
-			if (arDetectMarkerLite(gContextsActive[i].ARTImage, gContextsActive[i].ARTThreshhold, &marker_info, &marker_num) < 0) {
+			if (arHandleDetectMarkerLite(gContextsActive[i].ARTHandle, gContextsActive[i].ARTImage, gContextsActive[i].ARTThreshhold, &marker_info, &marker_num) < 0) {
 				exit(-1);
 			}
 			
@@ -409,7 +414,7 @@ static void mainLoop(void)
 			
 			if(k != -1) {
 				// Get the transformation between the marker and the real camera into gPatt_trans1.
-				arGetTransMat(&(marker_info[k]), gPatt_centre, gPatt_width, gContextsActive[i].patt_trans);
+				arHandleGetTransMat(gContextsActive[i].ARTHandle, &(marker_info[k]), gPatt_centre, gPatt_width, gContextsActive[i].patt_trans);
 				gContextsActive[i].patt_found = TRUE;
 			} else {
 				gContextsActive[i].patt_found = FALSE;
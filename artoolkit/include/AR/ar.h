@@ -176,6 +176,53 @@ typedef struct {
     int     vertex[5];
 } ARMarkerInfo2;
 
+/** \struct ARMotion
+* \brief constant velocity motion model of a marker.
+*
+* Kept by the application for each tracked marker and updated with each
+* pose found, see arGetTransMatMotion.
+* \param conv last pose
+* \param vrot angular velocity, rotation vector per unit of time in camera coordinates
+* \param vtrans velocity of the translation per unit of time
+* \param time time of conv
+* \param count number of poses seen, 0 if none
+*/
+typedef struct {
+    double  conv[3][4];
+    double  vrot[3];
+    double  vtrans[3];
+    double  time;
+    int     count;
+} ARMotion;
+
+/** \struct ARTransMatSetting
+* \brief when the pose iterations stop.
+*
+* arGetTransMat, arGetTransMatCont and arGetTransMatIter repeat
+* arGetTransMat3 until one of the tests below stops them, arModifyMatrixLM
+* iterates up to lm_loop_max times. The defaults are the
+* AR_GET_TRANS_MAT_* values of config.h.
+* \param loop_max maximum number of arGetTransMat3 rounds
+* \param fit_error stop once the error is below this (pixel^2)
+* \param cont_fit_error arGetTransMatCont falls back to arGetTransMat above this
+* \param min_improvement stop when a round lowers the error by less than this fraction
+* \param min_step_rot stop when a round turns the pose less than this (radian)...
+* \param min_step_trans ...and moves it less than this (mm)
+* \param lm_loop_max maximum number of iterations of arModifyMatrixLM
+* \param time_max time budget of one pose in microseconds, 0 for none;
+*        once spent no round and no fallback is started
+*/
+typedef struct {
+    int     loop_max;
+    double  fit_error;
+    double  cont_fit_error;
+    double  min_improvement;
+    double  min_step_rot;
+    double  min_step_trans;
+    int     lm_loop_max;
+    double  time_max;
+} ARTransMatSetting;
+
 // ============================================================================
 //	Public globals.
 // ============================================================================
@@ -264,6 +311,124 @@ extern int      arTemplateMatchingMode;
 */
 extern int      arMatchingPCAMode;
 
+/** \var int arMatchingCascadeMode
+* \brief coarse-to-fine rejection in template matching
+*
+* When enabled, each candidate square is first correlated with the
+* templates at 1/4 and then 1/2 of the pattern resolution. Candidates
+* scoring below AR_MATCHING_CASCADE_THRESH1/2 are rejected (id -1)
+* before the full resolution correlation. Not used with PCA matching.
+* The cascade may reject squares the full resolution matching would
+* have identified, so it is off unless the application enables it.
+* the possible values are :
+* -AR_MATCHING_WITHOUT_CASCADE: full resolution matching only
+* -AR_MATCHING_WITH_CASCADE: coarse-to-fine cascade
+* by default: DEFAULT_MATCHING_CASCADE_MODE in config.h
+*/
+extern int      arMatchingCascadeMode;
+
+/** \var int arPattDetectionMode
+* \brief how the inside of a square is identified
+*
+* Template matching compares the pattern with the patterns loaded by
+* arLoadPatt. Matrix code detection reads the pattern as a grid of
+* dark/light cells (see arMatrixCodeType) and the code number is the
+* decoded id.
+* the possible values are :
+* -AR_TEMPLATE_MATCHING: template matching
+* -AR_MATRIX_CODE_DETECTION: matrix code decoding
+* by default: DEFAULT_PATT_DETECTION_MODE in config.h
+*/
+extern int      arPattDetectionMode;
+
+/** \var int arMatrixCodeType
+* \brief layout and error correction of matrix codes
+*
+* the possible values are :
+* -AR_MATRIX_CODE_3x3: 64 ids, no error correction
+* -AR_MATRIX_CODE_3x3_HAMMING63: 8 ids, 1 bit corrected
+* -AR_MATRIX_CODE_4x4: 8192 ids, no error correction
+* -AR_MATRIX_CODE_4x4_BCH_13_9_3: 512 ids, 1 bit corrected
+* -AR_MATRIX_CODE_5x5_BCH_22_12_5: 4096 ids, 2 bits corrected
+* by default: DEFAULT_MATRIX_CODE_TYPE in config.h
+*
+* The cf of a code is 1.0 when it reads without error and falls with
+* each corrected bit, below the 0.5 of arDetectMarker when the code
+* corrects all it can. The codes without error correction cannot tell
+* a marker from noise and always get a cf of 0.5.
+*/
+extern int      arMatrixCodeType;
+
+/** \var int arPoseRefineMode
+* \brief how arGetTransMat refines the initial pose
+*
+* the possible values are :
+* -AR_POSE_REFINE_ANGLE_SEARCH: search of the euler angles around the
+*  initial rotation (arModifyMatrix), translation solved linearly
+* -AR_POSE_REFINE_LM: Levenberg-Marquardt over rotation and translation
+*  (arModifyMatrixLM)
+* by default: DEFAULT_POSE_REFINE_MODE in config.h
+*/
+extern int      arPoseRefineMode;
+
+/** \var int arLineFitMode
+* \brief precision of the marker edge fitting (arGetLine)
+*
+* the possible values are :
+* -AR_LINE_FIT_DOUBLE: principal axis of the edge points by arMatrixPCA
+* -AR_LINE_FIT_FLOAT: same fit in closed form in single precision,
+*  without allocation
+* by default: DEFAULT_LINE_FIT_MODE in config.h
+*/
+extern int      arLineFitMode;
+
+/** \var int arDetectInterval
+* \brief frames between two full detections of arDetectMarker
+*
+* Between them the corners of the identified markers are tracked from
+* the last frame (arTrackerTrackMarker), and a full detection is made
+* as soon as one of them is lost. The markers kept by the history are
+* reported on the tracked frames as on the detected ones. 0 or 1
+* detects every frame. This is the interval of the trackers created
+* after it is set.
+* by default: DEFAULT_DETECT_INTERVAL in config.h
+*/
+extern int      arDetectInterval;
+
+/** \var int arDetectAsync
+* \brief full detections of arDetectMarker on a thread of their own
+*
+* When set, arDetectMarker returns at once with the markers tracked by
+* their corners from the last frame, while the full detection of an
+* earlier frame runs on a thread of the tracker; the markers it finds
+* are tracked into the current frame and merged when it completes.
+* Ignored where the library is built without threads
+* (AR_POSE_THREAD_MAX 0). This is the mode of the trackers created
+* after it is set.
+* by default: DEFAULT_DETECT_ASYNC in config.h
+*/
+extern int      arDetectAsync;
+
+/** \var int arInitRotMode
+* \brief how arGetTransMat finds the rotation it starts from
+*
+* the possible values are :
+* -AR_INIT_ROT_VANISHING_POINT: vanishing points of the marker edges
+*  (arGetInitRot)
+* -AR_INIT_ROT_IPPE: analytic pose of the plane from the homography
+*  (arGetInitRotIPPE); of its two solutions the one that reprojects
+*  the corners better is refined
+* by default: DEFAULT_INIT_ROT_MODE in config.h
+*/
+extern int      arInitRotMode;
+
+/** \var ARTransMatSetting arTransMatSetting
+* \brief convergence tests and budgets of the pose iterations
+*
+* by default: AR_GET_TRANS_MAT_* in config.h
+*/
+extern ARTransMatSetting  arTransMatSetting;
+
 // ============================================================================
 //	Public functions.
 // ============================================================================
@@ -333,6 +498,9 @@ int arInitCparam( ARParam *param );
 *
 * load the bitmap pattern specified in the file filename into the pattern
 * matching array for later use by the marker detection routines.
+* A pattern whose template is already loaded, from the same file or
+* another one, is not loaded twice: its identity number is returned and
+* its count of loads incremented, so each call needs its arFreePatt.
 * \param filename name of the file containing the pattern bitmap to be loaded
 * \return the identity number of the pattern loaded or 1 if the pattern load failed.
 */
@@ -425,6 +593,121 @@ double arGetTransMat( ARMarkerInfo *marker_info,
 double arGetTransMatCont( ARMarkerInfo *marker_info, double prev_conv[3][4],
                           double center[2], double width, double conv[3][4] );
 
+/**
+* \brief compute camera position and its uncertainty.
+*
+* Same as arGetTransMat, and also returns the covariance of the pose,
+* estimated from the Jacobian of the reprojection at the solution (see
+* arGetPoseCov).
+* \param marker_info the detected marker.
+* \param center the physical center of the marker.
+* \param width the size of the marker (in mm).
+* \param conv resulted transformation matrix.
+* \param cov resulted 6x6 covariance: the rotation vector (radian) of a
+*            small rotation applied to the rotation part of conv, then the
+*            translation part of conv (mm). May be NULL.
+* \return the fitting error as arGetTransMat, -1 if no pose was found.
+*/
+double arGetTransMatEx( ARMarkerInfo *marker_info,
+                        double center[2], double width, double conv[3][4],
+                        double cov[6][6] );
+
+/**
+* \brief initial camera position of a marker, without refinement.
+*
+* The pose arGetTransMat starts from: the initial rotation of
+* arInitRotMode and the translation that fits it. Its fitting error
+* bounds that of arGetTransMat from above, so it is a cheap test of
+* whether a marker is consistent with a square seen by the camera.
+* \param marker_info the detected marker.
+* \param center the physical center of the marker.
+* \param width the size of the marker (in mm).
+* \param conv resulted transformation matrix.
+* \return the fitting error of conv, -1 if no pose was found.
+*/
+double arGetTransMatInit( ARMarkerInfo *marker_info,
+                          double center[2], double width, double conv[3][4] );
+
+/**
+* \brief compute the camera position for several markers.
+*
+* Same as calling arGetTransMat for each marker, but the markers are
+* processed in parallel by AR_POSE_THREAD_MAX worker threads and the
+* calling thread.
+* \param marker_info the markers, as returned by arDetectMarker.
+* \param num number of markers.
+* \param center the physical center of each marker.
+* \param width the size of each marker (in mm).
+* \param conv resulted transformation matrix of each marker.
+* \param err resulted fitting error of each marker, negative if no pose
+*            was found (as the return value of arGetTransMat).
+* \return the number of markers for which a pose was found.
+*/
+int arGetTransMatBatch( ARMarkerInfo marker_info[], int num,
+                        double center[][2], double width[],
+                        double conv[][3][4], double err[] );
+
+/**
+* \brief run a function over a number of items in parallel.
+*
+* The pool of worker threads behind arGetTransMatBatch and
+* arMultiGetTransMatAll: func is called once for each item, by
+* AR_POSE_THREAD_MAX worker threads and the calling thread, and
+* arRunJob returns once all are done. The pool runs one job at a time;
+* a caller that finds it busy, as a func calling arRunJob does, runs its
+* items in its own thread.
+* \param func the function run for each item.
+* \param context passed to func.
+* \param num number of items, passed to func as 0 to num-1.
+*/
+void arRunJob( void (*func)( void *context, int item ), void *context, int num );
+
+/**
+* \brief compute camera position starting from the predicted motion.
+*
+* Same as arGetTransMatCont, but starts from the pose motion predicts
+* for time instead of the previous one, then updates motion with the
+* result. Without history it is arGetTransMat. Call arMotionInit when
+* the marker is lost so that a stale velocity is not extrapolated.
+* \param marker_info the detected marker.
+* \param motion motion model of this marker.
+* \param time time of the frame, in any unit as long as it is the same
+*             for all calls (seconds, or frame numbers).
+* \param center the physical center of the marker.
+* \param width the size of the marker (in mm).
+* \param conv resulted transformation matrix.
+* \return the fitting error as arGetTransMatCont, -1 if no pose was found.
+*/
+double arGetTransMatMotion( ARMarkerInfo *marker_info, ARMotion *motion, double time,
+                            double center[2], double width, double conv[3][4] );
+
+/**
+* \brief clear a motion model.
+* \param motion the motion model.
+*/
+void arMotionInit( ARMotion *motion );
+
+/**
+* \brief predict the pose of a marker.
+* \param motion the motion model.
+* \param time time to predict for.
+* \param conv resulted transformation matrix.
+* \return 0 if ok, -1 if the model has no pose yet.
+*/
+int arMotionPredict( ARMotion *motion, double time, double conv[3][4] );
+
+/**
+* \brief add a measured pose to a motion model.
+*
+* The velocity is corrected by AR_MOTION_VELOCITY_GAIN of the prediction
+* error. A time not after the previous one restarts the model at conv.
+* \param motion the motion model.
+* \param time time of conv.
+* \param conv measured transformation matrix.
+* \return 0.
+*/
+int arMotionUpdate( ARMotion *motion, double time, double conv[3][4] );
+
 double arGetTransMat2( double rot[3][3], double pos2d[][2],
                        double pos3d[][2], int num, double conv[3][4] );
 double arGetTransMat3( double rot[3][3], double ppos2d[][2],
@@ -436,11 +719,43 @@ double arGetTransMat5( double rot[3][3], double ppos2d[][2],
                        double ppos3d[][3], int num, double conv[3][4],
                        double *dist_factor, double cpara[3][4] );
 
+/**
+* \brief repeat arGetTransMat3 until it converges.
+*
+* The iteration of arGetTransMat and arGetTransMatCont, under the tests
+* and budget of arTransMatSetting. If the last round made the error
+* worse or failed, the pose of the round before is returned.
+* \param rot initial rotation, modified.
+* \param ppos2d image positions of the points (ideal screen coordinates).
+* \param ppos3d positions of the points on the marker plane.
+* \param num number of points.
+* \param conv resulted transformation matrix.
+* \return mean squared reprojection error, -1 if the first round failed.
+*/
+double arGetTransMatIter( double rot[3][3], double ppos2d[][2],
+                          double ppos3d[][2], int num, double conv[3][4] );
+
+/**
+* \brief arGetTransMat5 with caller owned scratch memory.
+*
+* arGetTransMat2..5 keep no state between calls and may run concurrently;
+* for more than a few markers' worth of points they allocate scratch
+* memory. This version takes the scratch from the caller instead, so
+* repeated fits of large point sets (multi-marker) need no allocation.
+* \param work scratch of num*5 doubles.
+* \return mean squared reprojection error, as arGetTransMat5.
+*/
+double arGetTransMatWork( double rot[3][3], double ppos2d[][2],
+                          double ppos3d[][3], int num, double conv[3][4],
+                          double *dist_factor, double cpara[3][4], double *work );
+
 /**
 * \brief remove a pattern from memory.
 *
 * desactivate a pattern and remove from memory. post-condition
-* of this function is unavailability of the pattern.
+* of this function is unavailability of the pattern. A pattern loaded
+* several times by arLoadPatt stays available until the last of them
+* is freed.
 * \param patt_no number of pattern to free
 * \return return 1 in success, -1 if error
 */
@@ -450,7 +765,8 @@ int arFreePatt( int patt_no );
 * \brief activate a pattern on the recognition procedure.
 *
 * Activate a pattern to be check during the template matching
-* operation.
+* operation. A pattern shared by several loads counts one activation
+* per load, and each new load of it activates it again.
 * \param patt_no number of pattern to activate
 * \return return 1 in success, -1 if error
 */
@@ -460,7 +776,8 @@ int arActivatePatt( int pat_no );
 * \brief desactivate a pattern on the recognition procedure.
 *
 * Desactivate a pattern for not be check during the template matching
-* operation.
+* operation. A pattern shared by several loads stays active until
+* all the loads that activated it desactivate it.
 * \param patt_no number of pattern to desactivate
 * \return return 1 in success, -1 if error
 */
@@ -532,6 +849,18 @@ int    arUtilMat2QuatPos( double m[3][4], double q[4], double p[3] );
 */
 int    arUtilQuatPos2Mat( double q[4], double p[3], double m[3][4] );
 
+/**
+* \brief homography from the unit square to a quadrangle.
+*
+* Closed form solution of the projective transformation taking the
+* corners (0,0), (1,0), (1,1), (0,1) to vertex[0] .. vertex[3]:
+* (x y 1) ~ para * (u v 1). No memory is allocated.
+* \param vertex the four corners of the quadrangle.
+* \param para resulted homography, para[2][2] is 1.
+* \return 0 if the homography is computed, -1 if the quadrangle is degenerate.
+*/
+int    arUtilSquareToQuad( double vertex[4][2], double para[3][3] );
+
 /**
 * \brief get the time with the ARToolkit timer.
 * 
@@ -540,6 +869,14 @@ int    arUtilQuatPos2Mat( double q[4], double p[3], double m[3][4] );
 */
 double arUtilTimer(void);
 
+/**
+* \brief get the current time.
+*
+* Unlike arUtilTimer, keeps no state and may be called from any thread.
+* \return time in seconds, with the resolution of the system clock.
+*/
+double arUtilGetTime(void);
+
 /**
 * \brief reset the internal timer of ARToolkit.
 *
@@ -662,6 +999,35 @@ int arGetCode( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
 int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
                ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3] );
 
+/**
+* \brief Decode a matrix code from a normalized pattern.
+*
+* The pattern is divided in N x N cells of arMatrixCodeType. The top-left
+* and top-right cells are dark and the bottom-left cell is light on an
+* upright marker; the other cells hold the code word. Up to t wrong cells
+* are corrected, each correction lowers the confidence value.
+* \param ext_pat pattern from arGetPatt.
+* \param code decoded id, -1 if the pattern is not a valid code.
+* \param dir direction of the marker, same meaning as with template matching.
+* \param cf confidence value, 1.0 when no cell had to be corrected.
+* \return 0 if a code was decoded, -1 otherwise.
+*/
+int arGetMatrixCode( ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3],
+                     int *code, int *dir, double *cf );
+
+/**
+* \brief Build the cells of a matrix code marker.
+*
+* Fills the N x N cells of the marker with the given id, in row order
+* from the top-left of the upright marker (1 = dark, 0 = light). Used to
+* print markers.
+* \param type one of the AR_MATRIX_CODE_* types.
+* \param id id to encode.
+* \param cells N*N output cells.
+* \return N, or -1 if type or id is out of range.
+*/
+int arMatrixCodeEncode( int type, int id, ARUint8 *cells );
+
 /**
 * \brief estimate a line from a list of point.
 *
@@ -706,6 +1072,42 @@ int arGetContour( ARInt16 *limage, int *label_ref,
 double arModifyMatrix( double rot[3][3], double trans[3], double cpara[3][4],
                              double vertex[][3], double pos2d[][2], int num );
 
+/**
+* \brief refine a pose by minimizing the reprojection error.
+*
+* Levenberg-Marquardt on rotation and translation together, with the
+* analytic Jacobian of the projection. Same arguments and result as
+* arModifyMatrix, but trans is refined too.
+* \param rot rotation, refined in place.
+* \param trans translation, refined in place.
+* \param cpara camera matrix.
+* \param vertex 3D positions of the points.
+* \param pos2d observed 2D positions of the points.
+* \param num number of points.
+* \return mean squared reprojection error, -1 if a point projects to infinity.
+*/
+double arModifyMatrixLM( double rot[3][3], double trans[3], double cpara[3][4],
+                         double vertex[][3], double pos2d[][2], int num );
+
+/**
+* \brief covariance of a pose refined by arModifyMatrixLM.
+*
+* (J^T J)^-1 with the Jacobian of arModifyMatrixLM, scaled by the image
+* noise estimated from the residuals, at least
+* AR_GET_TRANS_MAT_COV_MIN_NOISE pixels.
+* \param rot rotation.
+* \param trans translation.
+* \param cpara camera matrix.
+* \param vertex 3D positions of the points.
+* \param pos2d observed 2D positions of the points.
+* \param num number of points.
+* \param cov resulted covariance of (rotation vector, translation).
+* \return 0 if ok, -1 if the pose is degenerate.
+*/
+int arGetPoseCov( double rot[3][3], double trans[3], double cpara[3][4],
+                  double vertex[][3], double pos2d[][2], int num,
+                  double cov[6][6] );
+
 /**
 * \brief extract euler angle from a rotation matrix.
 *
@@ -758,6 +1160,24 @@ int arGetNewMatrix( double a, double b, double c,
 */
 int arGetInitRot( ARMarkerInfo *marker_info, double cpara[3][4], double rot[3][3] );
 
+/**
+* \brief initial rotation of a marker from its homography.
+*
+* Infinitesimal plane-based pose estimation: the rotation is solved in
+* closed form from the homography of the marker and its derivative at
+* the marker center. A plane seen from a distance has two such poses,
+* mirrored about the line of sight, and both are returned. rot1 and
+* rot2 are in no particular order; the one that reprojects the
+* corners better is normally the right one.
+* \param marker_info the detected marker
+* \param cpara the camera matrix (arParam.mat)
+* \param rot1 first rotation
+* \param rot2 second rotation
+* \return 0 if ok, -1 for a degenerate marker
+*/
+int arGetInitRotIPPE( ARMarkerInfo *marker_info, double cpara[3][4],
+                      double rot1[3][3], double rot2[3][3] );
+
 /** \struct arPrevInfo
 * \brief structure for temporal continuity of tracking
 *
@@ -768,6 +1188,380 @@ typedef struct {
     int     count;
 } arPrevInfo;
 
+/** \struct ARTracker
+* \brief history of the markers of one camera stream
+*
+* The temporal filter of arDetectMarker: a marker identified in the
+* last frames keeps its id and direction where the new detection is
+* less confident, and is still reported for a few frames when it is
+* not detected. Each camera stream has its own, created by
+* arCreateTracker; arDetectMarker uses one of the library.
+* \param prev_info the markers identified in the last frames
+* \param prev_num their number
+* \param marker_info the markers of the last frame, returned by
+*                    arTrackerDetectMarker
+* \param marker_num their number
+* \param interval frames between two full detections, the markers being
+*                 tracked by their corners in between; 0 or 1 detects
+*                 every frame
+* \param async full detections on a thread of the tracker, the markers
+*              being tracked by their corners every frame (arDetectAsync)
+*/
+typedef struct {
+    arPrevInfo    prev_info[AR_SQUARE_MAX];
+    int           prev_num;
+    ARMarkerInfo  marker_info[AR_SQUARE_MAX*2];
+    int           marker_num;
+    int           interval;
+    int           async;
+/*---*/
+    int           stereo;
+    int           frame;
+    int           track_num;
+    void          *patch;
+    void          *job;
+    struct _ARHandle *handle;
+} ARTracker;
+
+/**
+* \brief create the history of a camera stream.
+*
+* \return the tracker, NULL if error
+*/
+ARTracker *arCreateTracker( void );
+
+/**
+* \brief free the history of a camera stream.
+*
+* Waits for the full detection still running on its thread, if any.
+* \param tracker the tracker
+* \return 0
+*/
+int arFreeTracker( ARTracker *tracker );
+
+/**
+* \brief arDetectMarker with the history of a camera stream.
+*
+* The markers returned belong to the tracker and stay valid until its
+* next call, so each stream can be tracked from its own thread. The
+* labeling and the matching of the patterns are shared by all the
+* trackers and run one frame at a time. With async set the image is
+* copied for the detection thread, and the caller may reuse it on return.
+* \param tracker the history of the stream
+* \param dataPtr the image, as for arDetectMarker
+* \param thresh the threshold, as for arDetectMarker
+* \param marker_info the detected markers
+* \param marker_num their number
+* \return 0 when the function completes normally, -1 otherwise
+*/
+int arTrackerDetectMarker( ARTracker *tracker, ARUint8 *dataPtr, int thresh,
+                           ARMarkerInfo **marker_info, int *marker_num );
+
+/**
+* \brief keep the corners of the markers of the tracker from the frame.
+*
+* A small patch of the image at 3 scales is kept around each corner
+* of the identified markers found in the frame, for arTrackerTrackMarker.
+* \param tracker the tracker, after the detection of the frame
+* \param dataPtr the image of the frame
+* \return 0 if ok, -1 if error
+*/
+int arTrackerSetPatch( ARTracker *tracker, ARUint8 *dataPtr );
+
+/**
+* \brief follow the markers of the tracker into a new frame.
+*
+* The corners kept by arTrackerSetPatch are found in the image by a
+* pyramidal Lucas-Kanade tracker; the vertex, line, pos and area of
+* each identified marker are moved with them, its id, dir and cf are
+* kept. The markers not identified, and those lost, are dropped: a
+* marker is lost when its corners are not found or no longer make a
+* convex quadrangle of about the same size.
+* \param tracker the tracker
+* \param dataPtr the image of the new frame
+* \return the number of markers lost, -1 if there was none to track
+*/
+int arTrackerTrackMarker( ARTracker *tracker, ARUint8 *dataPtr );
+
+/** \struct ARHandle
+* \brief the context of a camera
+*
+* What the detection of the markers of a camera depends on: its
+* parameters, the size of its images, the modes that may differ from
+* camera to camera, the buffers of the labeling and of the markers, and
+* the history of its markers. Each camera has its own, created by
+* arCreateHandle, and different handles can be used from different
+* threads at the same time. The loaded patterns, and the modes not
+* found here, are shared by all the handles.
+*
+* The functions without a handle work in the handle of the globals
+* (arParam, arImXsize, arImageProcMode, ...), arGetHandle, which is
+* only for one thread at a time.
+* \param param the camera; xsize and ysize are the size of the images
+* \param imageProcMode as arImageProcMode
+* \param templateMatchingMode as arTemplateMatchingMode
+* \param debug as arDebug
+* \param image the labeled image while debug is set, as arImage
+* \param tracker the history of the markers, for arHandleDetectMarker
+*/
+typedef struct _ARHandle {
+    ARParam         param;
+    int             imageProcMode;
+    int             templateMatchingMode;
+    int             debug;
+    ARUint8         *image;
+    ARTracker       *tracker;
+/*---*/
+    int             label_size;
+    ARInt16         *label_image;
+    int             *label_work;
+    int             *label_work2;
+    int             label_num;
+    int             *label_area;
+    int             *label_clip;
+    double          *label_pos;
+    int             image_size;
+    int             *chain;
+    ARMarkerInfo2   *marker_info2;
+    ARMarkerInfo    *marker_info;
+} ARHandle;
+
+/**
+* \brief create the context of a camera.
+*
+* The modes are those of the globals at the time; the buffers are
+* allocated at the first detection.
+* \param param the camera
+* \return the handle, NULL if error
+*/
+ARHandle *arCreateHandle( ARParam *param );
+
+/**
+* \brief free the context of a camera.
+*
+* \param handle the handle
+* \return 0
+*/
+int arDeleteHandle( ARHandle *handle );
+
+/**
+* \brief the context of the functions without handle.
+*
+* The handle is set from the globals at each call: arParam, arImXsize,
+* arImYsize, arImageProcMode, arTemplateMatchingMode, arDebug and
+* arImageL.
+* \return the handle
+*/
+ARHandle *arGetHandle( void );
+
+/**
+* \brief arDetectMarker in the context of a camera.
+*
+* The markers returned belong to the handle and stay valid until its
+* next detection.
+* \param handle the camera
+* \param dataPtr the image, of the size of the camera
+* \param thresh the threshold, as for arDetectMarker
+* \param marker_info the detected markers
+* \param marker_num their number
+* \return 0 when the function completes normally, -1 otherwise
+*/
+int arHandleDetectMarker( ARHandle *handle, ARUint8 *dataPtr, int thresh,
+                          ARMarkerInfo **marker_info, int *marker_num );
+
+/**
+* \brief arDetectMarkerLite in the context of a camera.
+*
+* \param handle the camera
+* \param dataPtr the image, of the size of the camera
+* \param thresh the threshold, as for arDetectMarker
+* \param marker_info the detected markers
+* \param marker_num their number
+* \return 0 when the function completes normally, -1 otherwise
+*/
+int arHandleDetectMarkerLite( ARHandle *handle, ARUint8 *dataPtr, int thresh,
+                              ARMarkerInfo **marker_info, int *marker_num );
+
+/**
+* \brief arGetTransMat with the camera of a handle.
+*
+* \param handle the camera
+* \param marker_info the marker, as for arGetTransMat
+* \param center the center of the marker
+* \param width the width of the marker
+* \param conv the transformation matrix found
+* \return the fitting error, -1 if no pose was found
+*/
+double arHandleGetTransMat( ARHandle *handle, ARMarkerInfo *marker_info,
+                            double center[2], double width, double conv[3][4] );
+
+/**
+* \brief arLabeling in the context of a camera.
+*
+* The results belong to the handle.
+*/
+ARInt16 *arHandleLabeling( ARHandle *handle, ARUint8 *image, int thresh,
+                           int *label_num, int **area, double **pos, int **clip,
+                           int **label_ref );
+
+/**
+* \brief arDetectMarker2 in the context of a camera.
+*
+* The results belong to the handle.
+*/
+ARMarkerInfo2 *arHandleDetectMarker2( ARHandle *handle, ARInt16 *limage,
+                                      int label_num, int *label_ref,
+                                      int *warea, double *wpos, int *wclip,
+                                      int area_max, int area_min, double factor,
+                                      int *marker_num );
+
+/**
+* \brief arGetMarkerInfo in the context of a camera.
+*
+* The results belong to the handle.
+*/
+ARMarkerInfo *arHandleGetMarkerInfo( ARHandle *handle, ARUint8 *image,
+                                     ARMarkerInfo2 *marker_info2, int *marker_num );
+
+/**
+* \brief arGetCode in the context of a camera.
+*/
+int arHandleGetCode( ARHandle *handle, ARUint8 *image, int *x_coord, int *y_coord,
+                     int *vertex, int *code, int *dir, double *cf );
+
+/**
+* \brief arGetLine with the camera of a handle.
+*/
+int arHandleGetLine( ARHandle *handle, int x_coord[], int y_coord[], int coord_num,
+                     int vertex[], double line[4][3], double v[4][2] );
+
+/** \struct ARPipelineFrame
+* \brief a frame of an ARPipeline
+*
+* \param image the copy of the captured image, of the size of the camera
+* \param serial the number of the frame, from 0
+* \param time_capture when the image was captured (arUtilGetTime)
+* \param time_detect when its detection was done
+* \param time_pose when its poses were done
+* \param marker_info the detected markers, as arHandleDetectMarker
+* \param marker_num their number
+* \param conv the pose of each marker, as arGetTransMat
+* \param err the fitting error of each pose, -1 when there is none: the
+*            pattern of the marker has no width, or no pose was found
+*/
+typedef struct {
+    ARUint8       *image;
+    int           serial;
+    double        time_capture;
+    double        time_detect;
+    double        time_pose;
+    ARMarkerInfo  marker_info[AR_SQUARE_MAX*2];
+    int           marker_num;
+    double        conv[AR_SQUARE_MAX*2][3][4];
+    double        err[AR_SQUARE_MAX*2];
+/*---*/
+    int           state;
+} ARPipelineFrame;
+
+/** \struct ARPipeline
+* \brief capture, detection and pose of a camera on their own threads
+*
+* The frames of the camera go through the capture, detection and pose
+* stages, each on its thread, and are then given to the caller to be
+* drawn: frame N+1 is detected while frame N is posed and drawn, so the
+* rate is that of the slowest stage rather than that of all of them. A
+* ring of depth frames bounds the queues between the stages; when the
+* caller falls behind, capture waits and the camera drops frames.
+* Without threads (AR_POSE_THREAD_MAX 0) arPipelineGetFrame runs the
+* stages of each frame itself.
+*
+* The detection is that of the handle and uses its tracker; the handle
+* must not be used elsewhere while the pipeline runs.
+* \param handle the camera
+* \param thresh the threshold of the detection
+* \param frame_num the depth of the pipeline
+*/
+typedef struct {
+    ARHandle         *handle;
+    int              thresh;
+    int              frame_num;
+/*---*/
+    ARUint8          *(*capture)(void *userdata);
+    int              (*capture_next)(void *userdata);
+    void             *userdata;
+    ARPipelineFrame  *frame;
+    int              next[4];
+    int              serial;
+    double           patt_width[AR_PIPELINE_PATT_MAX];
+    double           patt_center[AR_PIPELINE_PATT_MAX][2];
+    void             *sync;
+} ARPipeline;
+
+/**
+* \brief start the pipeline of a camera.
+*
+* capture returns the current image of the camera, NULL when there is
+* none yet; it is copied, then capture_next (which may be NULL) lets
+* the camera go on, as arVideoGetImage and arVideoCapNext. Both are
+* called from the capture thread.
+* \param handle the camera
+* \param thresh the threshold of the detection
+* \param depth the number of frames, AR_PIPELINE_DEPTH if 0; one per
+*              stage and one for the caller keeps all the stages busy
+* \param capture get the current image
+* \param capture_next release it
+* \param userdata given to capture and capture_next
+* \return the pipeline, NULL if error
+*/
+ARPipeline *arCreatePipeline( ARHandle *handle, int thresh, int depth,
+                              ARUint8 *(*capture)(void *userdata),
+                              int (*capture_next)(void *userdata),
+                              void *userdata );
+
+/**
+* \brief stop a pipeline and free it.
+*
+* The frames still held by the caller are freed with it.
+* \param pipeline the pipeline
+* \return 0
+*/
+int arDeletePipeline( ARPipeline *pipeline );
+
+/**
+* \brief set the size of a pattern for the pose stage.
+*
+* The markers of the patterns with a width are posed, the others only
+* detected.
+* \param pipeline the pipeline
+* \param patt_id the pattern, as returned by arLoadPatt, or the id of a
+*        matrix code with AR_MATRIX_CODE_DETECTION
+* \param center the physical center of the marker
+* \param width the size of the marker (in mm), 0 not to pose it
+* \return 0 if ok, -1 if patt_id is out of range (AR_PIPELINE_PATT_MAX)
+*/
+int arPipelineSetPatt( ARPipeline *pipeline, int patt_id, double center[2], double width );
+
+/**
+* \brief the next frame done by the pipeline.
+*
+* The frames come in the order they were captured. The frame belongs to
+* the caller until arPipelineReleaseFrame.
+* \param pipeline the pipeline
+* \param wait wait for the frame if it is not done yet
+* \return the frame, NULL if none was done (or none can be captured
+*         while the caller holds them all)
+*/
+ARPipelineFrame *arPipelineGetFrame( ARPipeline *pipeline, int wait );
+
+/**
+* \brief give a frame back to the pipeline once it is drawn.
+*
+* \param pipeline the pipeline
+* \param frame the frame from arPipelineGetFrame
+* \return 0 if ok, -1 if the frame was not held
+*/
+int arPipelineReleaseFrame( ARPipeline *pipeline, ARPipelineFrame *frame );
+
 
 /*------------------------------------*/
 
@@ -777,6 +1571,7 @@ extern ARSParam arsParam;
 extern double   arsMatR2L[3][4];
 
 int           arsInitCparam      ( ARSParam *sparam );
+ARHandle     *arsGetHandle       ( int LorR );
 void          arsGetImgFeature   ( int *num, int **area, int **clip, double **pos, int LorR );
 ARInt16      *arsLabeling        ( ARUint8 *image, int thresh,
                                    int *label_num, int **area, double **pos, int **clip,
@@ -789,6 +1584,24 @@ int           arsDetectMarker    ( ARUint8 *dataPtr, int thresh,
                                    ARMarkerInfo **marker_info, int *marker_num, int LorR );
 int           arsDetectMarkerLite( ARUint8 *dataPtr, int thresh,
                                    ARMarkerInfo **marker_info, int *marker_num, int LorR );
+/**
+* \brief compute the pose of a marker seen by a stereo pair.
+*
+* The pose is solved in the left camera coordinates from the corners
+* found in both images together; transR is matL2R * transL. It is
+* refined with arsModifyMatrixLM or arsModifyMatrix, following
+* arPoseRefineMode, under arTransMatSetting. arsGetTransMatCont starts
+* from the previous pose and arsGetTransMat2 from given points.
+* \param marker_infoL the marker in the left image, NULL if it was only
+*        found in the right one.
+* \param marker_infoR the marker in the right image, NULL if it was only
+*        found in the left one.
+* \param center the physical center of the marker.
+* \param width the size of the marker.
+* \param transL resulted pose in the left camera coordinates.
+* \param transR resulted pose in the right camera coordinates.
+* \return mean squared reprojection error, -1 if no pose was found.
+*/
 double        arsGetTransMat     ( ARMarkerInfo *marker_infoL, ARMarkerInfo *marker_infoR,
                                    double center[2], double width,
                                    double transL[3][4], double transR[3][4] );
@@ -808,6 +1621,27 @@ int           arsCheckMarkerPosition( ARMarkerInfo *marker_infoL, ARMarkerInfo *
 double arsModifyMatrix( double rot[3][3], double trans[3], ARSParam *arsParam,
                         double pos3dL[][3], double pos2dL[][2], int numL,
                         double pos3dR[][3], double pos2dR[][2], int numR );
+/**
+* \brief refine a stereo pose by minimizing the reprojection error.
+*
+* The stereo version of arModifyMatrixLM: Levenberg-Marquardt on the
+* pose in the left camera coordinates, over the points of both images.
+* The right camera projects through matR * matL2R.
+* \param rot rotation, refined in place.
+* \param trans translation, refined in place.
+* \param arsParam parameters of the stereo pair.
+* \param pos3dL 3D positions of the points seen by the left camera.
+* \param pos2dL observed 2D positions of the points in the left image.
+* \param numL number of points in the left image.
+* \param pos3dR 3D positions of the points seen by the right camera.
+* \param pos2dR observed 2D positions of the points in the right image.
+* \param numR number of points in the right image.
+* \return mean squared reprojection error over both images, -1 if there
+*         is no point or one projects to infinity.
+*/
+double arsModifyMatrixLM( double rot[3][3], double trans[3], ARSParam *arsParam,
+                          double pos3dL[][3], double pos2dL[][2], int numL,
+                          double pos3dR[][3], double pos2dR[][2], int numR );
 
 #ifdef __cplusplus
 }
@@ -45,6 +45,17 @@ extern "C" {
 //	Public types and defines.
 // ============================================================================
 
+/** \def AR_MULTI_WORK_SIZE
+* \brief number of doubles of scratch arMultiGetTransMatWork needs
+* for a configuration of marker_num markers.
+*/
+#define AR_MULTI_WORK_SIZE(marker_num)   ((marker_num)*65)
+
+/** \def AR_MULTI_HASH_SIZE
+* \brief number of buckets of the pattern index of ARMultiRegistryT (a power of 2)
+*/
+#define AR_MULTI_HASH_SIZE               256
+
 	/** \struct ARMultiEachMarkerInfoT
 * \brief multi-marker structure
 *
@@ -91,6 +102,39 @@ typedef struct {
     double                  transR[3][4];
 } ARMultiMarkerInfoT;
 
+/** \struct ARMultiRegistryT
+* \brief set of multi-marker patterns tracked from the same detection
+*
+* Patterns are added with arMultiAddConfig and stay owned by the caller.
+* Every member is indexed by its patt_id, so that one pass over the
+* detected markers finds the members of all the patterns.
+* \param config the patterns
+* \param err fitting error of each pattern from the last
+*            arMultiGetTransMatAll, -1 if it was not found
+* \param config_num number of patterns
+*/
+typedef struct {
+    ARMultiMarkerInfoT      **config;
+    double                  *err;
+    int                     config_num;
+/*---*/
+    int                     config_max;
+    double                  **work;
+    int                     hash[AR_MULTI_HASH_SIZE];
+    int                     (*entry)[4];
+    int                     entry_num;
+    int                     entry_max;
+} ARMultiRegistryT;
+
+/** \struct ARMultiRefineT
+* \brief refinement of the member transforms of a multi-marker pattern
+*
+* Keeps the frames a pattern is tracked in and refines the transform of
+* its members from them (bundle adjustment), in a worker thread when
+* AR_POSE_THREAD_MAX > 0. Created by arMultiCreateRefine.
+*/
+typedef struct _ARMultiRefineT ARMultiRefineT;
+
 // ============================================================================
 //	Public globals.
 // ============================================================================
@@ -115,6 +159,8 @@ ARMultiMarkerInfoT *arMultiReadConfigFile( const char *filename );
 * 
 * calculate the transformation between the multi-marker patterns and the real camera. Based on 
 * confident values of detected markers in the multi-markers patterns, a global position is return.
+* The pose is found by RANSAC over the markers, one marker giving a hypothesis: the markers that
+* do not agree with it (misidentified ones) are left out of the fit and their visible flag is -1.
 *
 * \param marker_info list of detected markers (from arDetectMarker)
 * \param marker_num number of detected markers
@@ -124,6 +170,22 @@ ARMultiMarkerInfoT *arMultiReadConfigFile( const char *filename );
 double  arMultiGetTransMat(ARMarkerInfo *marker_info, int marker_num,
                            ARMultiMarkerInfoT *config);
 
+/**
+* \brief compute camera position in function of the multi-marker patterns, with caller's scratch
+*
+* Same as arMultiGetTransMat, without allocating: the poses of the
+* members and the points of the joint fit are kept in work, which the
+* caller owns and can reuse from frame to frame.
+*
+* \param marker_info list of detected markers (from arDetectMarker)
+* \param marker_num number of detected markers
+* \param config the multi-marker pattern
+* \param work scratch of AR_MULTI_WORK_SIZE(config->marker_num) doubles
+* \return the fitting error, -1 if the pattern was not found
+*/
+double  arMultiGetTransMatWork(ARMarkerInfo *marker_info, int marker_num,
+                               ARMultiMarkerInfoT *config, double *work);
+
 /**
 * \brief activate a multi-marker pattern on the recognition procedure.
 *
@@ -149,11 +211,115 @@ int arMultiDeactivate( ARMultiMarkerInfoT *config );
 *
 * desactivate a pattern and remove it from memory. Post-condition
 * of this function is unavailability of the multi-marker pattern.
+* The patterns of its members are released once each, those also used
+* by other multi-markers stay loaded for them.
 * \param config pointer to the multi-marker
 * \return 0 if success, -1 if error
 */
 int arMultiFreeConfig( ARMultiMarkerInfoT *config );
 
+/**
+* \brief create an empty set of multi-marker patterns.
+*
+* \return the set, NULL if error
+*/
+ARMultiRegistryT *arMultiCreateRegistry( void );
+
+/**
+* \brief add a multi-marker pattern to a set.
+*
+* \param registry the set
+* \param config the pattern, which stays owned by the caller
+* \return the index of the pattern in the set, -1 if error
+*/
+int arMultiAddConfig( ARMultiRegistryT *registry, ARMultiMarkerInfoT *config );
+
+/**
+* \brief remove a multi-marker pattern from a set.
+*
+* The pattern itself is not freed. The patterns after it move down by one.
+* \param registry the set
+* \param config the pattern
+* \return 0 if success, -1 if the pattern is not in the set
+*/
+int arMultiRemoveConfig( ARMultiRegistryT *registry, ARMultiMarkerInfoT *config );
+
+/**
+* \brief free a set of multi-marker patterns, not the patterns.
+*
+* \param registry the set
+* \return 0
+*/
+int arMultiFreeRegistry( ARMultiRegistryT *registry );
+
+/**
+* \brief compute the position of every multi-marker pattern of a set.
+*
+* Same as arMultiGetTransMat for each pattern, from a single pass over
+* the detected markers. The reassociation of the patterns found in the
+* previous frame is done first for all of them, then the pose of each
+* pattern is solved, in parallel by AR_POSE_THREAD_MAX worker threads
+* and the calling thread.
+* \param marker_info list of detected markers (from arDetectMarker)
+* \param marker_num number of detected markers
+* \param registry the set; each pattern gets its trans, and its
+*                 fitting error in registry->err
+* \return the number of patterns found
+*/
+int arMultiGetTransMatAll( ARMarkerInfo *marker_info, int marker_num,
+                           ARMultiRegistryT *registry );
+
+/**
+* \brief start refining the member transforms of a multi-marker pattern.
+*
+* The transforms read from the configuration file are measured by hand;
+* once enough frames of the pattern are kept they are refined together
+* with the poses of these frames, minimizing the reprojection error of
+* all the corners. The member seen the most keeps its transform and so
+* the coordinates of the pattern.
+* \param config the pattern, which must stay allocated
+* \param frame_max number of frames kept (at least 2); the oldest is
+*                  replaced by a new one, and a refinement starts each
+*                  time a quarter of them are new
+* \return the refinement, NULL if error
+*/
+ARMultiRefineT *arMultiCreateRefine( ARMultiMarkerInfoT *config, int frame_max );
+
+/**
+* \brief keep a frame of the pattern for the refinement.
+*
+* To be called after arMultiGetTransMat found the pattern, with the same
+* detected markers. Only frames with at least 2 members seen, and whose
+* view differs from that of the previous frame kept, are kept.
+* \param refine the refinement
+* \param marker_info the detected markers given to arMultiGetTransMat
+* \return 1 if the frame was kept, 0 if not
+*/
+int arMultiRefineAddFrame( ARMultiRefineT *refine, ARMarkerInfo *marker_info );
+
+/**
+* \brief apply the result of the last refinement to the pattern.
+*
+* Copies the refined trans, itrans and pos3d into the members of the
+* pattern, all at once, when a refinement has finished since the last
+* call. To be called from the thread tracking the pattern, between two
+* arMultiGetTransMat. Without worker threads the refinement itself runs
+* in this call.
+* \param refine the refinement
+* \param err if not NULL, the mean squared reprojection error of the
+*            corners after the refinement
+* \return 1 if the pattern was updated, 0 if not
+*/
+int arMultiRefineUpdate( ARMultiRefineT *refine, double *err );
+
+/**
+* \brief stop a refinement and free it, not the pattern.
+*
+* \param refine the refinement
+* \return 0
+*/
+int arMultiFreeRefine( ARMultiRefineT *refine );
+
 /*------------------------------------*/
 double arsMultiGetTransMat(ARMarkerInfo *marker_infoL, int marker_numL,
                            ARMarkerInfo *marker_infoR, int marker_numR,
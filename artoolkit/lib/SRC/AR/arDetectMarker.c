@@ -1,15 +1,82 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <AR/ar.h>
+#if AR_POSE_THREAD_MAX > 0
+#include <pthread.h>
+#endif
+
+/* frames a marker no longer seen is kept in the history */
+#define  PREV_KEEP_COUNT    4
+/* buckets of the spatial hash of the markers of a frame, a power of 2 */
+#define  HASH_SIZE          64
+
+/*
+ *  A detected marker continues one of the history when its centre is
+ *  closer than sqrt(0.5*area) to it, so with cells of the largest such
+ *  radius only the 3x3 cells around the history marker are looked at.
+ */
+typedef struct {
+    double  size;
+    int     head[HASH_SIZE];
+    int     next[AR_SQUARE_MAX*2];
+    int     cell[AR_SQUARE_MAX*2][2];
+} MarkerHash;
+
+#if AR_POSE_THREAD_MAX > 0
+#define  DETECT_IDLE        0
+#define  DETECT_BUSY        1
+#define  DETECT_DONE        2
+
+/*
+ *  The full detection of an async tracker: the thread detects the copy
+ *  of a frame into detect while the tracker follows its markers by
+ *  their corners; the detected markers are then tracked from that
+ *  frame into the current one and merged.
+ */
+typedef struct {
+    pthread_t        thread;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    int              state;
+    int              quit;
+    int              thresh;
+    int              result;
+    ARUint8          *image;
+    int              image_size;
+    ARTracker        detect;
+} DetectJob;
+#endif
 
 static ARMarkerInfo2          *marker_info2;
 static ARMarkerInfo           *wmarker_info;
 static int                    wmarker_num = 0;
 
-static arPrevInfo             prev_info[AR_SQUARE_MAX];
-static int                    prev_num = 0;
-
-static arPrevInfo             sprev_info[2][AR_SQUARE_MAX];
-static int                    sprev_num[2] = {0,0};
+/* the history of arDetectMarker, and of arsDetectMarker for each camera */
+static ARTracker              prev_tracker;
+static ARTracker              sprev_tracker[2];
+
+#if AR_POSE_THREAD_MAX > 0
+/* the trackers without a handle share the handles of the globals */
+static pthread_mutex_t        detect_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int  detect_marker( ARTracker *tracker, ARUint8 *dataPtr, int thresh, int LorR );
+static ARMarkerInfo *get_marker_info( ARHandle *handle, ARUint8 *dataPtr, int thresh, int *marker_num );
+static ARMarkerInfo *global_marker_info( ARUint8 *dataPtr, int thresh, int LorR );
+static void track_marker( ARTracker *tracker );
+static void keep_history( ARTracker *tracker, MarkerHash *hash );
+static void make_hash( MarkerHash *hash, ARTracker *tracker );
+static void add_hash( MarkerHash *hash, ARMarkerInfo *marker_info, int id );
+static int  find_marker( MarkerHash *hash, ARMarkerInfo *marker_info, ARMarkerInfo *prev );
+#if AR_POSE_THREAD_MAX > 0
+static int  async_detect_marker( ARTracker *tracker, ARUint8 *dataPtr, int thresh );
+static void merge_marker( ARTracker *tracker, DetectJob *job, ARUint8 *dataPtr );
+static DetectJob *create_job( ARHandle *handle );
+static void free_job( DetectJob *job );
+static void *detect_worker( void *arg );
+#endif
 
 int arSavePatt( ARUint8 *image, ARMarkerInfo *marker_info, char *filename )
 {
@@ -58,110 +125,93 @@ int arSavePatt( ARUint8 *image, ARMarkerInfo *marker_info, char *filename )
 int arDetectMarker( ARUint8 *dataPtr, int thresh,
                     ARMarkerInfo **marker_info, int *marker_num )
 {
-    ARInt16                *limage;
-    int                    label_num;
-    int                    *area, *clip, *label_ref;
-    double                 *pos;
-    double                 rarea, rlen, rlenmin;
-    double                 diff, diffmin;
-    int                    cid, cdir;
-    int                    i, j, k;
+    prev_tracker.interval = arDetectInterval;
+    prev_tracker.async    = arDetectAsync;
 
-    *marker_num = 0;
+    return arTrackerDetectMarker( &prev_tracker, dataPtr, thresh, marker_info, marker_num );
+}
 
-    limage = arLabeling( dataPtr, thresh,
-                         &label_num, &area, &pos, &clip, &label_ref );
-    if( limage == 0 )    return -1;
+ARTracker *arCreateTracker( void )
+{
+    ARTracker   *tracker;
+
+    tracker = (ARTracker *)malloc( sizeof(ARTracker) );
+    if( tracker == NULL ) return NULL;
+    tracker->prev_num   = 0;
+    tracker->marker_num = 0;
+    tracker->interval   = arDetectInterval;
+    tracker->async      = arDetectAsync;
+    tracker->stereo     = 0;
+    tracker->frame      = 0;
+    tracker->track_num  = 0;
+    tracker->patch      = NULL;
+    tracker->job        = NULL;
+    tracker->handle     = NULL;
+
+    return tracker;
+}
 
-    marker_info2 = arDetectMarker2( limage, label_num, label_ref,
-                                    area, pos, clip, AR_AREA_MAX, AR_AREA_MIN,
-                                    1.0, &wmarker_num);
-    if( marker_info2 == 0 ) return -1;
+int arFreeTracker( ARTracker *tracker )
+{
+#if AR_POSE_THREAD_MAX > 0
+    if( tracker->job != NULL ) free_job( (DetectJob *)tracker->job );
+#endif
+    free( tracker->patch );
+    free( tracker );
 
-    wmarker_info = arGetMarkerInfo( dataPtr, marker_info2, &wmarker_num );
-    if( wmarker_info == 0 ) return -1;
+    return 0;
+}
 
-    for( i = 0; i < prev_num; i++ ) {
-        rlenmin = 10.0;
-        cid = -1;
-        for( j = 0; j < wmarker_num; j++ ) {
-            rarea = (double)prev_info[i].marker.area / (double)wmarker_info[j].area;
-            if( rarea < 0.7 || rarea > 1.43 ) continue;
-            rlen = ( (wmarker_info[j].pos[0] - prev_info[i].marker.pos[0])
-                   * (wmarker_info[j].pos[0] - prev_info[i].marker.pos[0])
-                   + (wmarker_info[j].pos[1] - prev_info[i].marker.pos[1])
-                   * (wmarker_info[j].pos[1] - prev_info[i].marker.pos[1]) ) / wmarker_info[j].area;
-            if( rlen < 0.5 && rlen < rlenmin ) {
-                rlenmin = rlen;
-                cid = j;
-            }
-        }
-        if( cid >= 0 && wmarker_info[cid].cf < prev_info[i].marker.cf ) {
-            wmarker_info[cid].cf = prev_info[i].marker.cf;
-            wmarker_info[cid].id = prev_info[i].marker.id;
-            diffmin = 10000.0 * 10000.0;
-            cdir = -1;
-            for( j = 0; j < 4; j++ ) {
-                diff = 0;
-                for( k = 0; k < 4; k++ ) {
-                    diff += (prev_info[i].marker.vertex[k][0] - wmarker_info[cid].vertex[(j+k)%4][0])
-                          * (prev_info[i].marker.vertex[k][0] - wmarker_info[cid].vertex[(j+k)%4][0])
-                          + (prev_info[i].marker.vertex[k][1] - wmarker_info[cid].vertex[(j+k)%4][1])
-                          * (prev_info[i].marker.vertex[k][1] - wmarker_info[cid].vertex[(j+k)%4][1]);
-                }
-                if( diff < diffmin ) {
-                    diffmin = diff;
-                    cdir = (prev_info[i].marker.dir - j + 4) % 4;
-                }
-            }
-            wmarker_info[cid].dir = cdir;
-        }
+int arTrackerDetectMarker( ARTracker *tracker, ARUint8 *dataPtr, int thresh,
+                           ARMarkerInfo **marker_info, int *marker_num )
+{
+    MarkerHash             hash;
+
+    *marker_num = 0;
+
+#if AR_POSE_THREAD_MAX > 0
+    if( tracker->async ) {
+        if( async_detect_marker( tracker, dataPtr, thresh ) < 0 ) return -1;
+        *marker_num  = tracker->marker_num;
+        *marker_info = tracker->marker_info;
+        return 0;
     }
+#endif
+
+    /* between full detections the markers are followed by their corners until one is lost */
+    if( tracker->interval > 1 && tracker->frame > 0 && tracker->frame < tracker->interval
+     && arTrackerTrackMarker( tracker, dataPtr ) == 0 ) {
+        make_hash( &hash, tracker );
+        keep_history( tracker, &hash );
+        tracker->frame++;
+    }
+    else {
+        tracker->frame = 0;
+        if( detect_marker( tracker, dataPtr, thresh, -1 ) < 0 ) return -1;
+        track_marker( tracker );
+        tracker->frame = 1;
+    }
+    if( tracker->interval > 1 ) arTrackerSetPatch( tracker, dataPtr );
 
-    for( i = 0; i < wmarker_num; i++ ) {
-/*
-	printf("cf = %g\n", wmarker_info[i].cf);
-*/
-        if( wmarker_info[i].cf < 0.5 ) wmarker_info[i].id = -1;
-   }
+    *marker_num  = tracker->marker_num;
+    *marker_info = tracker->marker_info;
 
+    return 0;
+}
 
-/*------------------------------------------------------------*/
 
-    for( i = j = 0; i < prev_num; i++ ) {
-        prev_info[i].count++;
-        if( prev_info[i].count < 4 ) {
-            prev_info[j] = prev_info[i];
-            j++;
-        }
-    }
-    prev_num = j;
+int arDetectMarkerLite( ARUint8 *dataPtr, int thresh,
+                        ARMarkerInfo **marker_info, int *marker_num )
+{
+    int                    i;
 
-    for( i = 0; i < wmarker_num; i++ ) {
-        if( wmarker_info[i].id < 0 ) continue;
+    *marker_num = 0;
 
-        for( j = 0; j < prev_num; j++ ) {
-            if( prev_info[j].marker.id == wmarker_info[i].id ) break;
-        }
-        prev_info[j].marker = wmarker_info[i];
-        prev_info[j].count  = 1;
-        if( j == prev_num ) prev_num++;
-    }
+    wmarker_info = global_marker_info( dataPtr, thresh, -1 );
+    if( wmarker_info == 0 ) return -1;
 
-    for( i = 0; i < prev_num; i++ ) {
-        for( j = 0; j < wmarker_num; j++ ) {
-            rarea = (double)prev_info[i].marker.area / (double)wmarker_info[j].area;
-            if( rarea < 0.7 || rarea > 1.43 ) continue;
-            rlen = ( (wmarker_info[j].pos[0] - prev_info[i].marker.pos[0])
-                   * (wmarker_info[j].pos[0] - prev_info[i].marker.pos[0])
-                   + (wmarker_info[j].pos[1] - prev_info[i].marker.pos[1])
-                   * (wmarker_info[j].pos[1] - prev_info[i].marker.pos[1]) ) / wmarker_info[j].area;
-            if( rlen < 0.5 ) break;
-        }
-        if( j == wmarker_num ) {
-            wmarker_info[wmarker_num] = prev_info[i].marker;
-            wmarker_num++;
-        }
+    for( i = 0; i < wmarker_num; i++ ) {
+        if( wmarker_info[i].cf < 0.5 ) wmarker_info[i].id = -1;
     }
 
 
@@ -171,28 +221,32 @@ int arDetectMarker( ARUint8 *dataPtr, int thresh,
     return 0;
 }
 
-
-int arDetectMarkerLite( ARUint8 *dataPtr, int thresh,
-                        ARMarkerInfo **marker_info, int *marker_num )
+int arsDetectMarker( ARUint8 *dataPtr, int thresh,
+                     ARMarkerInfo **marker_info, int *marker_num, int LorR )
 {
-    ARInt16                *limage;
-    int                    label_num;
-    int                    *area, *clip, *label_ref;
-    double                 *pos;
-    int                    i;
+    ARTracker   *tracker;
 
     *marker_num = 0;
 
-    limage = arLabeling( dataPtr, thresh,
-                         &label_num, &area, &pos, &clip, &label_ref );
-    if( limage == 0 )    return -1;
+    tracker = &sprev_tracker[LorR];
+    tracker->stereo = 1;
+    if( detect_marker( tracker, dataPtr, thresh, LorR ) < 0 ) return -1;
+    track_marker( tracker );
 
-    marker_info2 = arDetectMarker2( limage, label_num, label_ref,
-                                    area, pos, clip, AR_AREA_MAX, AR_AREA_MIN,
-                                    1.0, &wmarker_num);
-    if( marker_info2 == 0 ) return -1;
+    *marker_num  = tracker->marker_num;
+    *marker_info = tracker->marker_info;
+
+    return 0;
+}
+
+int arsDetectMarkerLite( ARUint8 *dataPtr, int thresh,
+                         ARMarkerInfo **marker_info, int *marker_num, int LorR )
+{
+    int                    i;
 
-    wmarker_info = arGetMarkerInfo( dataPtr, marker_info2, &wmarker_num );
+    *marker_num = 0;
+
+    wmarker_info = global_marker_info( dataPtr, thresh, LorR );
     if( wmarker_info == 0 ) return -1;
 
     for( i = 0; i < wmarker_num; i++ ) {
@@ -206,118 +260,424 @@ int arDetectMarkerLite( ARUint8 *dataPtr, int thresh,
     return 0;
 }
 
-int arsDetectMarker( ARUint8 *dataPtr, int thresh,
-                     ARMarkerInfo **marker_info, int *marker_num, int LorR )
+int arHandleDetectMarker( ARHandle *handle, ARUint8 *dataPtr, int thresh,
+                          ARMarkerInfo **marker_info, int *marker_num )
+{
+    return arTrackerDetectMarker( handle->tracker, dataPtr, thresh, marker_info, marker_num );
+}
+
+int arHandleDetectMarkerLite( ARHandle *handle, ARUint8 *dataPtr, int thresh,
+                              ARMarkerInfo **marker_info, int *marker_num )
+{
+    ARMarkerInfo           *minfo;
+    int                    num, i;
+
+    *marker_num = 0;
+
+    minfo = get_marker_info( handle, dataPtr, thresh, &num );
+    if( minfo == NULL ) return -1;
+
+    for( i = 0; i < num; i++ ) {
+        if( minfo[i].cf < 0.5 ) minfo[i].id = -1;
+    }
+
+    *marker_num  = num;
+    *marker_info = minfo;
+
+    return 0;
+}
+
+/*
+ *  detection of the frame into the markers of the tracker, in its handle
+ *  or else in the handle of the globals; LorR is -1 for a single camera
+ */
+static int detect_marker( ARTracker *tracker, ARUint8 *dataPtr, int thresh, int LorR )
+{
+    ARMarkerInfo           *minfo;
+    int                    num, i;
+
+    if( tracker->handle != NULL ) {
+        minfo = get_marker_info( tracker->handle, dataPtr, thresh, &num );
+        if( minfo == NULL ) return -1;
+        for( i = 0; i < num; i++ ) tracker->marker_info[i] = minfo[i];
+        tracker->marker_num = num;
+        return 0;
+    }
+
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_lock( &detect_mutex );
+#endif
+    minfo = global_marker_info( dataPtr, thresh, LorR );
+    if( minfo != NULL ) {
+        for( i = 0; i < wmarker_num; i++ ) tracker->marker_info[i] = minfo[i];
+        tracker->marker_num = wmarker_num;
+    }
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_unlock( &detect_mutex );
+#endif
+
+    return (minfo != NULL)? 0: -1;
+}
+
+static ARMarkerInfo *get_marker_info( ARHandle *handle, ARUint8 *dataPtr, int thresh, int *marker_num )
 {
     ARInt16                *limage;
+    ARMarkerInfo2          *minfo2;
     int                    label_num;
     int                    *area, *clip, *label_ref;
     double                 *pos;
-    double                 rarea, rlen, rlenmin;
-    double                 diff, diffmin;
-    int                    cid, cdir;
-    int                    i, j, k;
 
-    *marker_num = 0;
+    limage = arHandleLabeling( handle, dataPtr, thresh,
+                               &label_num, &area, &pos, &clip, &label_ref );
+    if( limage == 0 ) return NULL;
 
-    limage = arsLabeling( dataPtr, thresh,
-                          &label_num, &area, &pos, &clip, &label_ref, LorR );
-    if( limage == 0 )    return -1;
-
-    marker_info2 = arDetectMarker2( limage, label_num, label_ref,
+    minfo2 = arHandleDetectMarker2( handle, limage, label_num, label_ref,
                                     area, pos, clip, AR_AREA_MAX, AR_AREA_MIN,
-                                    1.0, &wmarker_num);
-    if( marker_info2 == 0 ) return -1;
+                                    1.0, marker_num );
+    if( minfo2 == 0 ) return NULL;
 
-    wmarker_info = arsGetMarkerInfo( dataPtr, marker_info2, &wmarker_num, LorR );
-    if( wmarker_info == 0 ) return -1;
+    return arHandleGetMarkerInfo( handle, dataPtr, minfo2, marker_num );
+}
 
-    for( i = 0; i < sprev_num[LorR]; i++ ) {
-        rlenmin = 10.0;
-        cid = -1;
-        for( j = 0; j < wmarker_num; j++ ) {
-            rarea = (double)sprev_info[LorR][i].marker.area / (double)wmarker_info[j].area;
-            if( rarea < 0.7 || rarea > 1.43 ) continue;
-            rlen = ( (wmarker_info[j].pos[0] - sprev_info[LorR][i].marker.pos[0])
-                   * (wmarker_info[j].pos[0] - sprev_info[LorR][i].marker.pos[0])
-                   + (wmarker_info[j].pos[1] - sprev_info[LorR][i].marker.pos[1])
-                   * (wmarker_info[j].pos[1] - sprev_info[LorR][i].marker.pos[1]) ) / wmarker_info[j].area;
-            if( rlen < 0.5 && rlen < rlenmin ) {
-                rlenmin = rlen;
-                cid = j;
-            }
-        }
-        if( cid >= 0 && wmarker_info[cid].cf < sprev_info[LorR][i].marker.cf ) {
-            wmarker_info[cid].cf = sprev_info[LorR][i].marker.cf;
-            wmarker_info[cid].id = sprev_info[LorR][i].marker.id;
+/* the detection of the functions without handle, kept for arSavePatt */
+static ARMarkerInfo *global_marker_info( ARUint8 *dataPtr, int thresh, int LorR )
+{
+    ARHandle               *handle;
+
+    handle = (LorR < 0)? arGetHandle(): arsGetHandle( LorR );
+    wmarker_info = get_marker_info( handle, dataPtr, thresh, &wmarker_num );
+    marker_info2 = handle->marker_info2;
+    if( handle->debug ) {
+        if( LorR != 0 ) arImage = arImageL = handle->image;
+        else            arImageR = handle->image;
+    }
+
+    return wmarker_info;
+}
+
+/*
+ *  The markers of the history take over the detected marker they
+ *  continue when they were identified with more confidence. The
+ *  identified markers then enter the history.
+ */
+static void track_marker( ARTracker *tracker )
+{
+    MarkerHash             hash;
+    ARMarkerInfo           *minfo;
+    arPrevInfo             *prev;
+    double                 diff, diffmin;
+    int                    cid, cdir;
+    int                    i, j, k;
+
+    minfo = tracker->marker_info;
+    prev  = tracker->prev_info;
+    make_hash( &hash, tracker );
+
+    for( i = 0; i < tracker->prev_num; i++ ) {
+        cid = find_marker( &hash, minfo, &prev[i].marker );
+        if( cid >= 0 && minfo[cid].cf < prev[i].marker.cf ) {
+            minfo[cid].cf = prev[i].marker.cf;
+            minfo[cid].id = prev[i].marker.id;
             diffmin = 10000.0 * 10000.0;
             cdir = -1;
             for( j = 0; j < 4; j++ ) {
                 diff = 0;
                 for( k = 0; k < 4; k++ ) {
-                    diff += (sprev_info[LorR][i].marker.vertex[k][0] - wmarker_info[cid].vertex[(j+k)%4][0])
-                          * (sprev_info[LorR][i].marker.vertex[k][0] - wmarker_info[cid].vertex[(j+k)%4][0])
-                          + (sprev_info[LorR][i].marker.vertex[k][1] - wmarker_info[cid].vertex[(j+k)%4][1])
-                          * (sprev_info[LorR][i].marker.vertex[k][1] - wmarker_info[cid].vertex[(j+k)%4][1]);
+                    diff += (prev[i].marker.vertex[k][0] - minfo[cid].vertex[(j+k)%4][0])
+                          * (prev[i].marker.vertex[k][0] - minfo[cid].vertex[(j+k)%4][0])
+                          + (prev[i].marker.vertex[k][1] - minfo[cid].vertex[(j+k)%4][1])
+                          * (prev[i].marker.vertex[k][1] - minfo[cid].vertex[(j+k)%4][1]);
                 }
                 if( diff < diffmin ) {
                     diffmin = diff;
-                    cdir = (sprev_info[LorR][i].marker.dir - j + 4) % 4;
+                    cdir = (prev[i].marker.dir - j + 4) % 4;
                 }
             }
-            wmarker_info[cid].dir = cdir;
+            minfo[cid].dir = cdir;
         }
     }
 
-    for( i = 0; i < wmarker_num; i++ ) {
-        if( wmarker_info[i].cf < 0.5 ) wmarker_info[i].id = -1;
+    for( i = 0; i < tracker->marker_num; i++ ) {
+        if( minfo[i].cf < 0.5 ) minfo[i].id = -1;
     }
+    tracker->track_num = tracker->marker_num;
 
-    j = 0;
-    for( i = 0; i < wmarker_num; i++ ) {
-        if( wmarker_info[i].id < 0 ) continue;
-        sprev_info[LorR][j].marker = wmarker_info[i];
-        sprev_info[LorR][j].count  = 1;
-        j++;
+    keep_history( tracker, &hash );
+}
+
+/*
+ *  For a single camera the history keeps the identified markers
+ *  PREV_KEEP_COUNT frames and adds them to the frame, detected or
+ *  tracked, while they are not found in it.
+ */
+static void keep_history( ARTracker *tracker, MarkerHash *hash )
+{
+    ARMarkerInfo           *minfo;
+    arPrevInfo             *prev;
+    int                    i, j;
+
+    minfo = tracker->marker_info;
+    prev  = tracker->prev_info;
+
+    if( tracker->stereo ) {
+        j = 0;
+        for( i = 0; i < tracker->marker_num; i++ ) {
+            if( minfo[i].id < 0 ) continue;
+            prev[j].marker = minfo[i];
+            prev[j].count  = 1;
+            j++;
+        }
+        tracker->prev_num = j;
+        return;
     }
-    sprev_num[LorR] = j;
 
-    *marker_num  = wmarker_num;
-    *marker_info = wmarker_info;
+    for( i = j = 0; i < tracker->prev_num; i++ ) {
+        prev[i].count++;
+        if( prev[i].count < PREV_KEEP_COUNT ) {
+            prev[j] = prev[i];
+            j++;
+        }
+    }
+    tracker->prev_num = j;
+
+    for( i = 0; i < tracker->marker_num; i++ ) {
+        if( minfo[i].id < 0 ) continue;
+
+        for( j = 0; j < tracker->prev_num; j++ ) {
+            if( prev[j].marker.id == minfo[i].id ) break;
+        }
+        if( j == AR_SQUARE_MAX ) continue;
+        prev[j].marker = minfo[i];
+        prev[j].count  = 1;
+        if( j == tracker->prev_num ) tracker->prev_num++;
+    }
+
+    for( i = 0; i < tracker->prev_num; i++ ) {
+        if( find_marker( hash, minfo, &prev[i].marker ) >= 0 ) continue;
+        minfo[tracker->marker_num] = prev[i].marker;
+        add_hash( hash, minfo, tracker->marker_num );
+        tracker->marker_num++;
+    }
+}
+
+#if AR_POSE_THREAD_MAX > 0
+/*
+ *  The markers of the last frame are tracked into this one; a finished
+ *  detection is merged, and the next one started on this frame.
+ */
+static int async_detect_marker( ARTracker *tracker, ARUint8 *dataPtr, int thresh )
+{
+    DetectJob   *job;
+    MarkerHash  hash;
+    int         size, state;
+
+    if( tracker->job == NULL ) {
+        tracker->job = create_job( tracker->handle );
+        if( tracker->job == NULL ) return -1;
+    }
+    job = (DetectJob *)tracker->job;
+
+    if( arTrackerTrackMarker( tracker, dataPtr ) < 0 ) {
+        tracker->marker_num = 0;
+        tracker->track_num  = 0;
+    }
+
+    pthread_mutex_lock( &job->mutex );
+    state = job->state;
+    pthread_mutex_unlock( &job->mutex );
+
+    if( state == DETECT_DONE && job->result == 0 ) merge_marker( tracker, job, dataPtr );
+    else {
+        make_hash( &hash, tracker );
+        keep_history( tracker, &hash );
+    }
+
+    if( state != DETECT_BUSY ) {
+        if( tracker->handle != NULL ) size = tracker->handle->param.xsize * tracker->handle->param.ysize * AR_PIX_SIZE_DEFAULT;
+        else                          size = arImXsize * arImYsize * AR_PIX_SIZE_DEFAULT;
+        if( job->image_size != size ) {
+            free( job->image );
+            job->image = (ARUint8 *)malloc( size );
+            job->image_size = (job->image == NULL)? 0: size;
+        }
+        if( job->image != NULL ) {
+            memcpy( job->image, dataPtr, size );
+            job->thresh = thresh;
+            pthread_mutex_lock( &job->mutex );
+            job->state = DETECT_BUSY;
+            pthread_cond_signal( &job->cond );
+            pthread_mutex_unlock( &job->mutex );
+        }
+    }
+
+    arTrackerSetPatch( tracker, dataPtr );
 
     return 0;
 }
 
-int arsDetectMarkerLite( ARUint8 *dataPtr, int thresh,
-                         ARMarkerInfo **marker_info, int *marker_num, int LorR )
+/*
+ *  The detected markers are brought to this frame by their corners.
+ *  They replace the tracked markers they continue, the others are kept,
+ *  and the whole goes through the history as a detected frame.
+ */
+static void merge_marker( ARTracker *tracker, DetectJob *job, ARUint8 *dataPtr )
 {
-    ARInt16                *limage;
-    int                    label_num;
-    int                    *area, *clip, *label_ref;
-    double                 *pos;
-    int                    i;
+    ARTracker       *detect;
+    ARMarkerInfo    wmarker[AR_SQUARE_MAX*2];
+    MarkerHash      hash;
+    int             num, i;
+
+    detect = &(job->detect);
+    detect->track_num = detect->marker_num;
+    if( arTrackerSetPatch( detect, job->image ) < 0
+     || arTrackerTrackMarker( detect, dataPtr ) < 0 ) detect->marker_num = 0;
+
+    num = tracker->track_num;
+    for( i = 0; i < num; i++ ) wmarker[i] = tracker->marker_info[i];
+    for( i = 0; i < detect->marker_num; i++ ) tracker->marker_info[i] = detect->marker_info[i];
+    tracker->marker_num = detect->marker_num;
+
+    make_hash( &hash, tracker );
+    for( i = 0; i < num && tracker->marker_num < AR_SQUARE_MAX; i++ ) {
+        if( find_marker( &hash, tracker->marker_info, &wmarker[i] ) >= 0 ) continue;
+        tracker->marker_info[tracker->marker_num] = wmarker[i];
+        tracker->marker_num++;
+    }
 
-    *marker_num = 0;
+    track_marker( tracker );
+}
 
-    limage = arsLabeling( dataPtr, thresh,
-                          &label_num, &area, &pos, &clip, &label_ref, LorR );
-    if( limage == 0 )    return -1;
+/* the handle is set before the detection thread starts, it only reads it */
+static DetectJob *create_job( ARHandle *handle )
+{
+    DetectJob   *job;
+
+    job = (DetectJob *)malloc( sizeof(DetectJob) );
+    if( job == NULL ) return NULL;
+    job->state      = DETECT_IDLE;
+    job->quit       = 0;
+    job->image      = NULL;
+    job->image_size = 0;
+    job->detect.prev_num   = 0;
+    job->detect.marker_num = 0;
+    job->detect.interval   = 0;
+    job->detect.async      = 0;
+    job->detect.stereo     = 0;
+    job->detect.frame      = 0;
+    job->detect.track_num  = 0;
+    job->detect.patch      = NULL;
+    job->detect.job        = NULL;
+    job->detect.handle     = handle;
+    pthread_mutex_init( &job->mutex, NULL );
+    pthread_cond_init( &job->cond, NULL );
+    if( pthread_create( &job->thread, NULL, detect_worker, job ) != 0 ) {
+        pthread_cond_destroy( &job->cond );
+        pthread_mutex_destroy( &job->mutex );
+        free( job );
+        return NULL;
+    }
 
-    marker_info2 = arDetectMarker2( limage, label_num, label_ref,
-                                    area, pos, clip, AR_AREA_MAX, AR_AREA_MIN,
-                                    1.0, &wmarker_num);
-    if( marker_info2 == 0 ) return -1;
+    return job;
+}
 
-    wmarker_info = arsGetMarkerInfo( dataPtr, marker_info2, &wmarker_num, LorR );
-    if( wmarker_info == 0 ) return -1;
+static void free_job( DetectJob *job )
+{
+    pthread_mutex_lock( &job->mutex );
+    job->quit = 1;
+    pthread_cond_signal( &job->cond );
+    pthread_mutex_unlock( &job->mutex );
+    pthread_join( job->thread, NULL );
+
+    pthread_cond_destroy( &job->cond );
+    pthread_mutex_destroy( &job->mutex );
+    free( job->detect.patch );
+    free( job->image );
+    free( job );
+}
 
-    for( i = 0; i < wmarker_num; i++ ) {
-        if( wmarker_info[i].cf < 0.5 ) wmarker_info[i].id = -1;
+static void *detect_worker( void *arg )
+{
+    DetectJob   *job;
+
+    job = (DetectJob *)arg;
+    pthread_mutex_lock( &job->mutex );
+    for(;;) {
+        while( job->state != DETECT_BUSY && !job->quit ) pthread_cond_wait( &job->cond, &job->mutex );
+        if( job->quit ) break;
+        pthread_mutex_unlock( &job->mutex );
+
+        job->result = detect_marker( &(job->detect), job->image, job->thresh, -1 );
+
+        pthread_mutex_lock( &job->mutex );
+        job->state = DETECT_DONE;
     }
+    pthread_mutex_unlock( &job->mutex );
 
+    return NULL;
+}
+#endif
 
-    *marker_num  = wmarker_num;
-    *marker_info = wmarker_info;
+/* cells of the radius of the largest marker of the frame or the history */
+static void make_hash( MarkerHash *hash, ARTracker *tracker )
+{
+    int     amax, i;
 
-    return 0;
+    amax = 1;
+    for( i = 0; i < tracker->marker_num; i++ ) {
+        if( tracker->marker_info[i].area > amax ) amax = tracker->marker_info[i].area;
+    }
+    for( i = 0; i < tracker->prev_num; i++ ) {
+        if( tracker->prev_info[i].marker.area > amax ) amax = tracker->prev_info[i].marker.area;
+    }
+    hash->size = sqrt( 0.5 * amax ) + 1.0;
+
+    for( i = 0; i < HASH_SIZE; i++ ) hash->head[i] = -1;
+    for( i = 0; i < tracker->marker_num; i++ ) add_hash( hash, tracker->marker_info, i );
+}
+
+#define  HASH_CELL(x, y)   ((((unsigned int)(x) * 73856093U) ^ ((unsigned int)(y) * 19349663U)) & (HASH_SIZE-1))
+
+static void add_hash( MarkerHash *hash, ARMarkerInfo *marker_info, int id )
+{
+    int     cx, cy, h;
+
+    cx = (int)floor( marker_info[id].pos[0] / hash->size );
+    cy = (int)floor( marker_info[id].pos[1] / hash->size );
+    h = HASH_CELL( cx, cy );
+    hash->cell[id][0] = cx;
+    hash->cell[id][1] = cy;
+    hash->next[id] = hash->head[h];
+    hash->head[h] = id;
+}
+
+/* the marker of the frame closest to prev, the first one on a tie; -1 if none */
+static int find_marker( MarkerHash *hash, ARMarkerInfo *marker_info, ARMarkerInfo *prev )
+{
+    double  rarea, rlen, rlenmin;
+    int     cx, cy, dx, dy, cid, j;
+
+    cx = (int)floor( prev->pos[0] / hash->size );
+    cy = (int)floor( prev->pos[1] / hash->size );
+    rlenmin = 10.0;
+    cid = -1;
+    for( dy = -1; dy <= 1; dy++ ) {
+        for( dx = -1; dx <= 1; dx++ ) {
+            for( j = hash->head[HASH_CELL(cx+dx, cy+dy)]; j >= 0; j = hash->next[j] ) {
+                if( hash->cell[j][0] != cx+dx || hash->cell[j][1] != cy+dy ) continue;
+                rarea = (double)prev->area / (double)marker_info[j].area;
+                if( rarea < 0.7 || rarea > 1.43 ) continue;
+                rlen = ( (marker_info[j].pos[0] - prev->pos[0])
+                       * (marker_info[j].pos[0] - prev->pos[0])
+                       + (marker_info[j].pos[1] - prev->pos[1])
+                       * (marker_info[j].pos[1] - prev->pos[1]) ) / marker_info[j].area;
+                if( rlen >= 0.5 ) continue;
+                if( rlen < rlenmin || (rlen == rlenmin && j < cid) ) {
+                    rlenmin = rlen;
+                    cid = j;
+                }
+            }
+        }
+    }
+
+    return cid;
 }
@@ -9,34 +9,53 @@
  *
 *******************************************************/
 
+#include <stdlib.h>
 #include <AR/ar.h>
 
+static int get_contour( ARHandle *handle, ARInt16 *limage, int *label_ref,
+                        int label, int clip[4], ARMarkerInfo2 *marker_info2 );
+
 static int check_square( int area, ARMarkerInfo2 *marker_info2, double factor );
 
 static int get_vertex( int x_coord[], int y_coord[], int st, int ed,
                        double thresh, int vertex[], int *vnum );
 
-static ARMarkerInfo2    marker_info2[AR_SQUARE_MAX];
-
 ARMarkerInfo2 *arDetectMarker2( ARInt16 *limage, int label_num, int *label_ref,
                                 int *warea, double *wpos, int *wclip,
                                 int area_max, int area_min, double factor, int *marker_num )
 {
+    return arHandleDetectMarker2( arGetHandle(), limage, label_num, label_ref,
+                                  warea, wpos, wclip, area_max, area_min, factor, marker_num );
+}
+
+ARMarkerInfo2 *arHandleDetectMarker2( ARHandle *handle, ARInt16 *limage,
+                                      int label_num, int *label_ref,
+                                      int *warea, double *wpos, int *wclip,
+                                      int area_max, int area_min, double factor,
+                                      int *marker_num )
+{
+    ARMarkerInfo2     *marker_info2;
     ARMarkerInfo2     *pm;
     int               xsize, ysize;
     int               marker_num2;
     int               i, j, ret;
     double            d;
 
-    if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
+    if( handle->marker_info2 == NULL ) {
+        handle->marker_info2 = (ARMarkerInfo2 *)malloc( AR_SQUARE_MAX*sizeof(ARMarkerInfo2) );
+        if( handle->marker_info2 == NULL ) return(0);
+    }
+    marker_info2 = handle->marker_info2;
+
+    if( handle->imageProcMode == AR_IMAGE_PROC_IN_HALF ) {
         area_min /= 4;
         area_max /= 4;
-        xsize = arImXsize / 2;
-        ysize = arImYsize / 2;
+        xsize = handle->param.xsize / 2;
+        ysize = handle->param.ysize / 2;
     }
     else {
-        xsize = arImXsize;
-        ysize = arImYsize;
+        xsize = handle->param.xsize;
+        ysize = handle->param.ysize;
     }
     marker_num2 = 0;
     for(i=0; i<label_num; i++ ) {
@@ -44,7 +63,7 @@ ARMarkerInfo2 *arDetectMarker2( ARInt16 *limage, int label_num, int *label_ref,
         if( wclip[i*4+0] == 1 || wclip[i*4+1] == xsize-2 ) continue;
         if( wclip[i*4+2] == 1 || wclip[i*4+3] == ysize-2 ) continue;
 
-        ret = arGetContour( limage, label_ref, i+1,
+        ret = get_contour( handle, limage, label_ref, i+1,
                             &(wclip[i*4]), &(marker_info2[marker_num2]));
         if( ret < 0 ) continue;
 
@@ -85,7 +104,7 @@ ARMarkerInfo2 *arDetectMarker2( ARInt16 *limage, int label_num, int *label_ref,
         }
     }
 
-    if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
+    if( handle->imageProcMode == AR_IMAGE_PROC_IN_HALF ) {
         pm = &(marker_info2[0]);
         for( i = 0; i < marker_num2; i++ ) {
             pm->area *= 4;
@@ -105,24 +124,36 @@ ARMarkerInfo2 *arDetectMarker2( ARInt16 *limage, int label_num, int *label_ref,
 
 int arGetContour( ARInt16 *limage, int *label_ref,
                   int label, int clip[4], ARMarkerInfo2 *marker_info2 )
+{
+    return get_contour( arGetHandle(), limage, label_ref, label, clip, marker_info2 );
+}
+
+static int get_contour( ARHandle *handle, ARInt16 *limage, int *label_ref,
+                        int label, int clip[4], ARMarkerInfo2 *marker_info2 )
 {
     static int      xdir[8] = { 0, 1, 1, 1, 0,-1,-1,-1};
     static int      ydir[8] = {-1,-1, 0, 1, 1, 1, 0,-1};
-    static int      wx[AR_CHAIN_MAX];
-    static int      wy[AR_CHAIN_MAX];
+    int             *wx, *wy;
     ARInt16         *p1;
     int             xsize, ysize;
     int             sx, sy, dir;
     int             dmax, d, v1;
     int             i, j;
 
-    if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
-        xsize = arImXsize / 2;
-        ysize = arImYsize / 2;
+    if( handle->chain == NULL ) {
+        handle->chain = (int *)malloc( AR_CHAIN_MAX*2*sizeof(int) );
+        if( handle->chain == NULL ) return(-1);
+    }
+    wx = &(handle->chain[0]);
+    wy = &(handle->chain[AR_CHAIN_MAX]);
+
+    if( handle->imageProcMode == AR_IMAGE_PROC_IN_HALF ) {
+        xsize = handle->param.xsize / 2;
+        ysize = handle->param.ysize / 2;
     }
     else {
-        xsize = arImXsize;
-        ysize = arImYsize;
+        xsize = handle->param.xsize;
+        ysize = handle->param.ysize;
     }
     j = clip[2];
     p1 = &(limage[j*xsize+clip[0]]);
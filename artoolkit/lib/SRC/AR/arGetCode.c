@@ -17,12 +17,63 @@
 #define   DEBUG        0
 #define   EVEC_MAX     10
 
+/* coarse blocks used to bound the correlation in pattern_match() */
+#define   BLK_SIZE     4
+#define   BLK_X        (AR_PATT_SIZE_X/BLK_SIZE)
+#define   BLK_Y        (AR_PATT_SIZE_Y/BLK_SIZE)
+#define   BLK_NUM      (BLK_X*BLK_Y)
+#if (AR_PATT_SIZE_X % BLK_SIZE) || (AR_PATT_SIZE_Y % BLK_SIZE)
+#  error AR_PATT_SIZE_X and AR_PATT_SIZE_Y must be multiples of BLK_SIZE
+#endif
+
+/* coarse levels of the matching cascade: 1/4 and 1/2 of the pattern size */
+#define   MIP1_X       (AR_PATT_SIZE_X/4)
+#define   MIP1_Y       (AR_PATT_SIZE_Y/4)
+#define   MIP2_X       (AR_PATT_SIZE_X/2)
+#define   MIP2_Y       (AR_PATT_SIZE_Y/2)
+#define   MIP1_NUM     (MIP1_Y*MIP1_X)
+#define   MIP2_NUM     (MIP2_Y*MIP2_X)
+
+#if AR_PATT_SIZE_X != AR_PATT_SIZE_Y
+#  error AR_PATT_SIZE_X and AR_PATT_SIZE_Y must be equal
+#endif
+
+/*
+ *  Only the first orientation of each pattern is stored (centred); the
+ *  input is turned by quarter turns instead for the other directions.
+ */
 static int    pattern_num = -1;
 static int    patf[AR_PATT_NUM_MAX] = { 0 };
-static int    pat[AR_PATT_NUM_MAX][4][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3];
-static double patpow[AR_PATT_NUM_MAX][4];
-static int    patBW[AR_PATT_NUM_MAX][4][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3];
-static double patpowBW[AR_PATT_NUM_MAX][4];
+/* loads of each pattern, how many of them keep it active, and a hash of
+   its template to find it again */
+static int    patref[AR_PATT_NUM_MAX];
+static int    patact[AR_PATT_NUM_MAX];
+static unsigned int patkey[AR_PATT_NUM_MAX];
+static short  pat[AR_PATT_NUM_MAX][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3];
+static double patpow[AR_PATT_NUM_MAX];
+static short  patBW[AR_PATT_NUM_MAX][AR_PATT_SIZE_Y*AR_PATT_SIZE_X];
+static double patpowBW[AR_PATT_NUM_MAX];
+static double patblk[AR_PATT_NUM_MAX][BLK_NUM];
+static double patdev[AR_PATT_NUM_MAX][BLK_NUM];
+static double patblkBW[AR_PATT_NUM_MAX][BLK_NUM];
+static double patdevBW[AR_PATT_NUM_MAX][BLK_NUM];
+static double patmip1[AR_PATT_NUM_MAX][MIP1_NUM*3];
+static double patmip2[AR_PATT_NUM_MAX][MIP2_NUM*3];
+static double patmip1BW[AR_PATT_NUM_MAX][MIP1_NUM];
+static double patmip2BW[AR_PATT_NUM_MAX][MIP2_NUM];
+static double patmippow1[AR_PATT_NUM_MAX];
+static double patmippow2[AR_PATT_NUM_MAX];
+static double patmippow1BW[AR_PATT_NUM_MAX];
+static double patmippow2BW[AR_PATT_NUM_MAX];
+static double patmipth1[AR_PATT_NUM_MAX];
+static double patmipth2[AR_PATT_NUM_MAX];
+static double patmipth1BW[AR_PATT_NUM_MAX];
+static double patmipth2BW[AR_PATT_NUM_MAX];
+
+/* rotidx[j][p]: pixel that lands on p when a pattern is turned j quarters */
+static int    rotidx[4][AR_PATT_SIZE_Y*AR_PATT_SIZE_X];
+static int    rotidx1[4][MIP1_NUM];
+static int    rotidx2[4][MIP2_NUM];
 
 static double evec[EVEC_MAX][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3];
 static double epat[AR_PATT_NUM_MAX][4][EVEC_MAX];
@@ -33,75 +84,139 @@ static int    evecf = 0;
 //static int    evec_dimBW;
 static int    evecBWf = 0;
 
-static void   get_cpara( double world[4][2], double vertex[4][2],
+static int    get_cpara( double world[4][2], double vertex[4][2],
                          double para[3][3] );
-static int    pattern_match( ARUint8 *data, int *code, int *dir, double *cf );
+static int    get_patt( ARHandle *handle, ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
+                        ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3],
+                        double mip1[MIP1_NUM*3], double mip2[MIP2_NUM*3] );
+static int    pattern_match( ARUint8 *data, double *mip1, double *mip2, int mode,
+                             int *code, int *dir, double *cf );
+static int    pattern_cascade( double *mip, int num, int pix, int *rot,
+                               double *tmip, double *tpow, double *tthresh,
+                               char alive[AR_PATT_NUM_MAX*4], double *cf );
+static int    pattern_match_bound( int input[4][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3],
+                                   double datapow, int pix, short *tpat, double *tpow,
+                                   double (*tblk)[BLK_NUM], double (*tdev)[BLK_NUM],
+                                   char *alive, int *code, int *dir, double *cf );
+static void   get_blk( int *data, int pix, double blk[BLK_NUM], double dev[BLK_NUM] );
+static void   get_mip( int *data, int pix, int scale, double *mip, double *pow );
+static void   get_rotidx( int size, int *idx );
 static void   put_zero( ARUint8 *p, int size );
+static unsigned int get_key( int *data, int size );
 static void   gen_evec(void);
 
 
 int arLoadPatt( const char *filename )
 {
     FILE    *fp;
+    int     wpat[4][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3];
+    int     wpatBW[AR_PATT_SIZE_Y*AR_PATT_SIZE_X];
+    unsigned int key;
     int     patno;
     int     h, i, j, l, m;
     int     i1, i2, i3;
 
     if(pattern_num == -1 ) {
         for( i = 0; i < AR_PATT_NUM_MAX; i++ ) patf[i] = 0;
+        get_rotidx( AR_PATT_SIZE_X, &rotidx[0][0] );
+        get_rotidx( MIP1_X,         &rotidx1[0][0] );
+        get_rotidx( MIP2_X,         &rotidx2[0][0] );
         pattern_num = 0;
     }
 
-    for( i = 0; i < AR_PATT_NUM_MAX; i++ ) {
-        if(patf[i] == 0) break;
-    }
-    if( i == AR_PATT_NUM_MAX ) return -1;
-    patno = i;
-
     if( (fp=fopen(filename, "r")) == NULL ) {
         printf("\"%s\" not found!!\n", filename);
         return(-1);
     }
 
     for( h=0; h<4; h++ ) {
-        l = 0;
         for( i3 = 0; i3 < 3; i3++ ) {
             for( i2 = 0; i2 < AR_PATT_SIZE_Y; i2++ ) {
                 for( i1 = 0; i1 < AR_PATT_SIZE_X; i1++ ) {
                     if( fscanf(fp, "%d", &j) != 1 ) {
                         printf("Pattern Data read error!!\n");
+                        fclose(fp);
                         return -1;
                     }
-                    j = 255-j;
-                    pat[patno][h][(i2*AR_PATT_SIZE_X+i1)*3+i3] = j;
-                    if( i3 == 0 ) patBW[patno][h][i2*AR_PATT_SIZE_X+i1]  = j;
-                    else          patBW[patno][h][i2*AR_PATT_SIZE_X+i1] += j;
-                    if( i3 == 2 ) patBW[patno][h][i2*AR_PATT_SIZE_X+i1] /= 3;
-                    l += j;
+                    wpat[h][(i2*AR_PATT_SIZE_X+i1)*3+i3] = 255-j;
                 }
             }
         }
-        l /= (AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3);
+    }
+    fclose(fp);
 
-        m = 0;
+    /* orientation h of the file is the first one turned by h quarters */
+    for( h = 1; h < 4; h++ ) {
         for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3; i++ ) {
-            pat[patno][h][i] -= l;
-            m += (pat[patno][h][i]*pat[patno][h][i]);
+            if( wpat[h][i] != wpat[0][rotidx[4-h][i/3]*3+i%3] ) break;
+        }
+        if( i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3 ) {
+            printf("\"%s\": orientations are not rotations of the first one, using the first one.\n", filename);
+            break;
         }
-        patpow[patno][h] = sqrt((double)m);
-        if( patpow[patno][h] == 0.0 ) patpow[patno][h] = 0.0000001;
+    }
 
-        m = 0;
-        for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X; i++ ) {
-            patBW[patno][h][i] -= l;
-            m += (patBW[patno][h][i]*patBW[patno][h][i]);
+    l = 0;
+    for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3; i++ ) l += wpat[0][i];
+    l /= (AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3);
+
+    for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X; i++ ) {
+        wpatBW[i] = (wpat[0][i*3+0] + wpat[0][i*3+1] + wpat[0][i*3+2])/3 - l;
+    }
+    for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3; i++ ) wpat[0][i] -= l;
+
+    /* a template already loaded, from this file or any other, is shared */
+    key = get_key( wpat[0], AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3 );
+    for( patno = 0; patno < AR_PATT_NUM_MAX; patno++ ) {
+        if( patf[patno] == 0 || patkey[patno] != key ) continue;
+        for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3; i++ ) {
+            if( pat[patno][i] != wpat[0][i] ) break;
+        }
+        if( i == AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3 ) {
+            patref[patno]++;
+            patact[patno]++;
+            patf[patno] = 1;
+            return( patno );
         }
-        patpowBW[patno][h] = sqrt((double)m);
-        if( patpowBW[patno][h] == 0.0 ) patpowBW[patno][h] = 0.0000001;
     }
-    fclose(fp);
 
-    patf[patno] = 1;
+    for( patno = 0; patno < AR_PATT_NUM_MAX; patno++ ) {
+        if( patf[patno] == 0 ) break;
+    }
+    if( patno == AR_PATT_NUM_MAX ) return -1;
+
+    m = 0;
+    for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X; i++ ) {
+        patBW[patno][i] = wpatBW[i];
+        m += (wpatBW[i]*wpatBW[i]);
+    }
+    patpowBW[patno] = sqrt((double)m);
+    if( patpowBW[patno] == 0.0 ) patpowBW[patno] = 0.0000001;
+
+    m = 0;
+    for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3; i++ ) {
+        pat[patno][i] = wpat[0][i];
+        m += (wpat[0][i]*wpat[0][i]);
+    }
+    patpow[patno] = sqrt((double)m);
+    if( patpow[patno] == 0.0 ) patpow[patno] = 0.0000001;
+
+    get_blk( wpat[0], 3, patblk[patno],   patdev[patno] );
+    get_blk( wpatBW,  1, patblkBW[patno], patdevBW[patno] );
+    get_mip( wpat[0], 3, 4, patmip1[patno],   &patmippow1[patno] );
+    get_mip( wpat[0], 3, 2, patmip2[patno],   &patmippow2[patno] );
+    get_mip( wpatBW,  1, 4, patmip1BW[patno], &patmippow1BW[patno] );
+    get_mip( wpatBW,  1, 2, patmip2BW[patno], &patmippow2BW[patno] );
+    /* a template with little coarse structure is expected to score lower there */
+    patmipth1[patno]   = AR_MATCHING_CASCADE_THRESH1 * patmippow1[patno]   / (4*patpow[patno]);
+    patmipth2[patno]   = AR_MATCHING_CASCADE_THRESH2 * patmippow2[patno]   / (2*patpow[patno]);
+    patmipth1BW[patno] = AR_MATCHING_CASCADE_THRESH1 * patmippow1BW[patno] / (4*patpowBW[patno]);
+    patmipth2BW[patno] = AR_MATCHING_CASCADE_THRESH2 * patmippow2BW[patno] / (2*patpowBW[patno]);
+
+    patf[patno]   = 1;
+    patref[patno] = 1;
+    patact[patno] = 1;
+    patkey[patno] = key;
     pattern_num++;
 
 /*
@@ -114,6 +229,10 @@ int arLoadPatt( const char *filename )
 int arFreePatt( int patno )
 {
     if( patf[patno] == 0 ) return -1;
+    if( --patref[patno] > 0 ) {
+        if( patact[patno] > patref[patno] ) patact[patno] = patref[patno];
+        return 1;
+    }
 
     patf[patno] = 0;
     pattern_num--;
@@ -127,6 +246,7 @@ int arActivatePatt( int patno )
 {
     if( patf[patno] == 0 ) return -1;
 
+    if( patact[patno] < patref[patno] ) patact[patno]++;
     patf[patno] = 1;
 
     return 1;
@@ -136,13 +256,20 @@ int arDeactivatePatt( int patno )
 {
     if( patf[patno] == 0 ) return -1;
 
-    patf[patno] = 2;
+    if( patact[patno] > 0 ) patact[patno]--;
+    if( patact[patno] == 0 ) patf[patno] = 2;
 
     return 1;
 }
 
 int arGetCode( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
                int *code, int *dir, double *cf )
+{
+    return arHandleGetCode( arGetHandle(), image, x_coord, y_coord, vertex, code, dir, cf );
+}
+
+int arHandleGetCode( ARHandle *handle, ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
+                     int *code, int *dir, double *cf )
 {
 #if DEBUG
 static int count = 0;
@@ -151,16 +278,29 @@ static double a2 = 0.0;
 double b1, b2, b3;
 #endif
     ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3];
+    double  mip1[MIP1_NUM*3];
+    double  mip2[MIP2_NUM*3];
 
 #if DEBUG
 b1 = arUtilTimer();
 #endif
-    arGetPatt(image, x_coord, y_coord, vertex, ext_pat);
+    if( arPattDetectionMode == AR_MATRIX_CODE_DETECTION ) {
+        if( get_patt(handle, image, x_coord, y_coord, vertex, ext_pat, NULL, NULL) < 0 ) {
+            *code = -1; *dir = 0; *cf = -1.0;
+            return(-1);
+        }
+        arGetMatrixCode(ext_pat, code, dir, cf);
+        return(0);
+    }
+    if( get_patt(handle, image, x_coord, y_coord, vertex, ext_pat, mip1, mip2) < 0 ) {
+        *code = -1; *dir = 0; *cf = -1.0;
+        return(-1);
+    }
 #if DEBUG
 b2 = arUtilTimer();
 #endif
 
-    pattern_match((ARUint8 *)ext_pat, code, dir, cf);
+    pattern_match((ARUint8 *)ext_pat, mip1, mip2, handle->templateMatchingMode, code, dir, cf);
 #if DEBUG
 b3 = arUtilTimer();
 #endif
@@ -179,9 +319,21 @@ if( count == 60 ) {
     return(0);
 }
 
-#if 1
 int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
                ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3] )
+{
+    return get_patt( arGetHandle(), image, x_coord, y_coord, vertex, ext_pat, NULL, NULL );
+}
+
+#if 1
+/*
+ *  mip1/mip2 (may be NULL) receive the block sums of the samples at 1/4
+ *  and 1/2 of the pattern resolution, for the coarse levels of the
+ *  matching cascade.
+ */
+static int get_patt( ARHandle *handle, ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
+                     ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3],
+                     double mip1[MIP1_NUM*3], double mip2[MIP2_NUM*3] )
 {
     ARUint32  ext_pat2[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3];
     double    world[4][2];
@@ -212,7 +364,7 @@ int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
         local[i][0] = x_coord[vertex[i]];
         local[i][1] = y_coord[vertex[i]];
     }
-    get_cpara( world, local, para );
+    if( get_cpara( world, local, para ) < 0 ) return(-1);
 
     lx1 = (int)((local[0][0] - local[1][0])*(local[0][0] - local[1][0])
         + (local[0][1] - local[1][1])*(local[0][1] - local[1][1]));
@@ -226,7 +378,7 @@ int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
     if( ly2 > ly1 ) ly1 = ly2;
     xdiv2 = AR_PATT_SIZE_X;
     ydiv2 = AR_PATT_SIZE_Y;
-    if( arImageProcMode == AR_IMAGE_PROC_IN_FULL ) {
+    if( handle->imageProcMode == AR_IMAGE_PROC_IN_FULL ) {
         while( xdiv2*xdiv2 < lx1/4 ) xdiv2*=2;
         while( ydiv2*ydiv2 < ly1/4 ) ydiv2*=2;
     }
@@ -255,14 +407,14 @@ printf("%3d(%f), %3d(%f)\n", xdiv2, sqrt(lx1), ydiv2, sqrt(ly1));
             if( d == 0 ) return(-1);
             xc = (int)((para[0][0]*xw + para[0][1]*yw + para[0][2])/d);
             yc = (int)((para[1][0]*xw + para[1][1]*yw + para[1][2])/d);
-            if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
+            if( handle->imageProcMode == AR_IMAGE_PROC_IN_HALF ) {
                 xc = ((xc+1)/2)*2;
                 yc = ((yc+1)/2)*2;
             }
-            if( xc >= 0 && xc < arImXsize && yc >= 0 && yc < arImYsize ) {
+            if( xc >= 0 && xc < handle->param.xsize && yc >= 0 && yc < handle->param.ysize ) {
 				ext_pat2_y_index = j/ydiv;
 				ext_pat2_x_index = i/xdiv;
-				image_index = (yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT;
+				image_index = (yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT;
 #if (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_ARGB)
                 ext_pat2[ext_pat2_y_index][ext_pat2_x_index][0] += image[image_index+3];
                 ext_pat2[ext_pat2_y_index][ext_pat2_x_index][1] += image[image_index+2];
@@ -314,11 +466,29 @@ printf("%3d(%f), %3d(%f)\n", xdiv2, sqrt(lx1), ydiv2, sqrt(ly1));
         }
     }
 
+    if( mip1 != NULL && mip2 != NULL ) {
+        for( i = 0; i < MIP1_NUM*3; i++ ) mip1[i] = 0.0;
+        for( i = 0; i < MIP2_NUM*3; i++ ) mip2[i] = 0.0;
+        for( j = 0; j < AR_PATT_SIZE_Y; j++ ) {
+            for( i = 0; i < AR_PATT_SIZE_X; i++ ) {
+                image_index = ((j/4)*MIP1_X + i/4)*3;
+                mip1[image_index+0] += ext_pat2[j][i][0];
+                mip1[image_index+1] += ext_pat2[j][i][1];
+                mip1[image_index+2] += ext_pat2[j][i][2];
+                image_index = ((j/2)*MIP2_X + i/2)*3;
+                mip2[image_index+0] += ext_pat2[j][i][0];
+                mip2[image_index+1] += ext_pat2[j][i][1];
+                mip2[image_index+2] += ext_pat2[j][i][2];
+            }
+        }
+    }
+
     return(0);
 }
 #else
-int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
-               ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3] )
+static int get_patt( ARHandle *handle, ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
+                     ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3],
+                     double mip1[MIP1_NUM*3], double mip2[MIP2_NUM*3] )
 {
     double  world[4][2];
     double  local[4][2];
@@ -340,7 +510,7 @@ int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
         local[i][0] = x_coord[vertex[i]];
         local[i][1] = y_coord[vertex[i]];
     }
-    get_cpara( world, local, para );
+    if( get_cpara( world, local, para ) < 0 ) return(-1);
 
     put_zero( (ARUint8 *)ext_pat, AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3 );
     for( j = 0; j < AR_PATT_SAMPLE_NUM; j++ ) {
@@ -351,125 +521,125 @@ int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
             if( d == 0 ) return(-1);
             xc = (int)((para[0][0]*xw + para[0][1]*yw + para[0][2])/d);
             yc = (int)((para[1][0]*xw + para[1][1]*yw + para[1][2])/d);
-            if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
+            if( handle->imageProcMode == AR_IMAGE_PROC_IN_HALF ) {
                 xc = ((xc+1)/2)*2;
                 yc = ((yc+1)/2)*2;
             }
-            if( xc >= 0 && xc < arImXsize && yc >= 0 && yc < arImYsize ) {
+            if( xc >= 0 && xc < handle->param.xsize && yc >= 0 && yc < handle->param.ysize ) {
 #if (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_ARGB)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+3];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+3];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
 					+ k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+2];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+2];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
 					+ k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
 					+ k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_ABGR)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
                    + k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+2];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+2];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
                    + k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+3];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+3];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
                    + k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_BGRA)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+0];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+0];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
                    + k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
                    + k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+2];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+2];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
                    + k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_BGR)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+0];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+0];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
                    + k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
                    + k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+2];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+2];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
                    + k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_RGBA)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+2];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+2];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
                    + k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
                    + k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+0];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+0];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
                    + k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_RGB)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+2];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+2];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
                    + k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
                    + k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+0];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+0];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
                    + k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_MONO)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
 					+ k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
 					+ k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
 					+ k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_2vuy)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
 					+ k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
 					+ k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+1];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+1];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
 					+ k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
 #elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_yuvs)
-                k1 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+0];
+                k1 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+0];
                 k1 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0]
 					+ k1*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][0] = (k1 > 255)? 255: k1;
-                k2 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+0];
+                k2 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+0];
                 k2 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1]
 					+ k2*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][1] = (k2 > 255)? 255: k2;
-                k3 = image[(yc*arImXsize+xc)*AR_PIX_SIZE_DEFAULT+0];
+                k3 = image[(yc*handle->param.xsize+xc)*AR_PIX_SIZE_DEFAULT+0];
                 k3 = ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2]
 					+ k3*(AR_PATT_SIZE_Y*AR_PATT_SIZE_X)/(AR_PATT_SAMPLE_NUM*AR_PATT_SAMPLE_NUM);
                 ext_pat[j*AR_PATT_SIZE_Y/AR_PATT_SAMPLE_NUM][i*AR_PATT_SIZE_X/AR_PATT_SAMPLE_NUM][2] = (k3 > 255)? 255: k3;
@@ -480,59 +650,60 @@ int arGetPatt( ARUint8 *image, int *x_coord, int *y_coord, int *vertex,
         }
     }
 
+    if( mip1 != NULL && mip2 != NULL ) {
+        for( i = 0; i < MIP1_NUM*3; i++ ) mip1[i] = 0.0;
+        for( i = 0; i < MIP2_NUM*3; i++ ) mip2[i] = 0.0;
+        for( j = 0; j < AR_PATT_SIZE_Y; j++ ) {
+            for( i = 0; i < AR_PATT_SIZE_X; i++ ) {
+                for( k1 = 0; k1 < 3; k1++ ) {
+                    mip1[((j/4)*MIP1_X + i/4)*3+k1] += ext_pat[j][i][k1];
+                    mip2[((j/2)*MIP2_X + i/2)*3+k1] += ext_pat[j][i][k1];
+                }
+            }
+        }
+    }
+
     return(0);
 }
 #endif
 
-static void get_cpara( double world[4][2], double vertex[4][2],
-                       double para[3][3] )
+/*
+ *  world is the axis-aligned square world[0] .. world[2], the unit square
+ *  homography of the vertices is scaled and shifted onto it.
+ */
+static int get_cpara( double world[4][2], double vertex[4][2],
+                      double para[3][3] )
 {
-    ARMat   *a, *b, *c;
+    double  h[3][3];
+    double  sx, sy;
     int     i;
 
-    a = arMatrixAlloc( 8, 8 );
-    b = arMatrixAlloc( 8, 1 );
-    c = arMatrixAlloc( 8, 1 );
-    for( i = 0; i < 4; i++ ) {
-        a->m[i*16+0]  = world[i][0];
-        a->m[i*16+1]  = world[i][1];
-        a->m[i*16+2]  = 1.0;
-        a->m[i*16+3]  = 0.0;
-        a->m[i*16+4]  = 0.0;
-        a->m[i*16+5]  = 0.0;
-        a->m[i*16+6]  = -world[i][0] * vertex[i][0];
-        a->m[i*16+7]  = -world[i][1] * vertex[i][0];
-        a->m[i*16+8]  = 0.0;
-        a->m[i*16+9]  = 0.0;
-        a->m[i*16+10] = 0.0;
-        a->m[i*16+11] = world[i][0];
-        a->m[i*16+12] = world[i][1];
-        a->m[i*16+13] = 1.0;
-        a->m[i*16+14] = -world[i][0] * vertex[i][1];
-        a->m[i*16+15] = -world[i][1] * vertex[i][1];
-        b->m[i*2+0] = vertex[i][0];
-        b->m[i*2+1] = vertex[i][1];
-    }
-    arMatrixSelfInv( a );
-    arMatrixMul( c, a, b );
-    for( i = 0; i < 2; i++ ) {
-        para[i][0] = c->m[i*3+0];
-        para[i][1] = c->m[i*3+1];
-        para[i][2] = c->m[i*3+2];
-    }
-    para[2][0] = c->m[2*3+0];
-    para[2][1] = c->m[2*3+1];
+    if( arUtilSquareToQuad( vertex, h ) < 0 ) return -1;
+
+    sx = world[2][0] - world[0][0];
+    sy = world[2][1] - world[0][1];
+    for( i = 0; i < 3; i++ ) {
+        para[i][0] = h[i][0] / sx;
+        para[i][1] = h[i][1] / sy;
+        para[i][2] = h[i][2] - para[i][0] * world[0][0] - para[i][1] * world[0][1];
+    }
+    for( i = 0; i < 3; i++ ) {
+        para[i][0] /= para[2][2];
+        para[i][1] /= para[2][2];
+        if( i < 2 ) para[i][2] /= para[2][2];
+    }
     para[2][2] = 1.0;
-    arMatrixFree( a );
-    arMatrixFree( b );
-    arMatrixFree( c );
+
+    return 0;
 }
 
-static int pattern_match( ARUint8 *data, int *code, int *dir, double *cf )
+static int pattern_match( ARUint8 *data, double *mip1, double *mip2, int mode,
+                          int *code, int *dir, double *cf )
 {
+    char   alive[AR_PATT_NUM_MAX*4];
     double invec[EVEC_MAX];
-    int    input[AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3];
-    int    i, j, l;
+    int    input[4][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3];
+    int    i, j, l, pix;
     int    k = 0; // fix VC7 compiler warning: uninitialized variable
     int    ave, sum, res, res2;
     double datapow, sum2, min;
@@ -544,16 +715,18 @@ static int pattern_match( ARUint8 *data, int *code, int *dir, double *cf )
     }
     ave /= (AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3);
 
-    if( arTemplateMatchingMode == AR_TEMPLATE_MATCHING_COLOR ) {
+    if( mode == AR_TEMPLATE_MATCHING_COLOR ) {
+        pix = 3;
         for(i=0;i<AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3;i++) {
-            input[i] = (255-data[i]) - ave;
-            sum += input[i]*input[i];
+            input[0][i] = (255-data[i]) - ave;
+            sum += input[0][i]*input[0][i];
         }
     }
     else {
+        pix = 1;
         for(i=0;i<AR_PATT_SIZE_Y*AR_PATT_SIZE_X;i++) {
-            input[i] = ((255-data[i*3+0]) + (255-data[i*3+1]) + (255-data[i*3+02]))/3 - ave;
-            sum += input[i]*input[i];
+            input[0][i] = ((255-data[i*3+0]) + (255-data[i*3+1]) + (255-data[i*3+02]))/3 - ave;
+            sum += input[0][i]*input[0][i];
         }
     }
 
@@ -565,14 +738,49 @@ static int pattern_match( ARUint8 *data, int *code, int *dir, double *cf )
         return -1;
     }
 
+    /* input[j]: the input turned so that it faces the stored orientation of direction j */
+    for( j = 1; j < 4; j++ ) {
+        for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X; i++ ) {
+            for( l = 0; l < pix; l++ ) input[j][i*pix+l] = input[0][rotidx[j][i]*pix+l];
+        }
+    }
+
+    for( i = 0; i < AR_PATT_NUM_MAX*4; i++ ) alive[i] = 1;
+    if( arMatchingCascadeMode == AR_MATCHING_WITH_CASCADE && mip1 != NULL
+     && !(mode == AR_TEMPLATE_MATCHING_COLOR
+          && arMatchingPCAMode == AR_MATCHING_WITH_PCA && evecf) ) {
+        if( mode == AR_TEMPLATE_MATCHING_COLOR ) {
+            l = pattern_cascade( mip1, MIP1_NUM, 3, &rotidx1[0][0], &patmip1[0][0],
+                                 patmippow1, patmipth1, alive, &max );
+            if( l > 0 ) {
+                l = pattern_cascade( mip2, MIP2_NUM, 3, &rotidx2[0][0], &patmip2[0][0],
+                                     patmippow2, patmipth2, alive, &max );
+            }
+        }
+        else {
+            l = pattern_cascade( mip1, MIP1_NUM, 1, &rotidx1[0][0], &patmip1BW[0][0],
+                                 patmippow1BW, patmipth1BW, alive, &max );
+            if( l > 0 ) {
+                l = pattern_cascade( mip2, MIP2_NUM, 1, &rotidx2[0][0], &patmip2BW[0][0],
+                                     patmippow2BW, patmipth2BW, alive, &max );
+            }
+        }
+        if( l == 0 ) {
+            *code = -1;
+            *dir  = 0;
+            *cf   = max;
+            return 0;
+        }
+    }
+
     res = res2 = -1;
-    if( arTemplateMatchingMode == AR_TEMPLATE_MATCHING_COLOR ) {
+    if( mode == AR_TEMPLATE_MATCHING_COLOR ) {
         if( arMatchingPCAMode == AR_MATCHING_WITH_PCA && evecf ) {
 
             for( i = 0; i < evec_dim; i++ ) {
                 invec[i] = 0.0;
                 for( j = 0; j < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3; j++ ) {
-                    invec[i] += evec[i][j] * input[j];
+                    invec[i] += evec[i][j] * input[0][j];
                 }
                 invec[i] /= datapow;
             }
@@ -601,37 +809,17 @@ static int pattern_match( ARUint8 *data, int *code, int *dir, double *cf )
 #endif
             }
             sum = 0;
-            for(i=0;i<AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3;i++) sum += input[i]*pat[res2][res][i];
-            max = sum / patpow[res2][res] / datapow;
+            for(i=0;i<AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3;i++) sum += input[res][i]*pat[res2][i];
+            max = sum / patpow[res2] / datapow;
         }
         else {
-            k = -1;
-            max = 0.0;
-            for( l = 0; l < pattern_num; l++ ) {
-                k++;
-                while( patf[k] == 0 ) k++;
-                if( patf[k] == 2 ) continue;
-                for( j = 0; j < 4; j++ ) {
-                    sum = 0;
-                    for(i=0;i<AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3;i++) sum += input[i]*pat[k][j][i];
-                    sum2 = sum / patpow[k][j] / datapow;
-                    if( sum2 > max ) { max = sum2; res = j; res2 = k; }
-                }
-            }
+            pattern_match_bound( input, datapow, 3, &pat[0][0], patpow, patblk, patdev,
+                                 alive, &res2, &res, &max );
         }
     }
     else {
-        for( l = 0; l < pattern_num; l++ ) {
-            k++;
-            while( patf[k] == 0 ) k++;
-            if( patf[k] == 2 ) continue;
-            for( j = 0; j < 4; j++ ) {
-                sum = 0;
-                for(i=0;i<AR_PATT_SIZE_Y*AR_PATT_SIZE_X;i++) sum += input[i]*patBW[k][j][i];
-                sum2 = sum / patpowBW[k][j] / datapow;
-                if( sum2 > max ) { max = sum2; res = j; res2 = k; }
-            }
-        }
+        pattern_match_bound( input, datapow, 1, &patBW[0][0], patpowBW, patblkBW, patdevBW,
+                             alive, &res2, &res, &max );
     }
 
     *code = res2;
@@ -645,11 +833,276 @@ static int pattern_match( ARUint8 *data, int *code, int *dir, double *cf )
     return 0;
 }
 
+/*
+ *  One coarse level of the matching cascade.  mip holds the RGB block
+ *  sums of the samples (num blocks); they are converted to the matching
+ *  mode (pix 1 or 3), inverted and centred like the full resolution input,
+ *  and turned with rot for the four directions.  Every alive (pattern,
+ *  direction) candidate whose normalized correlation at this level is
+ *  below tthresh is dropped; tthresh is the cascade threshold scaled by
+ *  the share of the template energy kept at this level.  Templates with
+ *  no energy left here cannot be judged and stay alive.  Returns the
+ *  number of candidates still alive, and the best coarse score in cf.
+ */
+static int pattern_cascade( double *mip, int num, int pix, int *rot,
+                            double *tmip, double *tpow, double *tthresh,
+                            char alive[AR_PATT_NUM_MAX*4], double *cf )
+{
+    double     input[4][MIP2_NUM*3];
+    double     *p;
+    double     ave, datapow, sum, max;
+    int        i, j, k, c, n, cnum;
+
+    n = num*pix;
+    ave = 0.0;
+    for( i = 0; i < num; i++ ) {
+        if( pix == 3 ) {
+            input[0][i*3+0] = -mip[i*3+0];
+            input[0][i*3+1] = -mip[i*3+1];
+            input[0][i*3+2] = -mip[i*3+2];
+        }
+        else {
+            input[0][i] = -(mip[i*3+0] + mip[i*3+1] + mip[i*3+2]);
+        }
+    }
+    for( i = 0; i < n; i++ ) ave += input[0][i];
+    ave /= n;
+    datapow = 0.0;
+    for( i = 0; i < n; i++ ) {
+        input[0][i] -= ave;
+        datapow += input[0][i]*input[0][i];
+    }
+    datapow = sqrt( datapow );
+    for( j = 1; j < 4; j++ ) {
+        for( i = 0; i < num; i++ ) {
+            for( c = 0; c < pix; c++ ) input[j][i*pix+c] = input[0][rot[j*num+i]*pix+c];
+        }
+    }
+
+    cnum = 0;
+    max = 0.0;
+    for( k = 0; k < AR_PATT_NUM_MAX; k++ ) {
+        if( patf[k] != 1 ) continue;
+        p = &tmip[k*n];
+        for( j = 0; j < 4; j++ ) {
+            if( !alive[k*4+j] ) continue;
+            if( tpow[k] == 0.0 ) { cnum++; continue; }
+            if( datapow == 0.0 ) { alive[k*4+j] = 0; continue; }
+            sum = 0.0;
+            for( i = 0; i < n; i++ ) sum += input[j][i] * p[i];
+            sum /= tpow[k] * datapow;
+            if( sum > max ) max = sum;
+            if( sum < tthresh[k] ) alive[k*4+j] = 0;
+            else                   cnum++;
+        }
+    }
+    *cf = max;
+
+    return cnum;
+}
+
+/*
+ *  Branch-and-bound version of the exhaustive correlation search.
+ *  Every (pattern, direction) candidate gets an upper bound of its
+ *  correlation from BLK_SIZE x BLK_SIZE block sums (mean term) plus
+ *  Cauchy-Schwarz on the in-block deviations.  The candidate with the
+ *  best coarse (block mean) score is correlated first, the others are
+ *  skipped when their bound is below the best value found, or abandoned
+ *  part way once the exact partial sum plus the bound of the remaining
+ *  block rows falls below it.  Ties are broken on (pattern, direction)
+ *  order, so the result is exactly the one of the full search.
+ *  input[j] is the input turned for direction j, tpat the stored
+ *  orientation of each pattern (AR_PATT_SIZE_Y*AR_PATT_SIZE_X*pix wide).
+ */
+static int pattern_match_bound( int input[4][AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3],
+                                double datapow, int pix, short *tpat, double *tpow,
+                                double (*tblk)[BLK_NUM], double (*tdev)[BLK_NUM],
+                                char *alive, int *code, int *dir, double *cf )
+{
+    double     bound[AR_PATT_NUM_MAX*4];
+    int        cand[AR_PATT_NUM_MAX*4];
+    double     inblk[4][BLK_NUM];
+    double     indev[4][BLK_NUM];
+    double     bb[BLK_Y+1];
+    double     coarse, cmax, dev, thresh, sum2, max;
+    int        *p1;
+    short      *p2;
+    int        cnum, res, res2;
+    int        by, b, c, i, j, k, sum;
+
+    for( j = 0; j < 4; j++ ) {
+        get_blk( input[j], pix, inblk[j], indev[j] );
+        for( b = 0; b < BLK_NUM; b++ ) inblk[j][b] /= BLK_SIZE*BLK_SIZE*pix;
+    }
+
+    cnum = 0;
+    cmax = 0.0;
+    c = 0;
+    for( k = 0; k < AR_PATT_NUM_MAX; k++ ) {
+        if( patf[k] != 1 ) continue;
+        for( j = 0; j < 4; j++ ) {
+            if( !alive[k*4+j] ) continue;
+            coarse = dev = 0.0;
+            for( b = 0; b < BLK_NUM; b++ ) {
+                coarse += inblk[j][b] * tblk[k][b];
+                dev    += indev[j][b] * tdev[k][b];
+            }
+            coarse /= tpow[k];
+            if( cnum == 0 || coarse > cmax ) { cmax = coarse; c = cnum; }
+            /* +1.0: slack for rounding, the exact correlation is an integer */
+            bound[cnum] = (coarse + (dev + 1.0) / tpow[k]) / datapow;
+            cand[cnum]  = k*4 + j;
+            cnum++;
+        }
+    }
+    if( cnum == 0 ) {
+        *code = -1;
+        *dir  = -1;
+        *cf   = 0.0;
+        return 0;
+    }
+    /* visit the best coarse candidate first */
+    i = cand[0]; cand[0] = cand[c]; cand[c] = i;
+    sum2 = bound[0]; bound[0] = bound[c]; bound[c] = sum2;
+
+    res = res2 = -1;
+    max = 0.0;
+    for( i = 0; i < cnum; i++ ) {
+        if( bound[i] < max ) continue;
+        k = cand[i] / 4;
+        j = cand[i] % 4;
+
+        /* bb[by]: bound of the correlation over block rows by.. */
+        bb[BLK_Y] = 1.0;
+        for( by = BLK_Y-1; by >= 0; by-- ) {
+            bb[by] = bb[by+1];
+            for( b = by*BLK_X; b < (by+1)*BLK_X; b++ ) {
+                bb[by] += inblk[j][b] * tblk[k][b] + indev[j][b] * tdev[k][b];
+            }
+        }
+        /* below thresh the correlation cannot reach max any more */
+        thresh = max * tpow[k] * datapow * (1.0 - 1.0e-9);
+
+        sum = 0;
+        p1 = input[j];
+        p2 = &tpat[k*AR_PATT_SIZE_Y*AR_PATT_SIZE_X*pix];
+        for( by = 0; by < BLK_Y; by++ ) {
+            for( b = 0; b < BLK_SIZE*AR_PATT_SIZE_X*pix; b++ ) sum += p1[b] * p2[b];
+            if( sum + bb[by+1] < thresh ) break;
+            p1 += BLK_SIZE*AR_PATT_SIZE_X*pix;
+            p2 += BLK_SIZE*AR_PATT_SIZE_X*pix;
+        }
+        if( by < BLK_Y ) continue;
+
+        sum2 = sum / tpow[k] / datapow;
+        if( sum2 > max
+         || (sum2 == max && res2 >= 0 && cand[i] < res2*4+res) ) {
+            max = sum2; res = j; res2 = k;
+        }
+    }
+
+    *code = res2;
+    *dir  = res;
+    *cf   = max;
+
+    return 0;
+}
+
+static void get_blk( int *data, int pix, double blk[BLK_NUM], double dev[BLK_NUM] )
+{
+    int     *p;
+    double  w;
+    int     bx, by, b, y, i;
+    int     s1, s2;
+
+    for( b = 0, by = 0; by < BLK_Y; by++ ) {
+        for( bx = 0; bx < BLK_X; bx++, b++ ) {
+            s1 = s2 = 0;
+            for( y = by*BLK_SIZE; y < (by+1)*BLK_SIZE; y++ ) {
+                p = &data[(y*AR_PATT_SIZE_X + bx*BLK_SIZE)*pix];
+                for( i = 0; i < BLK_SIZE*pix; i++ ) {
+                    s1 += p[i];
+                    s2 += p[i]*p[i];
+                }
+            }
+            w = s2 - (double)s1*s1/(BLK_SIZE*BLK_SIZE*pix);
+            blk[b] = s1;
+            dev[b] = (w > 0.0)? sqrt(w): 0.0;
+        }
+    }
+}
+
+/*
+ *  Centred block sums of a template at 1/scale of the pattern resolution,
+ *  and their power; pow is 0 when the level carries no energy.
+ */
+static void get_mip( int *data, int pix, int scale, double *mip, double *pow )
+{
+    int     xsize, ysize;
+    double  ave;
+    int     x, y, c, i;
+
+    xsize = AR_PATT_SIZE_X/scale;
+    ysize = AR_PATT_SIZE_Y/scale;
+    for( i = 0; i < xsize*ysize*pix; i++ ) mip[i] = 0.0;
+    for( y = 0; y < AR_PATT_SIZE_Y; y++ ) {
+        for( x = 0; x < AR_PATT_SIZE_X; x++ ) {
+            for( c = 0; c < pix; c++ ) {
+                mip[((y/scale)*xsize + x/scale)*pix + c] += data[(y*AR_PATT_SIZE_X + x)*pix + c];
+            }
+        }
+    }
+
+    ave = 0.0;
+    for( i = 0; i < xsize*ysize*pix; i++ ) ave += mip[i];
+    ave /= xsize*ysize*pix;
+    *pow = 0.0;
+    for( i = 0; i < xsize*ysize*pix; i++ ) {
+        mip[i] -= ave;
+        *pow += mip[i]*mip[i];
+    }
+    *pow = sqrt( *pow );
+    if( *pow < 1.0e-6 ) *pow = 0.0;
+}
+
+/*
+ *  idx[j*size*size+p]: pixel of a size x size pattern that lands on p
+ *  when the pattern is turned j quarters; the orientations of a pattern
+ *  file step the other way, orientation h is turned 4-h quarters.
+ */
+static void get_rotidx( int size, int *idx )
+{
+    int     x, y;
+
+    for( y = 0; y < size; y++ ) {
+        for( x = 0; x < size; x++ ) {
+            idx[0*size*size + y*size+x] = y*size + x;
+            idx[1*size*size + y*size+x] = (size-1-x)*size + y;
+            idx[2*size*size + y*size+x] = (size-1-y)*size + (size-1-x);
+            idx[3*size*size + y*size+x] = x*size + (size-1-y);
+        }
+    }
+}
+
 static void   put_zero( ARUint8 *p, int size )
 {
     while( (size--) > 0 ) *(p++) = 0;
 }
 
+/* FNV-1a over the values of a template */
+static unsigned int get_key( int *data, int size )
+{
+    unsigned int  key;
+    int           i;
+
+    key = 2166136261U;
+    for( i = 0; i < size; i++ ) {
+        key = (key ^ (unsigned int)data[i]) * 16777619U;
+    }
+
+    return key;
+}
+
 static void gen_evec(void)
 {
     int    i, j, k, ii, jj;
@@ -677,7 +1130,8 @@ static void gen_evec(void)
         if( patf[jj] == 0 ) continue;
         for( k = 0; k < 4; k++ ) {
             for( i = 0; i < AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3; i++ ) {
-                input->m[(j*4+k)*AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3+i] = pat[j][k][i] / patpow[j][k];
+                input->m[(j*4+k)*AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3+i]
+                    = pat[jj][rotidx[(4-k)%4][i/3]*3+i%3] / patpow[jj];
             }
         }
         j++;
@@ -719,7 +1173,7 @@ static void gen_evec(void)
             for( k = 0; k < evec_dim; k++ ) {
                 sum = 0.0;
                 for(ii=0;ii<AR_PATT_SIZE_Y*AR_PATT_SIZE_X*3;ii++) {
-                    sum += evec[k][ii] * pat[i][j][ii] / patpow[i][j];
+                    sum += evec[k][ii] * pat[i][rotidx[(4-j)%4][ii/3]*3+ii%3] / patpow[i];
                 }
 #if DEBUG
                 printf("%10.7f ", sum);
@@ -12,52 +12,160 @@
 #include <stdlib.h>
 #include <math.h>
 #include <AR/ar.h>
-#include <AR/matrix.h>
 
-#define P_MAX       500
-
-static double  pos2d[P_MAX][2];
-static double  pos3d[P_MAX][3];
+/* points handled with scratch on the stack, more are allocated */
+#define WORK_NUM    64
 
 static double arGetTransMatSub( double rot[3][3], double ppos2d[][2],
                                 double pos3d[][3], int num, double conv[3][4],
-                                double *dist_factor, double cpara[3][4] );
+                                double *dist_factor, double cpara[3][4],
+                                double pos2d[][2] );
+static int    get_trans( double rot[3][3], double pos3d[][3], double pos2d[][2],
+                         int num, double cpara[3][4], double trans[3] );
+static double get_init_rot( ARParam *cparam, ARMarkerInfo *marker_info,
+                            double ppos2d[][2], double ppos3d[][2],
+                            double rot[3][3], double trans[3] );
+static double get_trans_mat_iter( ARParam *cparam, double rot[3][3], double ppos2d[][2],
+                                  double ppos3d[][2], int num, double conv[3][4] );
+static double get_init_err( double rot[3][3], double ppos2d[][2], double ppos3d[][2],
+                            double *dist_factor, double cpara[3][4], double trans[3] );
+static void   get_square( ARMarkerInfo *marker_info, double center[2], double width,
+                          double ppos2d[4][2], double ppos3d[4][2] );
+static void   get_fit_pos( double ppos2d[][2], int num, double *dist_factor,
+                           double pos2d[][2] );
 
 double arGetTransMat( ARMarkerInfo *marker_info,
                       double center[2], double width, double conv[3][4] )
 {
-    double  rot[3][3];
+    double  rot[3][3], trans[3];
+    double  ppos2d[4][2];
+    double  ppos3d[4][2];
+
+    get_square( marker_info, center, width, ppos2d, ppos3d );
+    if( get_init_rot( &arParam, marker_info, ppos2d, ppos3d, rot, trans ) < -1.0 ) return -1;
+
+    return get_trans_mat_iter( &arParam, rot, ppos2d, ppos3d, 4, conv );
+}
+
+double arHandleGetTransMat( ARHandle *handle, ARMarkerInfo *marker_info,
+                            double center[2], double width, double conv[3][4] )
+{
+    double  rot[3][3], trans[3];
+    double  ppos2d[4][2];
+    double  ppos3d[4][2];
+
+    get_square( marker_info, center, width, ppos2d, ppos3d );
+    if( get_init_rot( &(handle->param), marker_info, ppos2d, ppos3d, rot, trans ) < -1.0 ) return -1;
+
+    return get_trans_mat_iter( &(handle->param), rot, ppos2d, ppos3d, 4, conv );
+}
+
+double arGetTransMatInit( ARMarkerInfo *marker_info,
+                          double center[2], double width, double conv[3][4] )
+{
+    double  rot[3][3], trans[3];
     double  ppos2d[4][2];
     double  ppos3d[4][2];
-    int     dir;
     double  err;
-    int     i;
+    int     i, j;
 
-    if( arGetInitRot( marker_info, arParam.mat, rot ) < 0 ) return -1;
+    get_square( marker_info, center, width, ppos2d, ppos3d );
+    err = get_init_rot( &arParam, marker_info, ppos2d, ppos3d, rot, trans );
+    if( err < 0.0 ) return -1;
 
-    dir = marker_info->dir;
-    ppos2d[0][0] = marker_info->vertex[(4-dir)%4][0];
-    ppos2d[0][1] = marker_info->vertex[(4-dir)%4][1];
-    ppos2d[1][0] = marker_info->vertex[(5-dir)%4][0];
-    ppos2d[1][1] = marker_info->vertex[(5-dir)%4][1];
-    ppos2d[2][0] = marker_info->vertex[(6-dir)%4][0];
-    ppos2d[2][1] = marker_info->vertex[(6-dir)%4][1];
-    ppos2d[3][0] = marker_info->vertex[(7-dir)%4][0];
-    ppos2d[3][1] = marker_info->vertex[(7-dir)%4][1];
-    ppos3d[0][0] = center[0] - width/2.0;
-    ppos3d[0][1] = center[1] + width/2.0;
-    ppos3d[1][0] = center[0] + width/2.0;
-    ppos3d[1][1] = center[1] + width/2.0;
-    ppos3d[2][0] = center[0] + width/2.0;
-    ppos3d[2][1] = center[1] - width/2.0;
-    ppos3d[3][0] = center[0] - width/2.0;
-    ppos3d[3][1] = center[1] - width/2.0;
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) conv[j][i] = rot[j][i];
+        conv[j][3] = trans[j];
+    }
+
+    return err;
+}
+
+double arGetTransMatEx( ARMarkerInfo *marker_info,
+                        double center[2], double width, double conv[3][4],
+                        double cov[6][6] )
+{
+    double  rot[3][3], trans[3];
+    double  ppos2d[4][2], ppos3d[4][2];
+    double  pos2d[4][2], pos3d[4][3];
+    double  err;
+    int     i, j;
+
+    err = arGetTransMat( marker_info, center, width, conv );
+    if( err < 0.0 || cov == NULL ) return err;
+
+    get_square( marker_info, center, width, ppos2d, ppos3d );
+    get_fit_pos( ppos2d, 4, arParam.dist_factor, pos2d );
+    for( i = 0; i < 4; i++ ) {
+        pos3d[i][0] = ppos3d[i][0];
+        pos3d[i][1] = ppos3d[i][1];
+        pos3d[i][2] = 0.0;
+    }
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) rot[j][i] = conv[j][i];
+        trans[j] = conv[j][3];
+    }
+    if( arGetPoseCov( rot, trans, arParam.mat, pos3d, pos2d, 4, cov ) < 0 ) return -1;
+
+    return err;
+}
 
-    for( i = 0; i < AR_GET_TRANS_MAT_MAX_LOOP_COUNT; i++ ) {
-        err = arGetTransMat3( rot, ppos2d, ppos3d, 4, conv,
-                                   arParam.dist_factor, arParam.mat );
-        if( err < AR_GET_TRANS_MAT_MAX_FIT_ERROR ) break;
+double arGetTransMatIter( double rot[3][3], double ppos2d[][2],
+                          double ppos3d[][2], int num, double conv[3][4] )
+{
+    return get_trans_mat_iter( &arParam, rot, ppos2d, ppos3d, num, conv );
+}
+
+static double get_trans_mat_iter( ARParam *cparam, double rot[3][3], double ppos2d[][2],
+                                  double ppos3d[][2], int num, double conv[3][4] )
+{
+    ARTransMatSetting  *set = &arTransMatSetting;
+    double  prev[3][4];
+    double  start, err, prev_err, c, d;
+    int     i, j, loop;
+
+    start = (set->time_max > 0.0)? arUtilGetTime(): 0.0;
+    prev_err = -1.0;
+    for( loop = 0;; loop++ ) {
+        err = arGetTransMat3( rot, ppos2d, ppos3d, num, conv,
+                              cparam->dist_factor, cparam->mat );
+        if( err < 0.0 && prev_err < 0.0 ) break;
+        if( err >= 0.0 && err < set->fit_error ) break;
+
+        if( prev_err >= 0.0 ) {
+            /* a failed round is taken as a worse one */
+            if( err < 0.0 || err > prev_err ) {
+                for( j = 0; j < 3; j++ ) {
+                    for( i = 0; i < 4; i++ ) conv[j][i] = prev[j][i];
+                }
+                err = prev_err;
+                break;
+            }
+            if( prev_err - err < prev_err * set->min_improvement ) break;
+
+            /* cosine of the turn and length of the move since the last round */
+            c = 0.0;
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 3; i++ ) c += prev[j][i] * conv[j][i];
+            }
+            c = (c - 1.0) / 2.0;
+            d = (prev[0][3]-conv[0][3]) * (prev[0][3]-conv[0][3])
+              + (prev[1][3]-conv[1][3]) * (prev[1][3]-conv[1][3])
+              + (prev[2][3]-conv[2][3]) * (prev[2][3]-conv[2][3]);
+            if( c >= cos(set->min_step_rot)
+             && d <= set->min_step_trans * set->min_step_trans ) break;
+        }
+
+        if( loop+1 >= set->loop_max ) break;
+        if( set->time_max > 0.0
+         && (arUtilGetTime() - start) * 1000000.0 >= set->time_max ) break;
+
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 4; i++ ) prev[j][i] = conv[j][i];
+        }
+        prev_err = err;
     }
+
     return err;
 }
 
@@ -72,10 +180,22 @@ double arGetTransMat3( double rot[3][3], double ppos2d[][2],
                        double ppos3d[][2], int num, double conv[3][4],
                        double *dist_factor, double cpara[3][4] )
 {
+    double  wwork[WORK_NUM*5];
+    double  *work;
+    double  (*pos2d)[2], (*pos3d)[3];
     double  off[3], pmax[3], pmin[3];
     double  ret;
     int     i;
 
+    if( num > WORK_NUM ) {
+        arMalloc( work, double, num*5 );
+    }
+    else {
+        work = wwork;
+    }
+    pos3d = (double (*)[3])work;
+    pos2d = (double (*)[2])(work + num*3);
+
     pmax[0]=pmax[1]=pmax[2] = -10000000000.0;
     pmin[0]=pmin[1]=pmin[2] =  10000000000.0;
     for( i = 0; i < num; i++ ) {
@@ -101,12 +221,14 @@ double arGetTransMat3( double rot[3][3], double ppos2d[][2],
     }
 
     ret = arGetTransMatSub( rot, ppos2d, pos3d, num, conv,
-                            dist_factor, cpara );
+                            dist_factor, cpara, pos2d );
 
     conv[0][3] = conv[0][0]*off[0] + conv[0][1]*off[1] + conv[0][2]*off[2] + conv[0][3];
     conv[1][3] = conv[1][0]*off[0] + conv[1][1]*off[1] + conv[1][2]*off[2] + conv[1][3];
     conv[2][3] = conv[2][0]*off[0] + conv[2][1]*off[1] + conv[2][2]*off[2] + conv[2][3];
 
+    if( num > WORK_NUM ) free( work );
+
     return ret;
 }
 
@@ -121,10 +243,37 @@ double arGetTransMat5( double rot[3][3], double ppos2d[][2],
                        double ppos3d[][3], int num, double conv[3][4],
                        double *dist_factor, double cpara[3][4] )
 {
+    double  wwork[WORK_NUM*5];
+    double  *work;
+    double  ret;
+
+    if( num > WORK_NUM ) {
+        arMalloc( work, double, num*5 );
+    }
+    else {
+        work = wwork;
+    }
+
+    ret = arGetTransMatWork( rot, ppos2d, ppos3d, num, conv,
+                             dist_factor, cpara, work );
+
+    if( num > WORK_NUM ) free( work );
+
+    return ret;
+}
+
+double arGetTransMatWork( double rot[3][3], double ppos2d[][2],
+                          double ppos3d[][3], int num, double conv[3][4],
+                          double *dist_factor, double cpara[3][4], double *work )
+{
+    double  (*pos2d)[2], (*pos3d)[3];
     double  off[3], pmax[3], pmin[3];
     double  ret;
     int     i;
 
+    pos3d = (double (*)[3])work;
+    pos2d = (double (*)[2])(work + num*3);
+
     pmax[0]=pmax[1]=pmax[2] = -10000000000.0;
     pmin[0]=pmin[1]=pmin[2] =  10000000000.0;
     for( i = 0; i < num; i++ ) {
@@ -145,7 +294,7 @@ double arGetTransMat5( double rot[3][3], double ppos2d[][2],
     }
 
     ret = arGetTransMatSub( rot, ppos2d, pos3d, num, conv,
-                            dist_factor, cpara );
+                            dist_factor, cpara, pos2d );
 
     conv[0][3] = conv[0][0]*off[0] + conv[0][1]*off[1] + conv[0][2]*off[2] + conv[0][3];
     conv[1][3] = conv[1][0]*off[0] + conv[1][1]*off[1] + conv[1][2]*off[2] + conv[1][3];
@@ -156,20 +305,204 @@ double arGetTransMat5( double rot[3][3], double ppos2d[][2],
 
 static double arGetTransMatSub( double rot[3][3], double ppos2d[][2],
                                 double pos3d[][3], int num, double conv[3][4],
-                                double *dist_factor, double cpara[3][4] )
+                                double *dist_factor, double cpara[3][4],
+                                double pos2d[][2] )
 {
-    ARMat   *mat_a, *mat_b, *mat_c, *mat_d, *mat_e, *mat_f;
     double  trans[3];
-    double  wx, wy, wz;
     double  ret;
     int     i, j;
 
-    mat_a = arMatrixAlloc( num*2, 3 );
-    mat_b = arMatrixAlloc( 3, num*2 );
-    mat_c = arMatrixAlloc( num*2, 1 );
-    mat_d = arMatrixAlloc( 3, 3 );
-    mat_e = arMatrixAlloc( 3, 1 );
-    mat_f = arMatrixAlloc( 3, 1 );
+    get_fit_pos( ppos2d, num, dist_factor, pos2d );
+
+    if( get_trans( rot, pos3d, pos2d, num, cpara, trans ) < 0 ) return -1;
+
+    if( arPoseRefineMode == AR_POSE_REFINE_LM ) {
+        ret = arModifyMatrixLM( rot, trans, cpara, pos3d, pos2d, num );
+    }
+    else {
+        ret = arModifyMatrix( rot, trans, cpara, pos3d, pos2d, num );
+        if( get_trans( rot, pos3d, pos2d, num, cpara, trans ) < 0 ) return -1;
+        ret = arModifyMatrix( rot, trans, cpara, pos3d, pos2d, num );
+    }
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) conv[j][i] = rot[j][i];
+        conv[j][3] = trans[j];
+    }
+
+    return ret;
+}
+
+/*
+ *  Least squares translation for a fixed rotation. Each point gives two
+ *  equations linear in trans; their 3x3 normal equations are accumulated
+ *  directly and solved by Cholesky.
+ */
+static int get_trans( double rot[3][3], double pos3d[][3], double pos2d[][2],
+                      int num, double cpara[3][4], double trans[3] )
+{
+    double  a[3][3], b[3], l[3][3];
+    double  r0[3], r1[3], c0, c1;
+    double  wx, wy, wz, w;
+    int     i, j, k;
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) a[j][i] = 0.0;
+        b[j] = 0.0;
+    }
+    for( k = 0; k < num; k++ ) {
+        wx = rot[0][0] * pos3d[k][0]
+           + rot[0][1] * pos3d[k][1]
+           + rot[0][2] * pos3d[k][2];
+        wy = rot[1][0] * pos3d[k][0]
+           + rot[1][1] * pos3d[k][1]
+           + rot[1][2] * pos3d[k][2];
+        wz = rot[2][0] * pos3d[k][0]
+           + rot[2][1] * pos3d[k][1]
+           + rot[2][2] * pos3d[k][2];
+        r0[0] = cpara[0][0];
+        r0[1] = cpara[0][1];
+        r0[2] = cpara[0][2] - pos2d[k][0];
+        c0 = wz * pos2d[k][0]
+           - cpara[0][0]*wx - cpara[0][1]*wy - cpara[0][2]*wz;
+        r1[0] = 0.0;
+        r1[1] = cpara[1][1];
+        r1[2] = cpara[1][2] - pos2d[k][1];
+        c1 = wz * pos2d[k][1]
+           - cpara[1][1]*wy - cpara[1][2]*wz;
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i <= j; i++ ) a[j][i] += r0[j]*r0[i] + r1[j]*r1[i];
+            b[j] += r0[j]*c0 + r1[j]*c1;
+        }
+    }
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i <= j; i++ ) {
+            w = a[j][i];
+            for( k = 0; k < i; k++ ) w -= l[j][k] * l[i][k];
+            if( i == j ) {
+                if( w <= 0.0 ) return -1;
+                l[j][j] = sqrt( w );
+            }
+            else {
+                l[j][i] = w / l[i][i];
+            }
+        }
+    }
+    for( j = 0; j < 3; j++ ) {
+        w = b[j];
+        for( k = 0; k < j; k++ ) w -= l[j][k] * trans[k];
+        trans[j] = w / l[j][j];
+    }
+    for( j = 2; j >= 0; j-- ) {
+        w = trans[j];
+        for( k = j+1; k < 3; k++ ) w -= l[k][j] * trans[k];
+        trans[j] = w / l[j][j];
+    }
+
+    return 0;
+}
+
+/*
+ *  Initial rotation of arInitRotMode and the translation that goes with
+ *  it. Returns the reprojection error of that pose, -1 if it puts a
+ *  corner behind the camera (rot is still usable) and -2 on failure.
+ */
+static double get_init_rot( ARParam *cparam, ARMarkerInfo *marker_info,
+                            double ppos2d[][2], double ppos3d[][2],
+                            double rot[3][3], double trans[3] )
+{
+    double  rot2[3][3], trans2[3];
+    double  err, err2;
+    int     i, j;
+
+    if( arInitRotMode == AR_INIT_ROT_IPPE ) {
+        if( arGetInitRotIPPE( marker_info, cparam->mat, rot, rot2 ) < 0 ) return -2;
+    }
+    else {
+        if( arGetInitRot( marker_info, cparam->mat, rot ) < 0 ) return -2;
+    }
+
+    err = get_init_err( rot, ppos2d, ppos3d, cparam->dist_factor, cparam->mat, trans );
+    if( arInitRotMode == AR_INIT_ROT_IPPE ) {
+        /* the ambiguity is settled before refinement, by the reprojection error */
+        err2 = get_init_err( rot2, ppos2d, ppos3d, cparam->dist_factor, cparam->mat, trans2 );
+        if( err2 >= 0.0 && (err < 0.0 || err2 < err) ) {
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 3; i++ ) rot[j][i] = rot2[j][i];
+                trans[j] = trans2[j];
+            }
+            err = err2;
+        }
+    }
+
+    return err;
+}
+
+static double get_init_err( double rot[3][3], double ppos2d[][2], double ppos3d[][2],
+                            double *dist_factor, double cpara[3][4], double trans[3] )
+{
+    double  pos2d[4][2], pos3d[4][3];
+    double  q[3];
+    double  h, x, y, err;
+    int     i, j;
+
+    get_fit_pos( ppos2d, 4, dist_factor, pos2d );
+    for( i = 0; i < 4; i++ ) {
+        pos3d[i][0] = ppos3d[i][0];
+        pos3d[i][1] = ppos3d[i][1];
+        pos3d[i][2] = 0.0;
+    }
+    if( get_trans( rot, pos3d, pos2d, 4, cpara, trans ) < 0 ) return -1;
+
+    err = 0.0;
+    for( i = 0; i < 4; i++ ) {
+        for( j = 0; j < 3; j++ ) {
+            q[j] = rot[j][0] * pos3d[i][0]
+                 + rot[j][1] * pos3d[i][1]
+                 + trans[j];
+        }
+        h = cpara[2][0]*q[0] + cpara[2][1]*q[1] + cpara[2][2]*q[2] + cpara[2][3];
+        if( h <= 0.0 ) return -1;
+        x = (cpara[0][0]*q[0] + cpara[0][1]*q[1] + cpara[0][2]*q[2] + cpara[0][3]) / h;
+        y = (cpara[1][0]*q[0] + cpara[1][1]*q[1] + cpara[1][2]*q[2] + cpara[1][3]) / h;
+        err += (pos2d[i][0] - x) * (pos2d[i][0] - x)
+             + (pos2d[i][1] - y) * (pos2d[i][1] - y);
+    }
+
+    return err / 4.0;
+}
+
+/* corners in the order of the marker direction and their position on the marker */
+static void get_square( ARMarkerInfo *marker_info, double center[2], double width,
+                        double ppos2d[4][2], double ppos3d[4][2] )
+{
+    int     dir;
+
+    dir = marker_info->dir;
+    ppos2d[0][0] = marker_info->vertex[(4-dir)%4][0];
+    ppos2d[0][1] = marker_info->vertex[(4-dir)%4][1];
+    ppos2d[1][0] = marker_info->vertex[(5-dir)%4][0];
+    ppos2d[1][1] = marker_info->vertex[(5-dir)%4][1];
+    ppos2d[2][0] = marker_info->vertex[(6-dir)%4][0];
+    ppos2d[2][1] = marker_info->vertex[(6-dir)%4][1];
+    ppos2d[3][0] = marker_info->vertex[(7-dir)%4][0];
+    ppos2d[3][1] = marker_info->vertex[(7-dir)%4][1];
+    ppos3d[0][0] = center[0] - width/2.0;
+    ppos3d[0][1] = center[1] + width/2.0;
+    ppos3d[1][0] = center[0] + width/2.0;
+    ppos3d[1][1] = center[1] + width/2.0;
+    ppos3d[2][0] = center[0] + width/2.0;
+    ppos3d[2][1] = center[1] - width/2.0;
+    ppos3d[3][0] = center[0] - width/2.0;
+    ppos3d[3][1] = center[1] - width/2.0;
+}
+
+/* image positions in the coordinates the pose is fitted in */
+static void get_fit_pos( double ppos2d[][2], int num, double *dist_factor,
+                         double pos2d[][2] )
+{
+    int     i;
 
     if( arFittingMode == AR_FITTING_TO_INPUT ) {
         for( i = 0; i < num; i++ ) {
@@ -183,80 +516,4 @@ static double arGetTransMatSub( double rot[3][3], double ppos2d[][2],
             pos2d[i][1] = ppos2d[i][1];
         }
     }
-
-    for( j = 0; j < num; j++ ) {
-        wx = rot[0][0] * pos3d[j][0]
-           + rot[0][1] * pos3d[j][1]
-           + rot[0][2] * pos3d[j][2];
-        wy = rot[1][0] * pos3d[j][0]
-           + rot[1][1] * pos3d[j][1]
-           + rot[1][2] * pos3d[j][2];
-        wz = rot[2][0] * pos3d[j][0]
-           + rot[2][1] * pos3d[j][1]
-           + rot[2][2] * pos3d[j][2];
-        mat_a->m[j*6+0] = mat_b->m[num*0+j*2] = cpara[0][0];
-        mat_a->m[j*6+1] = mat_b->m[num*2+j*2] = cpara[0][1];
-        mat_a->m[j*6+2] = mat_b->m[num*4+j*2] = cpara[0][2] - pos2d[j][0];
-        mat_c->m[j*2+0] = wz * pos2d[j][0]
-               - cpara[0][0]*wx - cpara[0][1]*wy - cpara[0][2]*wz;
-        mat_a->m[j*6+3] = mat_b->m[num*0+j*2+1] = 0.0;
-        mat_a->m[j*6+4] = mat_b->m[num*2+j*2+1] = cpara[1][1];
-        mat_a->m[j*6+5] = mat_b->m[num*4+j*2+1] = cpara[1][2] - pos2d[j][1];
-        mat_c->m[j*2+1] = wz * pos2d[j][1]
-               - cpara[1][1]*wy - cpara[1][2]*wz;
-    }
-    arMatrixMul( mat_d, mat_b, mat_a );
-    arMatrixMul( mat_e, mat_b, mat_c );
-    arMatrixSelfInv( mat_d );
-    arMatrixMul( mat_f, mat_d, mat_e );
-    trans[0] = mat_f->m[0];
-    trans[1] = mat_f->m[1];
-    trans[2] = mat_f->m[2];
-
-    ret = arModifyMatrix( rot, trans, cpara, pos3d, pos2d, num );
-
-    for( j = 0; j < num; j++ ) {
-        wx = rot[0][0] * pos3d[j][0]
-           + rot[0][1] * pos3d[j][1]
-           + rot[0][2] * pos3d[j][2];
-        wy = rot[1][0] * pos3d[j][0]
-           + rot[1][1] * pos3d[j][1]
-           + rot[1][2] * pos3d[j][2];
-        wz = rot[2][0] * pos3d[j][0]
-           + rot[2][1] * pos3d[j][1]
-           + rot[2][2] * pos3d[j][2];
-        mat_a->m[j*6+0] = mat_b->m[num*0+j*2] = cpara[0][0];
-        mat_a->m[j*6+1] = mat_b->m[num*2+j*2] = cpara[0][1];
-        mat_a->m[j*6+2] = mat_b->m[num*4+j*2] = cpara[0][2] - pos2d[j][0];
-        mat_c->m[j*2+0] = wz * pos2d[j][0]
-               - cpara[0][0]*wx - cpara[0][1]*wy - cpara[0][2]*wz;
-        mat_a->m[j*6+3] = mat_b->m[num*0+j*2+1] = 0.0;
-        mat_a->m[j*6+4] = mat_b->m[num*2+j*2+1] = cpara[1][1];
-        mat_a->m[j*6+5] = mat_b->m[num*4+j*2+1] = cpara[1][2] - pos2d[j][1];
-        mat_c->m[j*2+1] = wz * pos2d[j][1]
-               - cpara[1][1]*wy - cpara[1][2]*wz;
-    }
-    arMatrixMul( mat_d, mat_b, mat_a );
-    arMatrixMul( mat_e, mat_b, mat_c );
-    arMatrixSelfInv( mat_d );
-    arMatrixMul( mat_f, mat_d, mat_e );
-    trans[0] = mat_f->m[0];
-    trans[1] = mat_f->m[1];
-    trans[2] = mat_f->m[2];
-
-    ret = arModifyMatrix( rot, trans, cpara, pos3d, pos2d, num );
-
-    arMatrixFree( mat_a );
-    arMatrixFree( mat_b );
-    arMatrixFree( mat_c );
-    arMatrixFree( mat_d );
-    arMatrixFree( mat_e );
-    arMatrixFree( mat_f );
-
-    for( j = 0; j < 3; j++ ) {
-        for( i = 0; i < 3; i++ ) conv[j][i] = rot[j][i];
-        conv[j][3] = trans[j];
-    }
-
-    return ret;
 }
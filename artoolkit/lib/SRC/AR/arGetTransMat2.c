@@ -14,6 +14,23 @@
 #include <AR/matrix.h>
 
 #define MD_PI         3.14159265358979323846
+#define LM_LAMBDA     0.001
+
+/* the points seen by one camera, for the LM refinement */
+typedef struct {
+    double   (*cpara)[4];
+    double   (*vertex)[3];
+    double   (*pos2d)[2];
+    int      num;
+} LMView;
+
+static double lm_modify( double rot[3][3], double trans[3], LMView view[], int vnum );
+static double lm_error( double rot[3][3], double trans[3], double cpara[3][4],
+                        double vertex[][3], double pos2d[][2], int num );
+static int    lm_normal( double rot[3][3], double trans[3], double cpara[3][4],
+                         double vertex[][3], double pos2d[][2], int num,
+                         double a[6][6], double b[6] );
+static int    lm_solve( double a[6][6], double b[6], double x[6] );
 
 double arModifyMatrix( double rot[3][3], double trans[3], double cpara[3][4],
                              double vertex[][3], double pos2d[][2], int num )
@@ -91,6 +108,308 @@ double arModifyMatrix( double rot[3][3], double trans[3], double cpara[3][4],
     return minerr/num;
 }
 
+/*
+ *  Levenberg-Marquardt over rotation and translation together.
+ *  The rotation is updated by R <- exp([w]x) R, so the Jacobian of a
+ *  projected point is analytic: with q = R*X, X' = q + t and g the
+ *  derivative of the projection by X', d/dw = q x g and d/dt = g.
+ */
+double arModifyMatrixLM( double rot[3][3], double trans[3], double cpara[3][4],
+                         double vertex[][3], double pos2d[][2], int num )
+{
+    LMView    view;
+
+    view.cpara  = cpara;
+    view.vertex = vertex;
+    view.pos2d  = pos2d;
+    view.num    = num;
+
+    return lm_modify( rot, trans, &view, 1 );
+}
+
+/*
+ *  The same over both cameras of a stereo pair. The pose is that of the
+ *  left camera; the right camera sees the point at matL2R * X', so its
+ *  projection matrix in left camera coordinates is matR * matL2R and
+ *  the Jacobian keeps its form.
+ */
+double arsModifyMatrixLM( double rot[3][3], double trans[3], ARSParam *arsParam,
+                          double pos3dL[][3], double pos2dL[][2], int numL,
+                          double pos3dR[][3], double pos2dR[][2], int numR )
+{
+    LMView    view[2];
+    double    cparaR[3][4];
+
+    arUtilMatMul( arsParam->matR, arsParam->matL2R, cparaR );
+    view[0].cpara  = arsParam->matL;
+    view[0].vertex = pos3dL;
+    view[0].pos2d  = pos2dL;
+    view[0].num    = numL;
+    view[1].cpara  = cparaR;
+    view[1].vertex = pos3dR;
+    view[1].pos2d  = pos2dR;
+    view[1].num    = numR;
+
+    return lm_modify( rot, trans, view, 2 );
+}
+
+/*
+ *  The covariance is (J^T J)^-1 at the solution, scaled by the variance
+ *  of the residuals, which is not allowed to drop below that of
+ *  AR_GET_TRANS_MAT_COV_MIN_NOISE pixels.
+ */
+int arGetPoseCov( double rot[3][3], double trans[3], double cpara[3][4],
+                  double vertex[][3], double pos2d[][2], int num,
+                  double cov[6][6] )
+{
+    double    a[6][6], b[6], e[6], x[6];
+    double    s2;
+    int       i, j;
+
+    if( lm_normal( rot, trans, cpara, vertex, pos2d, num, a, b ) < 0 ) return -1;
+
+    s2 = (num > 3)? lm_error( rot, trans, cpara, vertex, pos2d, num ) / (2*num - 6): 0.0;
+    if( s2 < AR_GET_TRANS_MAT_COV_MIN_NOISE * AR_GET_TRANS_MAT_COV_MIN_NOISE ) {
+        s2 = AR_GET_TRANS_MAT_COV_MIN_NOISE * AR_GET_TRANS_MAT_COV_MIN_NOISE;
+    }
+
+    for( i = 0; i < 6; i++ ) {
+        for( j = 0; j < 6; j++ ) e[j] = 0.0;
+        e[i] = 1.0;
+        if( lm_solve( a, e, x ) < 0 ) return -1;
+        for( j = 0; j < 6; j++ ) cov[j][i] = x[j] * s2;
+    }
+
+    return 0;
+}
+
+static double lm_modify( double rot[3][3], double trans[3], LMView view[], int vnum )
+{
+    double    a[6][6], b[6], d[6];
+    double    va[6][6], vb[6];
+    double    wrot[3][3], wtrans[3];
+    double    drot[3][3], th, s, c, k[3];
+    double    err, err2, lambda;
+    int       num, loop, v, i, j;
+
+    num = 0;
+    err = 0.0;
+    for( v = 0; v < vnum; v++ ) {
+        num += view[v].num;
+        err += lm_error( rot, trans, view[v].cpara, view[v].vertex, view[v].pos2d, view[v].num );
+    }
+    if( num == 0 ) return -1;
+
+    lambda = LM_LAMBDA;
+    for( loop = 0; loop < arTransMatSetting.lm_loop_max && err > 0.0; loop++ ) {
+        for( v = 0; v < vnum; v++ ) {
+            if( lm_normal( rot, trans, view[v].cpara, view[v].vertex, view[v].pos2d,
+                           view[v].num, va, vb ) < 0 ) return -1;
+            for( j = 0; j < 6; j++ ) {
+                for( i = 0; i < 6; i++ ) a[j][i] = (v == 0)? va[j][i]: a[j][i] + va[j][i];
+                b[j] = (v == 0)? vb[j]: b[j] + vb[j];
+            }
+        }
+
+        for(;;) {
+            for( j = 0; j < 6; j++ ) a[j][j] *= 1.0 + lambda;
+            i = lm_solve( a, b, d );
+            for( j = 0; j < 6; j++ ) a[j][j] /= 1.0 + lambda;
+            if( i < 0 ) return err/num;
+
+            th = sqrt( d[0]*d[0] + d[1]*d[1] + d[2]*d[2] );
+            if( th > 0.0 ) {
+                k[0] = d[0] / th; k[1] = d[1] / th; k[2] = d[2] / th;
+            }
+            else {
+                k[0] = 1.0; k[1] = k[2] = 0.0;
+            }
+            s = sin( th );
+            c = cos( th );
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 3; i++ ) drot[j][i] = (1.0 - c) * k[j] * k[i];
+                drot[j][j] += c;
+            }
+            drot[0][1] -= s*k[2]; drot[1][0] += s*k[2];
+            drot[0][2] += s*k[1]; drot[2][0] -= s*k[1];
+            drot[1][2] -= s*k[0]; drot[2][1] += s*k[0];
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 3; i++ ) {
+                    wrot[j][i] = drot[j][0] * rot[0][i]
+                               + drot[j][1] * rot[1][i]
+                               + drot[j][2] * rot[2][i];
+                }
+                wtrans[j] = trans[j] + d[j+3];
+            }
+
+            err2 = 0.0;
+            for( v = 0; v < vnum; v++ ) {
+                err2 += lm_error( wrot, wtrans, view[v].cpara, view[v].vertex,
+                                  view[v].pos2d, view[v].num );
+            }
+            if( err2 < err ) break;
+            lambda *= 10.0;
+            if( lambda > 1.0e6 ) return err/num;
+        }
+
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) rot[j][i] = wrot[j][i];
+            trans[j] = wtrans[j];
+        }
+        lambda *= 0.1;
+        if( err - err2 < err * 1.0e-6 ) {
+            err = err2;
+            break;
+        }
+        err = err2;
+    }
+
+    return err/num;
+}
+
+/*
+ *  Normal equations J^T J and J^T e of the reprojection error for the
+ *  update of arModifyMatrixLM: rotation vector first, then translation.
+ */
+static int lm_normal( double rot[3][3], double trans[3], double cpara[3][4],
+                      double vertex[][3], double pos2d[][2], int num,
+                      double a[6][6], double b[6] )
+{
+    double    q[3], gx[3], gy[3], jx[6], jy[6];
+    double    hx, hy, h, x, y, ex, ey;
+    int       i, j, l;
+
+    for( j = 0; j < 6; j++ ) {
+        for( i = 0; i < 6; i++ ) a[j][i] = 0.0;
+        b[j] = 0.0;
+    }
+    for( l = 0; l < num; l++ ) {
+        for( j = 0; j < 3; j++ ) {
+            q[j] = rot[j][0] * vertex[l][0]
+                 + rot[j][1] * vertex[l][1]
+                 + rot[j][2] * vertex[l][2];
+        }
+        hx = cpara[0][0] * (q[0]+trans[0])
+           + cpara[0][1] * (q[1]+trans[1])
+           + cpara[0][2] * (q[2]+trans[2])
+           + cpara[0][3];
+        hy = cpara[1][0] * (q[0]+trans[0])
+           + cpara[1][1] * (q[1]+trans[1])
+           + cpara[1][2] * (q[2]+trans[2])
+           + cpara[1][3];
+        h  = cpara[2][0] * (q[0]+trans[0])
+           + cpara[2][1] * (q[1]+trans[1])
+           + cpara[2][2] * (q[2]+trans[2])
+           + cpara[2][3];
+        if( h == 0.0 ) return -1;
+        x = hx / h;
+        y = hy / h;
+        ex = pos2d[l][0] - x;
+        ey = pos2d[l][1] - y;
+        for( j = 0; j < 3; j++ ) {
+            gx[j] = (cpara[0][j] - x * cpara[2][j]) / h;
+            gy[j] = (cpara[1][j] - y * cpara[2][j]) / h;
+        }
+        jx[0] = q[1]*gx[2] - q[2]*gx[1];
+        jx[1] = q[2]*gx[0] - q[0]*gx[2];
+        jx[2] = q[0]*gx[1] - q[1]*gx[0];
+        jy[0] = q[1]*gy[2] - q[2]*gy[1];
+        jy[1] = q[2]*gy[0] - q[0]*gy[2];
+        jy[2] = q[0]*gy[1] - q[1]*gy[0];
+        for( j = 0; j < 3; j++ ) {
+            jx[j+3] = gx[j];
+            jy[j+3] = gy[j];
+        }
+        for( j = 0; j < 6; j++ ) {
+            for( i = 0; i <= j; i++ ) a[j][i] += jx[j]*jx[i] + jy[j]*jy[i];
+            b[j] += jx[j]*ex + jy[j]*ey;
+        }
+    }
+    for( j = 0; j < 6; j++ ) {
+        for( i = 0; i < j; i++ ) a[i][j] = a[j][i];
+    }
+
+    return 0;
+}
+
+static double lm_error( double rot[3][3], double trans[3], double cpara[3][4],
+                        double vertex[][3], double pos2d[][2], int num )
+{
+    double    combo[3][4];
+    double    hx, hy, h, x, y;
+    double    err;
+    int       i, j;
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) {
+            combo[j][i] = cpara[j][0] * rot[0][i]
+                        + cpara[j][1] * rot[1][i]
+                        + cpara[j][2] * rot[2][i];
+        }
+        combo[j][3] = cpara[j][0] * trans[0]
+                    + cpara[j][1] * trans[1]
+                    + cpara[j][2] * trans[2]
+                    + cpara[j][3];
+    }
+
+    err = 0.0;
+    for( i = 0; i < num; i++ ) {
+        hx = combo[0][0] * vertex[i][0]
+           + combo[0][1] * vertex[i][1]
+           + combo[0][2] * vertex[i][2]
+           + combo[0][3];
+        hy = combo[1][0] * vertex[i][0]
+           + combo[1][1] * vertex[i][1]
+           + combo[1][2] * vertex[i][2]
+           + combo[1][3];
+        h  = combo[2][0] * vertex[i][0]
+           + combo[2][1] * vertex[i][1]
+           + combo[2][2] * vertex[i][2]
+           + combo[2][3];
+        x = hx / h;
+        y = hy / h;
+
+        err += (pos2d[i][0] - x) * (pos2d[i][0] - x)
+             + (pos2d[i][1] - y) * (pos2d[i][1] - y);
+    }
+
+    return err;
+}
+
+/* Cholesky solution of the symmetric positive definite system a x = b */
+static int lm_solve( double a[6][6], double b[6], double x[6] )
+{
+    double    l[6][6];
+    double    w;
+    int       i, j, k;
+
+    for( j = 0; j < 6; j++ ) {
+        for( i = 0; i <= j; i++ ) {
+            w = a[j][i];
+            for( k = 0; k < i; k++ ) w -= l[j][k] * l[i][k];
+            if( i == j ) {
+                if( w <= 0.0 ) return -1;
+                l[j][j] = sqrt( w );
+            }
+            else {
+                l[j][i] = w / l[i][i];
+            }
+        }
+    }
+    for( j = 0; j < 6; j++ ) {
+        w = b[j];
+        for( k = 0; k < j; k++ ) w -= l[j][k] * x[k];
+        x[j] = w / l[j][j];
+    }
+    for( j = 5; j >= 0; j-- ) {
+        w = x[j];
+        for( k = j+1; k < 6; k++ ) w -= l[k][j] * x[k];
+        x[j] = w / l[j][j];
+    }
+
+    return 0;
+}
+
 double arsModifyMatrix( double rot[3][3], double trans[3], ARSParam *arsParam,
                         double pos3dL[][3], double pos2dL[][2], int numL,
                         double pos3dR[][3], double pos2dR[][2], int numR )
@@ -212,19 +212,28 @@ int arGetNewMatrix( double a, double b, double c,
 int arGetInitRot( ARMarkerInfo *marker_info, double cpara[3][4], double rot[3][3] )
 {
     double  wdir[3][3];
+    double  vertex[4][2];
+    double  para[3][3];
     double  w, w1, w2, w3;
     int     dir;
-    int     j;
+    int     i, j;
 
     dir = marker_info->dir;
 
+    /*
+     *  The marker edges are the images of the square axes, so their
+     *  vanishing points are the first two columns of the homography.
+     */
+    for( i = 0; i < 4; i++ ) {
+        vertex[i][0] = marker_info->vertex[(4-dir+i)%4][0];
+        vertex[i][1] = marker_info->vertex[(4-dir+i)%4][1];
+    }
+    if( arUtilSquareToQuad( vertex, para ) < 0 ) return -1;
+
     for( j = 0; j < 2; j++ ) {
-        w1 = marker_info->line[(4-dir+j)%4][0] * marker_info->line[(6-dir+j)%4][1]
-           - marker_info->line[(6-dir+j)%4][0] * marker_info->line[(4-dir+j)%4][1];
-        w2 = marker_info->line[(4-dir+j)%4][1] * marker_info->line[(6-dir+j)%4][2]
-           - marker_info->line[(6-dir+j)%4][1] * marker_info->line[(4-dir+j)%4][2];
-        w3 = marker_info->line[(4-dir+j)%4][2] * marker_info->line[(6-dir+j)%4][0]
-           - marker_info->line[(6-dir+j)%4][2] * marker_info->line[(4-dir+j)%4][0];
+        w1 = para[2][j];
+        w2 = para[0][j];
+        w3 = para[1][j];
 
         wdir[j][0] =  w1*(cpara[0][1]*cpara[1][2]-cpara[0][2]*cpara[1][1])
                    +  w2*cpara[1][1]
@@ -235,6 +244,7 @@ int arGetInitRot( ARMarkerInfo *marker_info, double cpara[3][4], double rot[3][3
         w = sqrt( wdir[j][0]*wdir[j][0]
                 + wdir[j][1]*wdir[j][1]
                 + wdir[j][2]*wdir[j][2] );
+        if( w == 0.0 ) return -1;
         wdir[j][0] /= w;
         wdir[j][1] /= w;
         wdir[j][2] /= w;
@@ -281,6 +291,114 @@ int arGetInitRot( ARMarkerInfo *marker_info, double cpara[3][4], double rot[3][3
     return 0;
 }
 
+/*
+ *  Infinitesimal plane-based pose (IPPE, Collins and Bartoli): the
+ *  homography is differentiated at the marker center. Only two plane
+ *  orientations give that Jacobian, one tilted each way about the line
+ *  of sight, and both are returned.
+ */
+int arGetInitRotIPPE( ARMarkerInfo *marker_info, double cpara[3][4],
+                      double rot1[3][3], double rot2[3][3] )
+{
+    double  vertex[4][2];
+    double  para[3][3], h[3][3];
+    double  c[3], vx, vy;
+    double  jx[2], jy[2];
+    double  rv[3][3], p[3], w;
+    double  b00, b01, b10, b11, d;
+    double  a00, a01, a10, a11;
+    double  s00, s01, s11, gamma;
+    double  rt[3][3];
+    int     dir;
+    int     i, j, k;
+
+    dir = marker_info->dir;
+    for( i = 0; i < 4; i++ ) {
+        vertex[i][0] = marker_info->vertex[(4-dir+i)%4][0];
+        vertex[i][1] = marker_info->vertex[(4-dir+i)%4][1];
+    }
+    if( arUtilSquareToQuad( vertex, para ) < 0 ) return -1;
+
+    /* to normalized camera coordinates */
+    for( i = 0; i < 3; i++ ) {
+        h[2][i] = para[2][i] / cpara[2][2];
+        h[1][i] = (para[1][i] - cpara[1][2]*h[2][i]) / cpara[1][1];
+        h[0][i] = (para[0][i] - cpara[0][1]*h[1][i] - cpara[0][2]*h[2][i]) / cpara[0][0];
+    }
+
+    /* image of the center and the Jacobian there; the square's v runs along -Y */
+    for( j = 0; j < 3; j++ ) c[j] = 0.5*h[j][0] + 0.5*h[j][1] + h[j][2];
+    if( c[2] <= 0.0 ) return -1;
+    vx = c[0] / c[2];
+    vy = c[1] / c[2];
+    jx[0] =  (h[0][0] - vx*h[2][0]) / c[2];
+    jx[1] = -(h[0][1] - vx*h[2][1]) / c[2];
+    jy[0] =  (h[1][0] - vy*h[2][0]) / c[2];
+    jy[1] = -(h[1][1] - vy*h[2][1]) / c[2];
+
+    /* rotation taking the optical axis onto the line of sight */
+    w = sqrt( vx*vx + vy*vy + 1.0 );
+    p[0] = vx / w;
+    p[1] = vy / w;
+    p[2] = 1.0 / w;
+    rv[0][0] = 1.0 - p[0]*p[0]/(1.0+p[2]);
+    rv[0][1] = -p[0]*p[1]/(1.0+p[2]);
+    rv[0][2] = p[0];
+    rv[1][0] = rv[0][1];
+    rv[1][1] = 1.0 - p[1]*p[1]/(1.0+p[2]);
+    rv[1][2] = p[1];
+    rv[2][0] = -p[0];
+    rv[2][1] = -p[1];
+    rv[2][2] = p[2];
+
+    b00 = rv[0][0] - vx*rv[2][0];
+    b01 = rv[0][1] - vx*rv[2][1];
+    b10 = rv[1][0] - vy*rv[2][0];
+    b11 = rv[1][1] - vy*rv[2][1];
+    d = b00*b11 - b01*b10;
+    if( d == 0.0 ) return -1;
+    a00 = ( b11*jx[0] - b01*jy[0]) / d;
+    a01 = ( b11*jx[1] - b01*jy[1]) / d;
+    a10 = (-b10*jx[0] + b00*jy[0]) / d;
+    a11 = (-b10*jx[1] + b00*jy[1]) / d;
+
+    /* the largest singular value scales A to the top-left of a rotation */
+    s00 = a00*a00 + a01*a01;
+    s01 = a00*a10 + a01*a11;
+    s11 = a10*a10 + a11*a11;
+    gamma = sqrt( 0.5 * (s00 + s11 + sqrt((s00-s11)*(s00-s11) + 4.0*s01*s01)) );
+    if( gamma == 0.0 ) return -1;
+
+    rt[0][0] = a00 / gamma;
+    rt[0][1] = a01 / gamma;
+    rt[1][0] = a10 / gamma;
+    rt[1][1] = a11 / gamma;
+    w = 1.0 - rt[0][0]*rt[0][0] - rt[1][0]*rt[1][0];
+    rt[2][0] = (w > 0.0)? sqrt(w): 0.0;
+    w = 1.0 - rt[0][1]*rt[0][1] - rt[1][1]*rt[1][1];
+    rt[2][1] = (w > 0.0)? sqrt(w): 0.0;
+    if( rt[0][0]*rt[0][1] + rt[1][0]*rt[1][1] > 0.0 ) rt[2][1] = -rt[2][1];
+
+    for( i = 0; i < 2; i++ ) {
+        if( i == 1 ) {
+            rt[2][0] = -rt[2][0];
+            rt[2][1] = -rt[2][1];
+        }
+        rt[0][2] = rt[1][0]*rt[2][1] - rt[2][0]*rt[1][1];
+        rt[1][2] = rt[2][0]*rt[0][1] - rt[0][0]*rt[2][1];
+        rt[2][2] = rt[0][0]*rt[1][1] - rt[1][0]*rt[0][1];
+        for( j = 0; j < 3; j++ ) {
+            for( k = 0; k < 3; k++ ) {
+                w = rv[j][0]*rt[0][k] + rv[j][1]*rt[1][k] + rv[j][2]*rt[2][k];
+                if( i == 0 ) rot1[j][k] = w;
+                else         rot2[j][k] = w;
+            }
+        }
+    }
+
+    return 0;
+}
+
 static int check_dir( double dir[3], double st[2], double ed[2],
                       double cpara[3][4] )
 {
@@ -0,0 +1,52 @@
+/*******************************************************
+ *
+ *  Pose of every detected marker of a frame at once.
+ *
+ *  The markers are independent, so they are shared out to the pose
+ *  worker threads of arRunJob. arGetTransMat keeps no state between
+ *  calls, so the workers simply call it.
+ *
+*******************************************************/
+
+#include <stdlib.h>
+#include <AR/ar.h>
+
+typedef struct {
+    ARMarkerInfo   *marker_info;
+    double         (*center)[2];
+    double         *width;
+    double         (*conv)[3][4];
+    double         *err;
+} BatchJob;
+
+static void  get_trans_mat( void *context, int i );
+
+int arGetTransMatBatch( ARMarkerInfo marker_info[], int num,
+                        double center[][2], double width[],
+                        double conv[][3][4], double err[] )
+{
+    BatchJob    job;
+    int         ok, i;
+
+    if( num <= 0 ) return 0;
+
+    job.marker_info = marker_info;
+    job.center      = center;
+    job.width       = width;
+    job.conv        = conv;
+    job.err         = err;
+    arRunJob( get_trans_mat, &job, num );
+
+    ok = 0;
+    for( i = 0; i < num; i++ ) if( err[i] >= 0.0 ) ok++;
+
+    return ok;
+}
+
+static void get_trans_mat( void *context, int i )
+{
+    BatchJob    *job = (BatchJob *)context;
+
+    job->err[i] = arGetTransMat( &job->marker_info[i], job->center[i],
+                                 job->width[i], job->conv[i] );
+}
@@ -18,10 +18,14 @@ double arGetTransMatCont( ARMarkerInfo *marker_info, double prev_conv[3][4],
 {
     double  err1, err2;
     double  wtrans[3][4];
+    double  start;
     int     i, j;
 
+    start = (arTransMatSetting.time_max > 0.0)? arUtilGetTime(): 0.0;
     err1 = arGetTransMatContSub(marker_info, prev_conv, center, width, conv);
-    if( err1 > AR_GET_TRANS_CONT_MAT_MAX_FIT_ERROR ) {
+    if( arTransMatSetting.time_max > 0.0
+     && (arUtilGetTime() - start) * 1000000.0 >= arTransMatSetting.time_max ) return err1;
+    if( err1 > arTransMatSetting.cont_fit_error ) {
         err2 = arGetTransMat(marker_info, center, width, wtrans);
         if( err2 < err1 ) {
             for( j = 0; j < 3; j++ ) {
@@ -42,7 +46,6 @@ static double arGetTransMatContSub( ARMarkerInfo *marker_info, double prev_conv[
     double  ppos2d[4][2];
     double  ppos3d[4][2];
     int     dir;
-    double  err;
     int     i, j;
 
     for( i = 0; i < 3; i++ ) {
@@ -69,10 +72,5 @@ static double arGetTransMatContSub( ARMarkerInfo *marker_info, double prev_conv[
     ppos3d[3][0] = center[0] - width/2.0;
     ppos3d[3][1] = center[1] - width/2.0;
 
-    for( i = 0; i < AR_GET_TRANS_MAT_MAX_LOOP_COUNT; i++ ) {
-        err = arGetTransMat3( rot, ppos2d, ppos3d, 4, conv,
-                                   arParam.dist_factor, arParam.mat );
-        if( err < AR_GET_TRANS_MAT_MAX_FIT_ERROR ) break;
-    }
-    return err;
+    return arGetTransMatIter( rot, ppos2d, ppos3d, 4, conv );
 }
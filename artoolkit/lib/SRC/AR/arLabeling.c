@@ -26,50 +26,24 @@
 #define USE_OPTIMIZATIONS
 #define WORK_SIZE   1024*32
 
-/*****************************************************************************/
-// BUG in ARToolkit 2.65
-// Hardcoded buffer (600*500) is too small for full-size DV-PAL/NTSC resolutions of
-// 720x576 and 720x480, respectively. Results in segment faults.
-/*
-static ARInt16      l_imageL[640*500];
-static ARInt16      l_imageR[640*500];
-*/
-
-#define HARDCODED_BUFFER_WIDTH  1024
-#define HARDCODED_BUFFER_HEIGHT 1024
-
-static ARInt16      l_imageL[HARDCODED_BUFFER_WIDTH*HARDCODED_BUFFER_HEIGHT];
-static ARInt16      l_imageR[HARDCODED_BUFFER_WIDTH*HARDCODED_BUFFER_HEIGHT];
-/*****************************************************************************/
-
-
-static int          workL[WORK_SIZE];
-static int          workR[WORK_SIZE];
-static int          work2L[WORK_SIZE*7];
-static int          work2R[WORK_SIZE*7];
-
-static int          wlabel_numL;
-static int          wlabel_numR;
-static int          wareaL[WORK_SIZE];
-static int          wareaR[WORK_SIZE];
-static int          wclipL[WORK_SIZE*4];
-static int          wclipR[WORK_SIZE*4];
-static double       wposL[WORK_SIZE*2];
-static double       wposR[WORK_SIZE*2];
-
-static ARInt16 *labeling2( ARUint8 *image, int thresh,
+static ARInt16 *labeling2( ARHandle *handle, ARUint8 *image, int thresh,
                            int *label_num, int **area, double **pos, int **clip,
-                           int **label_ref, int LorR );
-static ARInt16 *labeling3( ARUint8 *image, int thresh,
+                           int **label_ref );
+static ARInt16 *labeling3( ARHandle *handle, ARUint8 *image, int thresh,
                            int *label_num, int **area, double **pos, int **clip,
-                           int **label_ref, int LorR );
+                           int **label_ref );
+static int      alloc_label( ARHandle *handle, int lxsize, int lysize );
+static int      alloc_image( ARHandle *handle, int lxsize, int lysize );
 
 void arGetImgFeature( int *num, int **area, int **clip, double **pos )
 {
-    *num  = wlabel_numL;
-    *area = wareaL;
-    *clip = wclipL;
-    *pos  = wposL;
+    ARHandle  *handle;
+
+    handle = arGetHandle();
+    *num  = handle->label_num;
+    *area = handle->label_area;
+    *clip = handle->label_clip;
+    *pos  = handle->label_pos;
 
     return;
 }
@@ -78,28 +52,26 @@ ARInt16 *arLabeling( ARUint8 *image, int thresh,
                      int *label_num, int **area, double **pos, int **clip,
                      int **label_ref )
 {
-    if( arDebug ) {
-        return( labeling3(image, thresh, label_num,
-                          area, pos, clip, label_ref, 1) );
-    } else {
-        return( labeling2(image, thresh, label_num,
-                          area, pos, clip, label_ref, 1) );
-    }
+    ARHandle  *handle;
+    ARInt16   *limage;
+
+    handle = arGetHandle();
+    limage = arHandleLabeling( handle, image, thresh,
+                               label_num, area, pos, clip, label_ref );
+    if( arDebug ) arImage = arImageL = handle->image;
+
+    return limage;
 }
 
 void arsGetImgFeature( int *num, int **area, int **clip, double **pos, int LorR )
 {
-    if (LorR) {
-        *num  = wlabel_numL;
-        *area = wareaL;
-        *clip = wclipL;
-        *pos  = wposL;
-    } else {
-        *num  = wlabel_numR;
-        *area = wareaR;
-        *clip = wclipR;
-        *pos  = wposR;
-    }
+    ARHandle  *handle;
+
+    handle = arsGetHandle( LorR );
+    *num  = handle->label_num;
+    *area = handle->label_area;
+    *clip = handle->label_clip;
+    *pos  = handle->label_pos;
 
     return;
 }
@@ -108,18 +80,36 @@ ARInt16 *arsLabeling( ARUint8 *image, int thresh,
                       int *label_num, int **area, double **pos, int **clip,
                       int **label_ref, int LorR )
 {
+    ARHandle  *handle;
+    ARInt16   *limage;
+
+    handle = arsGetHandle( LorR );
+    limage = arHandleLabeling( handle, image, thresh,
+                               label_num, area, pos, clip, label_ref );
     if( arDebug ) {
-        return( labeling3(image, thresh, label_num,
-                          area, pos, clip, label_ref, LorR) );
+        if( LorR ) arImage = arImageL = handle->image;
+        else       arImageR = handle->image;
+    }
+
+    return limage;
+}
+
+ARInt16 *arHandleLabeling( ARHandle *handle, ARUint8 *image, int thresh,
+                           int *label_num, int **area, double **pos, int **clip,
+                           int **label_ref )
+{
+    if( handle->debug ) {
+        return( labeling3(handle, image, thresh, label_num,
+                          area, pos, clip, label_ref) );
     } else {
-        return( labeling2(image, thresh, label_num,
-                          area, pos, clip, label_ref, LorR) );
+        return( labeling2(handle, image, thresh, label_num,
+                          area, pos, clip, label_ref) );
     }
 }
 
-static ARInt16 *labeling2( ARUint8 *image, int thresh,
+static ARInt16 *labeling2( ARHandle *handle, ARUint8 *image, int thresh,
                            int *label_num, int **area, double **pos, int **clip,
-                           int **label_ref, int LorR )
+                           int **label_ref )
 {
     ARUint8   *pnt;                     /*  image pointer       */
     ARInt16   *pnt1, *pnt2;             /*  image pointer       */
@@ -140,31 +130,21 @@ static ARInt16 *labeling2( ARUint8 *image, int thresh,
 #endif
 	int		  thresht3 = thresh * 3;
 
-	if (LorR) {
-        l_image = &l_imageL[0];
-        work    = &workL[0];
-        work2   = &work2L[0];
-        wlabel_num = &wlabel_numL;
-        warea   = &wareaL[0];
-        wclip   = &wclipL[0];
-        wpos    = &wposL[0];
+    if (handle->imageProcMode == AR_IMAGE_PROC_IN_HALF) {
+        lxsize = handle->param.xsize / 2;
+        lysize = handle->param.ysize / 2;
     } else {
-        l_image = &l_imageR[0];
-        work    = &workR[0];
-        work2   = &work2R[0];
-        wlabel_num = &wlabel_numR;
-        warea   = &wareaR[0];
-        wclip   = &wclipR[0];
-        wpos    = &wposR[0];
-    }
-
-    if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) {
-        lxsize = arImXsize / 2;
-        lysize = arImYsize / 2;
-    } else {
-        lxsize = arImXsize;
-        lysize = arImYsize;
+        lxsize = handle->param.xsize;
+        lysize = handle->param.ysize;
     }
+    if( alloc_label( handle, lxsize, lysize ) < 0 ) return(0);
+    l_image = handle->label_image;
+    work    = handle->label_work;
+    work2   = handle->label_work2;
+    wlabel_num = &(handle->label_num);
+    warea   = handle->label_area;
+    wclip   = handle->label_clip;
+    wpos    = handle->label_pos;
 
     pnt1 = &l_image[0]; // Leftmost pixel of top row of image.
     pnt2 = &l_image[(lysize - 1)*lxsize]; // Leftmost pixel of bottom row of image.
@@ -214,11 +194,11 @@ static ARInt16 *labeling2( ARUint8 *image, int thresh,
 
     wk_max = 0;
     pnt2 = &(l_image[lxsize+1]);
-    if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) {
-        pnt = &(image[(arImXsize*2+2)*AR_PIX_SIZE_DEFAULT]);
+    if (handle->imageProcMode == AR_IMAGE_PROC_IN_HALF) {
+        pnt = &(image[(handle->param.xsize*2+2)*AR_PIX_SIZE_DEFAULT]);
         poff = AR_PIX_SIZE_DEFAULT*2;
     } else {
-        pnt = &(image[(arImXsize+1)*AR_PIX_SIZE_DEFAULT]);
+        pnt = &(image[(handle->param.xsize+1)*AR_PIX_SIZE_DEFAULT]);
         poff = AR_PIX_SIZE_DEFAULT;
     }
     for (j = 1; j < lysize - 1; j++, pnt += poff*2, pnt2 += 2) {
@@ -418,7 +398,7 @@ static ARInt16 *labeling2( ARUint8 *image, int thresh,
                 *pnt2 = 0;
             }
         }
-        if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) pnt += arImXsize*AR_PIX_SIZE_DEFAULT;
+        if (handle->imageProcMode == AR_IMAGE_PROC_IN_HALF) pnt += handle->param.xsize*AR_PIX_SIZE_DEFAULT;
     }
 
     j = 1;
@@ -462,9 +442,9 @@ static ARInt16 *labeling2( ARUint8 *image, int thresh,
     return (l_image);
 }
 
-static ARInt16 *labeling3( ARUint8 *image, int thresh,
+static ARInt16 *labeling3( ARHandle *handle, ARUint8 *image, int thresh,
                            int *label_num, int **area, double **pos, int **clip,
-                           int **label_ref, int LorR )
+                           int **label_ref )
 {
     ARUint8   *pnt;                     /*  image pointer       */
     ARInt16   *pnt1, *pnt2;             /*  image pointer       */
@@ -482,73 +462,24 @@ static ARInt16 *labeling3( ARUint8 *image, int thresh,
     int       *wclip;
     double    *wpos;
 	int		  thresht3 = thresh * 3;
-	static int imageProcModePrev = -1;
-	static int imXsizePrev = -1;
-	static int imYsizePrev = -1;
-
-	// Ensure that the debug image is correct size.
-	// If size has changed, debug image will need to be re-allocated.
-	if (imageProcModePrev != arImageProcMode || imXsizePrev != arImXsize || imYsizePrev != arImYsize) {
-		arLabelingCleanup();
-		imageProcModePrev = arImageProcMode;
-		imXsizePrev = arImXsize;
-		imYsizePrev = arImYsize;
-	}
-
-    if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
-        lxsize = arImXsize / 2;
-        lysize = arImYsize / 2;
-    }
-    else {
-        lxsize = arImXsize;
-        lysize = arImYsize;
-    }
 
-    if( LorR ) {
-        l_image = &l_imageL[0];
-        work    = &workL[0];
-        work2   = &work2L[0];
-        wlabel_num = &wlabel_numL;
-        warea   = &wareaL[0];
-        wclip   = &wclipL[0];
-        wpos    = &wposL[0];
-        if( arImageL == NULL ) {
-#if 0
-            int texXsize = 1;
-            int texYsize = 1;
-            while( texXsize < arImXsize ) texXsize *= 2;
-            if( texXsize > 512 ) texXsize = 512;
-            while( texYsize < arImYsize ) texYsize *= 2;
-            arMalloc( arImageL, ARUint8, texXsize*texYsize*AR_PIX_SIZE_DEFAULT );
-#else
-            arMalloc( arImageL, ARUint8, arImXsize*arImYsize*AR_PIX_SIZE_DEFAULT );
-#endif
-            put_zero( arImageL, lxsize*lysize*AR_PIX_SIZE_DEFAULT );
-            arImage = arImageL;
-        }
+    if( handle->imageProcMode == AR_IMAGE_PROC_IN_HALF ) {
+        lxsize = handle->param.xsize / 2;
+        lysize = handle->param.ysize / 2;
     }
     else {
-        l_image = &l_imageR[0];
-        work    = &workR[0];
-        work2   = &work2R[0];
-        wlabel_num = &wlabel_numR;
-        warea   = &wareaR[0];
-        wclip   = &wclipR[0];
-        wpos    = &wposR[0];
-        if( arImageR == NULL ) {
-#if 0
-            int texXsize = 1;
-            int texYsize = 1;
-            while( texXsize < arImXsize ) texXsize *= 2;
-            if( texXsize > 512 ) texXsize = 512;
-            while( texYsize < arImYsize ) texYsize *= 2;
-            arMalloc( arImageR, ARUint8, texXsize*texYsize*AR_PIX_SIZE_DEFAULT );
-#else
-            arMalloc( arImageR, ARUint8, arImXsize*arImYsize*AR_PIX_SIZE_DEFAULT );
-#endif
-            put_zero( arImageR, lxsize*lysize*AR_PIX_SIZE_DEFAULT );
-        }
+        lxsize = handle->param.xsize;
+        lysize = handle->param.ysize;
     }
+    if( alloc_label( handle, lxsize, lysize ) < 0 ) return(0);
+    if( alloc_image( handle, lxsize, lysize ) < 0 ) return(0);
+    l_image = handle->label_image;
+    work    = handle->label_work;
+    work2   = handle->label_work2;
+    wlabel_num = &(handle->label_num);
+    warea   = handle->label_area;
+    wclip   = handle->label_clip;
+    wpos    = handle->label_pos;
 
     pnt1 = &l_image[0];
     pnt2 = &l_image[(lysize-1)*lxsize];
@@ -566,14 +497,13 @@ static ARInt16 *labeling3( ARUint8 *image, int thresh,
 
     wk_max = 0;
     pnt2 = &(l_image[lxsize+1]);
-    if( LorR ) dpnt = &(arImageL[(lxsize+1)*AR_PIX_SIZE_DEFAULT]);
-    else       dpnt = &(arImageR[(lxsize+1)*AR_PIX_SIZE_DEFAULT]);
-    if( arImageProcMode == AR_IMAGE_PROC_IN_HALF ) {
-        pnt = &(image[(arImXsize*2+2)*AR_PIX_SIZE_DEFAULT]);
+    dpnt = &(handle->image[(lxsize+1)*AR_PIX_SIZE_DEFAULT]);
+    if( handle->imageProcMode == AR_IMAGE_PROC_IN_HALF ) {
+        pnt = &(image[(handle->param.xsize*2+2)*AR_PIX_SIZE_DEFAULT]);
         poff = AR_PIX_SIZE_DEFAULT*2;
     }
     else {
-        pnt = &(image[(arImXsize+1)*AR_PIX_SIZE_DEFAULT]);
+        pnt = &(image[(handle->param.xsize+1)*AR_PIX_SIZE_DEFAULT]);
         poff = AR_PIX_SIZE_DEFAULT;
     }
     for(j = 1; j < lysize-1; j++, pnt+=poff*2, pnt2+=2, dpnt+=AR_PIX_SIZE_DEFAULT*2) {
@@ -729,7 +659,7 @@ static ARInt16 *labeling3( ARUint8 *image, int thresh,
 #  error Unknown default pixel format defined in config.h
 #endif
         }
-        if (arImageProcMode == AR_IMAGE_PROC_IN_HALF) pnt += arImXsize*AR_PIX_SIZE_DEFAULT;
+        if (handle->imageProcMode == AR_IMAGE_PROC_IN_HALF) pnt += handle->param.xsize*AR_PIX_SIZE_DEFAULT;
     }
 
     j = 1;
@@ -775,13 +705,62 @@ static ARInt16 *labeling3( ARUint8 *image, int thresh,
 
 void arLabelingCleanup(void)
 {
-	if (arImageL) {
-		free (arImageL);
-		arImageL = NULL;
-		arImage = NULL;
-	}
-	if (arImageR) {
-		free (arImageR);
-		arImageR = NULL;
-	}
+    ARHandle  *handle;
+
+    handle = arsGetHandle( 1 );
+    free( handle->image );
+    handle->image = NULL;
+    arImageL = NULL;
+    arImage = NULL;
+
+    handle = arsGetHandle( 0 );
+    free( handle->image );
+    handle->image = NULL;
+    arImageR = NULL;
+}
+
+/* the buffers of the labeling, for images of up to lxsize*lysize */
+static int alloc_label( ARHandle *handle, int lxsize, int lysize )
+{
+    ARInt16   *l_image;
+
+    if( handle->label_work == NULL ) {
+        handle->label_work  = (int *)malloc( WORK_SIZE*sizeof(int) );
+        handle->label_work2 = (int *)malloc( WORK_SIZE*7*sizeof(int) );
+        handle->label_area  = (int *)malloc( WORK_SIZE*sizeof(int) );
+        handle->label_clip  = (int *)malloc( WORK_SIZE*4*sizeof(int) );
+        handle->label_pos   = (double *)malloc( WORK_SIZE*2*sizeof(double) );
+        if( handle->label_work == NULL || handle->label_work2 == NULL || handle->label_area == NULL
+         || handle->label_clip == NULL || handle->label_pos == NULL ) {
+            free( handle->label_work );  handle->label_work  = NULL;
+            free( handle->label_work2 ); handle->label_work2 = NULL;
+            free( handle->label_area );  handle->label_area  = NULL;
+            free( handle->label_clip );  handle->label_clip  = NULL;
+            free( handle->label_pos );   handle->label_pos   = NULL;
+            return -1;
+        }
+        handle->label_num = 0;
+    }
+    if( handle->label_size < lxsize*lysize ) {
+        l_image = (ARInt16 *)realloc( handle->label_image, lxsize*lysize*sizeof(ARInt16) );
+        if( l_image == NULL ) return -1;
+        handle->label_image = l_image;
+        handle->label_size  = lxsize*lysize;
+    }
+
+    return 0;
+}
+
+/* the debug image, made again when the size labeled changes */
+static int alloc_image( ARHandle *handle, int lxsize, int lysize )
+{
+    if( handle->image != NULL && handle->image_size == lxsize*lysize ) return 0;
+
+    free( handle->image );
+    handle->image = (ARUint8 *)malloc( handle->param.xsize*handle->param.ysize*AR_PIX_SIZE_DEFAULT );
+    if( handle->image == NULL ) return -1;
+    put_zero( handle->image, lxsize*lysize*AR_PIX_SIZE_DEFAULT );
+    handle->image_size = lxsize*lysize;
+
+    return 0;
 }
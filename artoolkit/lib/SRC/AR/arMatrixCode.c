@@ -0,0 +1,244 @@
+/*******************************************************
+ *
+ *  Matrix (2D barcode) markers.
+ *
+ *  The inside of the marker is a N x N grid of dark/light cells,
+ *  read from the arGetPatt() sample grid.  Three corner cells give the
+ *  orientation (top-left and top-right dark, bottom-left light), the
+ *  remaining N*N-3 cells hold a systematic cyclic code word, read in
+ *  row order from the top-left, first cell = most significant bit.
+ *  The marker id is the data part of the code word.  Errors are
+ *  corrected with a syndrome table built from the generator polynomial.
+ *
+*******************************************************/
+
+#include <stdio.h>
+#include <AR/ar.h>
+#if AR_POSE_THREAD_MAX > 0
+#include <pthread.h>
+#endif
+
+#define   CODE_TYPE_NUM     5
+#define   PARITY_MAX       10
+#define   CELL_MAX          5
+/* minimum difference of cell grey levels for a grid to be read at all */
+#define   CONTRAST_MIN     30
+/* cf of a word corrected at the limit of the code, below the 0.5 of arDetectMarker */
+#define   CF_CORRECTED     0.45
+/* cf of the codes without parity, where any grid decodes */
+#define   CF_UNCHECKED     0.5
+
+typedef struct {
+    int     size;       /* N */
+    int     n;          /* code word length, N*N-3 */
+    int     k;          /* data bits */
+    int     t;          /* correctable errors */
+    int     g;          /* generator polynomial, degree n-k */
+} CodeType;
+
+static CodeType codeType[CODE_TYPE_NUM] = {
+    { 3,  6,  6, 0, 0x001 },    /* AR_MATRIX_CODE_3x3 */
+    { 3,  6,  3, 1, 0x00b },    /* AR_MATRIX_CODE_3x3_HAMMING63:   x^3+x+1 */
+    { 4, 13, 13, 0, 0x001 },    /* AR_MATRIX_CODE_4x4 */
+    { 4, 13,  9, 1, 0x013 },    /* AR_MATRIX_CODE_4x4_BCH_13_9_3:  x^4+x+1 */
+    { 5, 22, 12, 2, 0x769 }     /* AR_MATRIX_CODE_5x5_BCH_22_12_5: (x^5+x^2+1)(x^5+x^4+x^3+x^2+1) */
+};
+
+/* syndrome -> error pattern, -1 when not correctable; built once for all the types */
+static int    syndrome_err[CODE_TYPE_NUM][1 << PARITY_MAX];
+#if AR_POSE_THREAD_MAX > 0
+static pthread_once_t syndrome_once = PTHREAD_ONCE_INIT;
+#else
+static int    syndrome_init = 0;
+#endif
+
+static int    get_syndrome( CodeType *ct, int word );
+static void   init_syndrome( void );
+static int    bit_count( int v );
+
+
+int arMatrixCodeEncode( int type, int id, ARUint8 *cells )
+{
+    CodeType  *ct;
+    int       word;
+    int       x, y, b;
+
+    if( type < 0 || type >= CODE_TYPE_NUM ) return -1;
+    ct = &codeType[type];
+    if( id < 0 || id >= (1 << ct->k) ) return -1;
+
+    word = id << (ct->n - ct->k);
+    word |= get_syndrome( ct, word );
+
+    b = ct->n - 1;
+    for( y = 0; y < ct->size; y++ ) {
+        for( x = 0; x < ct->size; x++ ) {
+            if( y == 0 && (x == 0 || x == ct->size-1) ) {
+                cells[y*ct->size+x] = 1;
+            }
+            else if( y == ct->size-1 && x == 0 ) {
+                cells[y*ct->size+x] = 0;
+            }
+            else {
+                cells[y*ct->size+x] = (word >> b) & 1;
+                b--;
+            }
+        }
+    }
+
+    return ct->size;
+}
+
+int arGetMatrixCode( ARUint8 ext_pat[AR_PATT_SIZE_Y][AR_PATT_SIZE_X][3],
+                     int *code, int *dir, double *cf )
+{
+    CodeType  *ct;
+    double    cell[CELL_MAX*CELL_MAX];
+    int       bit[CELL_MAX*CELL_MAX];
+    double    w, min, max, thresh;
+    int       size, x1, x2, y1, y2, num;
+    int       word, err, s;
+    int       i, j, x, y, xx, yy, b;
+
+    *code = -1;
+    *dir  = 0;
+    *cf   = 0.0;
+    if( arMatrixCodeType < 0 || arMatrixCodeType >= CODE_TYPE_NUM ) return -1;
+    ct = &codeType[arMatrixCodeType];
+    size = ct->size;
+
+    /* mean grey level of the samples well inside each cell */
+    for( j = 0; j < size; j++ ) {
+        y1 = (int)((j + 0.2) * AR_PATT_SIZE_Y / size + 0.5);
+        y2 = (int)((j + 0.8) * AR_PATT_SIZE_Y / size - 0.5);
+        for( i = 0; i < size; i++ ) {
+            x1 = (int)((i + 0.2) * AR_PATT_SIZE_X / size + 0.5);
+            x2 = (int)((i + 0.8) * AR_PATT_SIZE_X / size - 0.5);
+            w = 0.0;
+            num = 0;
+            for( y = y1; y <= y2; y++ ) {
+                for( x = x1; x <= x2; x++ ) {
+                    w += ext_pat[y][x][0] + ext_pat[y][x][1] + ext_pat[y][x][2];
+                    num++;
+                }
+            }
+            cell[j*size+i] = (num > 0)? w / (num*3): 0.0;
+        }
+    }
+
+    min = max = cell[0];
+    for( i = 1; i < size*size; i++ ) {
+        if( cell[i] < min ) min = cell[i];
+        if( cell[i] > max ) max = cell[i];
+    }
+    if( max - min < CONTRAST_MIN ) return -1;
+    thresh = (min + max) / 2.0;
+    for( i = 0; i < size*size; i++ ) bit[i] = (cell[i] < thresh)? 1: 0;
+
+    /*
+     *  direction: the grid turned j quarters (as the input of template
+     *  matching) must show the orientation corners.
+     */
+    for( j = 0; j < 4; j++ ) {
+        for( b = 0; b < 3; b++ ) {
+            x = (b == 1)? size-1: 0;
+            y = (b == 2)? size-1: 0;
+            switch( j ) {
+              case 0:  xx = x;        yy = y;        break;
+              case 1:  xx = y;        yy = size-1-x; break;
+              case 2:  xx = size-1-x; yy = size-1-y; break;
+              default: xx = size-1-y; yy = x;        break;
+            }
+            if( bit[yy*size+xx] != ((b < 2)? 1: 0) ) break;
+        }
+        if( b == 3 ) break;
+    }
+    if( j == 4 ) return -1;
+
+    word = 0;
+    for( y = 0; y < size; y++ ) {
+        for( x = 0; x < size; x++ ) {
+            if( y == 0 && (x == 0 || x == size-1) ) continue;
+            if( y == size-1 && x == 0 ) continue;
+            switch( j ) {
+              case 0:  xx = x;        yy = y;        break;
+              case 1:  xx = y;        yy = size-1-x; break;
+              case 2:  xx = size-1-x; yy = size-1-y; break;
+              default: xx = size-1-y; yy = x;        break;
+            }
+            word = (word << 1) | bit[yy*size+xx];
+        }
+    }
+
+#if AR_POSE_THREAD_MAX > 0
+    pthread_once( &syndrome_once, init_syndrome );
+#else
+    if( syndrome_init == 0 ) init_syndrome();
+#endif
+    s = get_syndrome( ct, word );
+    err = syndrome_err[arMatrixCodeType][s];
+    if( err < 0 ) return -1;
+    word ^= err;
+
+    *code = word >> (ct->n - ct->k);
+    *dir  = j;
+    /*
+     *  every corrected bit costs confidence, down to CF_CORRECTED when
+     *  the code corrects all it can; a code without parity cannot tell
+     *  a marker from any grid with the orientation corners.
+     */
+    if( ct->t == 0 ) *cf = CF_UNCHECKED;
+    else             *cf = 1.0 - (1.0 - CF_CORRECTED) * bit_count(err) / ct->t;
+
+    return 0;
+}
+
+static int get_syndrome( CodeType *ct, int word )
+{
+    int     deg, i;
+
+    deg = ct->n - ct->k;
+    for( i = ct->n - 1; i >= deg; i-- ) {
+        if( word & (1 << i) ) word ^= ct->g << (i - deg);
+    }
+
+    return word;
+}
+
+static void init_syndrome( void )
+{
+    CodeType  *ct;
+    int       type, e, i, j;
+
+    for( type = 0; type < CODE_TYPE_NUM; type++ ) {
+        ct = &codeType[type];
+        for( i = 0; i < (1 << (ct->n - ct->k)); i++ ) syndrome_err[type][i] = -1;
+        syndrome_err[type][0] = 0;
+        if( ct->t >= 1 ) {
+            for( i = 0; i < ct->n; i++ ) {
+                e = 1 << i;
+                syndrome_err[type][get_syndrome(ct, e)] = e;
+            }
+        }
+        if( ct->t >= 2 ) {
+            for( i = 0; i < ct->n; i++ ) {
+                for( j = i+1; j < ct->n; j++ ) {
+                    e = (1 << i) | (1 << j);
+                    syndrome_err[type][get_syndrome(ct, e)] = e;
+                }
+            }
+        }
+    }
+#if AR_POSE_THREAD_MAX == 0
+    syndrome_init = 1;
+#endif
+}
+
+static int bit_count( int v )
+{
+    int     n;
+
+    for( n = 0; v; v &= v-1 ) n++;
+
+    return n;
+}
@@ -0,0 +1,151 @@
+/*******************************************************
+ *
+ *  Constant velocity motion model of a marker pose.
+ *
+ *  The rotation and the translation move independently in camera
+ *  coordinates: R(t) = exp([w]x (t-t0)) R(t0) and T(t) = T(t0) + v (t-t0).
+ *  The velocities are corrected by AR_MOTION_VELOCITY_GAIN of the
+ *  prediction error at each update (an alpha-beta filter with alpha 1,
+ *  since the measured pose is much better than the prediction).
+ *
+*******************************************************/
+
+#include <math.h>
+#include <AR/ar.h>
+
+static void rot_exp( double w[3], double rot[3][3] );
+static void rot_log( double rot[3][3], double w[3] );
+
+void arMotionInit( ARMotion *motion )
+{
+    int     i;
+
+    for( i = 0; i < 3; i++ ) {
+        motion->vrot[i]   = 0.0;
+        motion->vtrans[i] = 0.0;
+    }
+    motion->time  = 0.0;
+    motion->count = 0;
+}
+
+int arMotionPredict( ARMotion *motion, double time, double conv[3][4] )
+{
+    double  w[3], drot[3][3], dt;
+    int     i, j;
+
+    if( motion->count == 0 ) return -1;
+
+    dt = time - motion->time;
+    for( i = 0; i < 3; i++ ) w[i] = motion->vrot[i] * dt;
+    rot_exp( w, drot );
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) {
+            conv[j][i] = drot[j][0] * motion->conv[0][i]
+                       + drot[j][1] * motion->conv[1][i]
+                       + drot[j][2] * motion->conv[2][i];
+        }
+        conv[j][3] = motion->conv[j][3] + motion->vtrans[j] * dt;
+    }
+
+    return 0;
+}
+
+int arMotionUpdate( ARMotion *motion, double time, double conv[3][4] )
+{
+    double  pred[3][4], drot[3][3], w[3];
+    double  dt, k;
+    int     i, j;
+
+    dt = time - motion->time;
+    if( motion->count > 0 && dt > 0.0 ) {
+        /* the first velocity is taken as measured */
+        k = (motion->count == 1)? 1.0: AR_MOTION_VELOCITY_GAIN;
+        arMotionPredict( motion, time, pred );
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) {
+                drot[j][i] = conv[j][0] * pred[i][0]
+                           + conv[j][1] * pred[i][1]
+                           + conv[j][2] * pred[i][2];
+            }
+        }
+        rot_log( drot, w );
+        for( i = 0; i < 3; i++ ) {
+            motion->vrot[i]   += k * w[i] / dt;
+            motion->vtrans[i] += k * (conv[i][3] - pred[i][3]) / dt;
+        }
+        motion->count++;
+    }
+    else {
+        for( i = 0; i < 3; i++ ) {
+            motion->vrot[i]   = 0.0;
+            motion->vtrans[i] = 0.0;
+        }
+        motion->count = 1;
+    }
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 4; i++ ) motion->conv[j][i] = conv[j][i];
+    }
+    motion->time = time;
+
+    return 0;
+}
+
+double arGetTransMatMotion( ARMarkerInfo *marker_info, ARMotion *motion, double time,
+                            double center[2], double width, double conv[3][4] )
+{
+    double  pred[3][4];
+    double  err;
+
+    if( arMotionPredict( motion, time, pred ) < 0 ) {
+        err = arGetTransMat( marker_info, center, width, conv );
+    }
+    else {
+        err = arGetTransMatCont( marker_info, pred, center, width, conv );
+    }
+    if( err >= 0.0 ) arMotionUpdate( motion, time, conv );
+
+    return err;
+}
+
+static void rot_exp( double w[3], double rot[3][3] )
+{
+    double  th, s, c, k[3];
+    int     i, j;
+
+    th = sqrt( w[0]*w[0] + w[1]*w[1] + w[2]*w[2] );
+    if( th == 0.0 ) {
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) rot[j][i] = (i == j)? 1.0: 0.0;
+        }
+        return;
+    }
+    k[0] = w[0] / th; k[1] = w[1] / th; k[2] = w[2] / th;
+    s = sin( th );
+    c = cos( th );
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) rot[j][i] = (1.0 - c) * k[j] * k[i];
+        rot[j][j] += c;
+    }
+    rot[0][1] -= s*k[2]; rot[1][0] += s*k[2];
+    rot[0][2] += s*k[1]; rot[2][0] -= s*k[1];
+    rot[1][2] -= s*k[0]; rot[2][1] += s*k[0];
+}
+
+static void rot_log( double rot[3][3], double w[3] )
+{
+    double  c, s, th;
+
+    w[0] = (rot[2][1] - rot[1][2]) / 2.0;
+    w[1] = (rot[0][2] - rot[2][0]) / 2.0;
+    w[2] = (rot[1][0] - rot[0][1]) / 2.0;
+    c = (rot[0][0] + rot[1][1] + rot[2][2] - 1.0) / 2.0;
+    s = sqrt( w[0]*w[0] + w[1]*w[1] + w[2]*w[2] );
+    if( s < 1.0e-10 ) return;
+
+    /* the axis gets inaccurate near half a turn, never reached between frames */
+    th = atan2( s, c );
+    w[0] *= th / s;
+    w[1] *= th / s;
+    w[2] *= th / s;
+}
@@ -0,0 +1,369 @@
+/*******************************************************
+ *
+ *  Capture, detection and pose of a camera as a pipeline.
+ *
+ *  The frames go round a ring of depth slots. Each stage takes the
+ *  slots in turn once the stage before is done with them: capture
+ *  copies an image into a free slot, detection and pose fill it, and
+ *  the caller gets it, draws it and releases it. Each stage has its
+ *  thread, so frame N+1 is detected while frame N is posed and drawn;
+ *  a stage that runs ahead waits for a slot, which bounds the queues.
+ *  Without threads (AR_POSE_THREAD_MAX 0) arPipelineGetFrame runs the
+ *  three stages of a frame itself.
+ *
+*******************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <AR/ar.h>
+#if AR_POSE_THREAD_MAX > 0
+#include <pthread.h>
+#endif
+
+/* the state of a slot is the stage it waits for */
+#define  STAGE_CAPTURE      0
+#define  STAGE_DETECT       1
+#define  STAGE_POSE         2
+#define  STAGE_PRESENT      3
+#define  FRAME_HELD         4
+
+#if AR_POSE_THREAD_MAX > 0
+typedef struct {
+    pthread_t        thread[3];
+    int              thread_num;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    int              quit;
+} PipelineSync;
+
+static ARPipelineFrame *wait_frame( ARPipeline *pipeline, int stage );
+static void  done_frame( ARPipeline *pipeline, int stage );
+static void  *capture_thread( void *arg );
+static void  *detect_thread( void *arg );
+static void  *pose_thread( void *arg );
+#endif
+
+static int   capture_frame( ARPipeline *pipeline, ARPipelineFrame *frame );
+static void  detect_frame( ARPipeline *pipeline, ARPipelineFrame *frame );
+static void  pose_frame( ARPipeline *pipeline, ARPipelineFrame *frame );
+static void  lock( ARPipeline *pipeline );
+static void  unlock( ARPipeline *pipeline );
+
+ARPipeline *arCreatePipeline( ARHandle *handle, int thresh, int depth,
+                              ARUint8 *(*capture)(void *userdata),
+                              int (*capture_next)(void *userdata),
+                              void *userdata )
+{
+    ARPipeline     *pipeline;
+    int            size, i;
+#if AR_POSE_THREAD_MAX > 0
+    PipelineSync   *sync;
+    void           *(*func[3])(void *);
+#endif
+
+    if( depth <= 0 ) depth = AR_PIPELINE_DEPTH;
+    if( depth < 2 ) depth = 2;
+
+    pipeline = (ARPipeline *)malloc( sizeof(ARPipeline) );
+    if( pipeline == NULL ) return NULL;
+    pipeline->handle       = handle;
+    pipeline->thresh       = thresh;
+    pipeline->frame_num    = depth;
+    pipeline->capture      = capture;
+    pipeline->capture_next = capture_next;
+    pipeline->userdata     = userdata;
+    pipeline->serial       = 0;
+    pipeline->sync         = NULL;
+    for( i = 0; i < AR_PIPELINE_PATT_MAX; i++ ) pipeline->patt_width[i] = 0.0;
+    for( i = 0; i < 4; i++ ) pipeline->next[i] = 0;
+
+    pipeline->frame = (ARPipelineFrame *)malloc( depth*sizeof(ARPipelineFrame) );
+    if( pipeline->frame == NULL ) {
+        free( pipeline );
+        return NULL;
+    }
+    size = handle->param.xsize * handle->param.ysize * AR_PIX_SIZE_DEFAULT;
+    for( i = 0; i < depth; i++ ) {
+        pipeline->frame[i].state      = STAGE_CAPTURE;
+        pipeline->frame[i].marker_num = 0;
+        pipeline->frame[i].image = (ARUint8 *)malloc( size );
+        if( pipeline->frame[i].image == NULL ) break;
+    }
+    if( i < depth ) {
+        while( --i >= 0 ) free( pipeline->frame[i].image );
+        free( pipeline->frame );
+        free( pipeline );
+        return NULL;
+    }
+
+#if AR_POSE_THREAD_MAX > 0
+    sync = (PipelineSync *)malloc( sizeof(PipelineSync) );
+    if( sync == NULL ) {
+        pipeline->sync = NULL;
+        arDeletePipeline( pipeline );
+        return NULL;
+    }
+    sync->thread_num = 0;
+    sync->quit       = 0;
+    pthread_mutex_init( &sync->mutex, NULL );
+    pthread_cond_init( &sync->cond, NULL );
+    pipeline->sync = sync;
+
+    func[0] = capture_thread;
+    func[1] = detect_thread;
+    func[2] = pose_thread;
+    for( i = 0; i < 3; i++ ) {
+        if( pthread_create( &sync->thread[i], NULL, func[i], pipeline ) != 0 ) {
+            arDeletePipeline( pipeline );
+            return NULL;
+        }
+        sync->thread_num++;
+    }
+#endif
+
+    return pipeline;
+}
+
+int arDeletePipeline( ARPipeline *pipeline )
+{
+    int            i;
+#if AR_POSE_THREAD_MAX > 0
+    PipelineSync   *sync;
+
+    sync = (PipelineSync *)pipeline->sync;
+    if( sync != NULL ) {
+        pthread_mutex_lock( &sync->mutex );
+        sync->quit = 1;
+        pthread_cond_broadcast( &sync->cond );
+        pthread_mutex_unlock( &sync->mutex );
+        for( i = 0; i < sync->thread_num; i++ ) pthread_join( sync->thread[i], NULL );
+        pthread_cond_destroy( &sync->cond );
+        pthread_mutex_destroy( &sync->mutex );
+        free( sync );
+    }
+#endif
+
+    for( i = 0; i < pipeline->frame_num; i++ ) free( pipeline->frame[i].image );
+    free( pipeline->frame );
+    free( pipeline );
+
+    return 0;
+}
+
+int arPipelineSetPatt( ARPipeline *pipeline, int patt_id, double center[2], double width )
+{
+    if( patt_id < 0 || patt_id >= AR_PIPELINE_PATT_MAX ) return -1;
+
+    lock( pipeline );
+    pipeline->patt_width[patt_id]     = width;
+    pipeline->patt_center[patt_id][0] = center[0];
+    pipeline->patt_center[patt_id][1] = center[1];
+    unlock( pipeline );
+
+    return 0;
+}
+
+ARPipelineFrame *arPipelineGetFrame( ARPipeline *pipeline, int wait )
+{
+    ARPipelineFrame   *frame;
+#if AR_POSE_THREAD_MAX > 0
+    PipelineSync      *sync;
+
+    sync = (PipelineSync *)pipeline->sync;
+    pthread_mutex_lock( &sync->mutex );
+    frame = &(pipeline->frame[pipeline->next[STAGE_PRESENT]]);
+    while( frame->state != STAGE_PRESENT ) {
+        if( !wait || sync->quit ) {
+            pthread_mutex_unlock( &sync->mutex );
+            return NULL;
+        }
+        pthread_cond_wait( &sync->cond, &sync->mutex );
+    }
+    frame->state = FRAME_HELD;
+    pipeline->next[STAGE_PRESENT] = (pipeline->next[STAGE_PRESENT] + 1) % pipeline->frame_num;
+    pthread_mutex_unlock( &sync->mutex );
+#else
+    int               i;
+
+    frame = &(pipeline->frame[pipeline->next[STAGE_PRESENT]]);
+    if( frame->state != STAGE_CAPTURE ) return NULL;
+    while( capture_frame( pipeline, frame ) < 0 ) {
+        if( !wait ) return NULL;
+        arUtilSleep(2);
+    }
+    detect_frame( pipeline, frame );
+    pose_frame( pipeline, frame );
+    frame->state = FRAME_HELD;
+    for( i = 0; i < 4; i++ ) {
+        pipeline->next[i] = (pipeline->next[i] + 1) % pipeline->frame_num;
+    }
+#endif
+
+    return frame;
+}
+
+int arPipelineReleaseFrame( ARPipeline *pipeline, ARPipelineFrame *frame )
+{
+    if( frame->state != FRAME_HELD ) return -1;
+
+    lock( pipeline );
+    frame->state = STAGE_CAPTURE;
+#if AR_POSE_THREAD_MAX > 0
+    pthread_cond_broadcast( &((PipelineSync *)pipeline->sync)->cond );
+#endif
+    unlock( pipeline );
+
+    return 0;
+}
+
+/* the image is copied so that the camera can go on to the next one */
+static int capture_frame( ARPipeline *pipeline, ARPipelineFrame *frame )
+{
+    ARUint8   *image;
+    double    time;
+
+    image = (*pipeline->capture)( pipeline->userdata );
+    if( image == NULL ) return -1;
+    time = arUtilGetTime();
+
+    memcpy( frame->image, image, pipeline->handle->param.xsize * pipeline->handle->param.ysize
+                                 * AR_PIX_SIZE_DEFAULT );
+    if( pipeline->capture_next != NULL ) (*pipeline->capture_next)( pipeline->userdata );
+
+    frame->serial       = pipeline->serial++;
+    frame->time_capture = time;
+
+    return 0;
+}
+
+static void detect_frame( ARPipeline *pipeline, ARPipelineFrame *frame )
+{
+    ARMarkerInfo   *marker_info;
+    int            marker_num, i;
+
+    if( arHandleDetectMarker( pipeline->handle, frame->image, pipeline->thresh,
+                              &marker_info, &marker_num ) < 0 ) marker_num = 0;
+    for( i = 0; i < marker_num; i++ ) frame->marker_info[i] = marker_info[i];
+    frame->marker_num  = marker_num;
+    frame->time_detect = arUtilGetTime();
+}
+
+/* the markers whose pattern has no width are not posed */
+static void pose_frame( ARPipeline *pipeline, ARPipelineFrame *frame )
+{
+    double   width[AR_SQUARE_MAX*2];
+    double   center[AR_SQUARE_MAX*2][2];
+    int      id, i;
+
+    lock( pipeline );
+    for( i = 0; i < frame->marker_num; i++ ) {
+        id = frame->marker_info[i].id;
+        if( id < 0 || id >= AR_PIPELINE_PATT_MAX ) {
+            width[i] = 0.0;
+            continue;
+        }
+        width[i]     = pipeline->patt_width[id];
+        center[i][0] = pipeline->patt_center[id][0];
+        center[i][1] = pipeline->patt_center[id][1];
+    }
+    unlock( pipeline );
+
+    for( i = 0; i < frame->marker_num; i++ ) {
+        if( width[i] <= 0.0 ) {
+            frame->err[i] = -1.0;
+            continue;
+        }
+        frame->err[i] = arHandleGetTransMat( pipeline->handle, &(frame->marker_info[i]),
+                                             center[i], width[i], frame->conv[i] );
+    }
+    frame->time_pose = arUtilGetTime();
+}
+
+static void lock( ARPipeline *pipeline )
+{
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_lock( &((PipelineSync *)pipeline->sync)->mutex );
+#endif
+}
+
+static void unlock( ARPipeline *pipeline )
+{
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_unlock( &((PipelineSync *)pipeline->sync)->mutex );
+#endif
+}
+
+#if AR_POSE_THREAD_MAX > 0
+/* the next slot of a stage, once the stage before is done with it; NULL when stopped */
+static ARPipelineFrame *wait_frame( ARPipeline *pipeline, int stage )
+{
+    PipelineSync      *sync;
+    ARPipelineFrame   *frame;
+
+    sync = (PipelineSync *)pipeline->sync;
+    pthread_mutex_lock( &sync->mutex );
+    frame = &(pipeline->frame[pipeline->next[stage]]);
+    while( frame->state != stage && !sync->quit ) pthread_cond_wait( &sync->cond, &sync->mutex );
+    if( sync->quit ) frame = NULL;
+    pthread_mutex_unlock( &sync->mutex );
+
+    return frame;
+}
+
+static void done_frame( ARPipeline *pipeline, int stage )
+{
+    PipelineSync      *sync;
+
+    sync = (PipelineSync *)pipeline->sync;
+    pthread_mutex_lock( &sync->mutex );
+    pipeline->frame[pipeline->next[stage]].state = stage + 1;
+    pipeline->next[stage] = (pipeline->next[stage] + 1) % pipeline->frame_num;
+    pthread_cond_broadcast( &sync->cond );
+    pthread_mutex_unlock( &sync->mutex );
+}
+
+static void *capture_thread( void *arg )
+{
+    ARPipeline        *pipeline;
+    ARPipelineFrame   *frame;
+
+    pipeline = (ARPipeline *)arg;
+    while( (frame = wait_frame( pipeline, STAGE_CAPTURE )) != NULL ) {
+        if( capture_frame( pipeline, frame ) < 0 ) {
+            arUtilSleep(2);
+            continue;
+        }
+        done_frame( pipeline, STAGE_CAPTURE );
+    }
+
+    return NULL;
+}
+
+static void *detect_thread( void *arg )
+{
+    ARPipeline        *pipeline;
+    ARPipelineFrame   *frame;
+
+    pipeline = (ARPipeline *)arg;
+    while( (frame = wait_frame( pipeline, STAGE_DETECT )) != NULL ) {
+        detect_frame( pipeline, frame );
+        done_frame( pipeline, STAGE_DETECT );
+    }
+
+    return NULL;
+}
+
+static void *pose_thread( void *arg )
+{
+    ARPipeline        *pipeline;
+    ARPipelineFrame   *frame;
+
+    pipeline = (ARPipeline *)arg;
+    while( (frame = wait_frame( pipeline, STAGE_POSE )) != NULL ) {
+        pose_frame( pipeline, frame );
+        done_frame( pipeline, STAGE_POSE );
+    }
+
+    return NULL;
+}
+#endif
@@ -0,0 +1,120 @@
+/*******************************************************
+ *
+ *  The pool of worker threads of the pose functions.
+ *
+ *  arGetTransMatBatch and arMultiGetTransMatAll share the items of a
+ *  job (markers, patterns) out to AR_POSE_THREAD_MAX threads, created on
+ *  the first job and kept, plus the calling thread. One job runs at a
+ *  time: a caller that finds the pool busy runs its items itself.
+ *
+*******************************************************/
+
+#include <stdlib.h>
+#include <AR/ar.h>
+#if AR_POSE_THREAD_MAX > 0
+#include <pthread.h>
+#endif
+
+#if AR_POSE_THREAD_MAX > 0
+typedef struct {
+    void           (*func)( void *context, int item );
+    void           *context;
+    int            num;
+    int            next;
+    int            done;
+    int            serial;
+} Job;
+
+static Job              job;
+static int              thread_num = 0;
+static pthread_mutex_t  pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  job_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   job_start  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   job_end    = PTHREAD_COND_INITIALIZER;
+
+static void  *worker( void *arg );
+static void  run_job( void );
+#endif
+
+void arRunJob( void (*func)( void *context, int item ), void *context, int num )
+{
+    int     i;
+#if AR_POSE_THREAD_MAX > 0
+    pthread_t   thread;
+#endif
+
+    if( num <= 0 ) return;
+
+#if AR_POSE_THREAD_MAX > 0
+    if( num > 1 && pthread_mutex_trylock( &pool_mutex ) == 0 ) {
+        if( thread_num == 0 ) {
+            for( i = 0; i < AR_POSE_THREAD_MAX; i++ ) {
+                if( pthread_create(&thread, NULL, worker, NULL) != 0 ) break;
+                pthread_detach( thread );
+                thread_num++;
+            }
+        }
+        if( thread_num > 0 ) {
+            pthread_mutex_lock( &job_mutex );
+            job.func    = func;
+            job.context = context;
+            job.num     = num;
+            job.next    = 0;
+            job.done    = 0;
+            job.serial++;
+            pthread_cond_broadcast( &job_start );
+            pthread_mutex_unlock( &job_mutex );
+
+            run_job();
+
+            pthread_mutex_lock( &job_mutex );
+            while( job.done < job.num ) pthread_cond_wait( &job_end, &job_mutex );
+            job.num = 0;
+            pthread_mutex_unlock( &job_mutex );
+            pthread_mutex_unlock( &pool_mutex );
+            return;
+        }
+        pthread_mutex_unlock( &pool_mutex );
+    }
+#endif
+
+    for( i = 0; i < num; i++ ) (*func)( context, i );
+}
+
+#if AR_POSE_THREAD_MAX > 0
+static void *worker( void *arg )
+{
+    int     serial = 0;
+
+    (void)arg;
+    for(;;) {
+        pthread_mutex_lock( &job_mutex );
+        while( job.serial == serial ) pthread_cond_wait( &job_start, &job_mutex );
+        serial = job.serial;
+        pthread_mutex_unlock( &job_mutex );
+
+        run_job();
+    }
+
+    return NULL;
+}
+
+/* takes items of the current job until none is left */
+static void run_job( void )
+{
+    int     i;
+
+    pthread_mutex_lock( &job_mutex );
+    for(;;) {
+        if( job.next >= job.num ) break;
+        i = job.next++;
+        pthread_mutex_unlock( &job_mutex );
+
+        (*job.func)( job.context, i );
+
+        pthread_mutex_lock( &job_mutex );
+        if( ++job.done == job.num ) pthread_cond_signal( &job_end );
+    }
+    pthread_mutex_unlock( &job_mutex );
+}
+#endif
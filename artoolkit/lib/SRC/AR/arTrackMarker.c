@@ -0,0 +1,318 @@
+/*******************************************************
+ *
+ *  Tracking of the markers of a camera stream by their corners.
+ *
+ *  Between two full detections the four corners of every identified
+ *  marker are followed with a pyramidal Lucas-Kanade tracker: each corner
+ *  keeps a small patch of the last frame at AR_TRACK_LEVEL levels, each
+ *  level the 2x2 average of the one below, and its translation into the
+ *  new frame is found from the coarsest level down by inverse
+ *  compositional Gauss-Newton steps. Only the patches and the search
+ *  windows around them are read from the image.
+ *
+*******************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <AR/ar.h>
+
+/* levels of the pyramid; a corner moves up to about AR_TRACK_SEARCH*(2^AR_TRACK_LEVEL-1) pixels */
+#define  AR_TRACK_LEVEL         3
+/* half size of the window matched around a corner, in pixels of its level */
+#define  AR_TRACK_WIN           4
+/* displacement searched at each level, in pixels of the level */
+#define  AR_TRACK_SEARCH        5
+#define  AR_TRACK_LOOP_COUNT    10
+/* mean absolute difference of a tracked corner to its patch, in sums of the 3 channels */
+#define  AR_TRACK_MAX_RESIDUAL  60.0
+/* smallest eigenvalue of the gradient matrix of a patch, per pixel */
+#define  AR_TRACK_MIN_EIGEN     100.0
+
+#define  PATCH_SIZE     (AR_TRACK_WIN*2+3)
+#define  SEARCH_SIZE    (PATCH_SIZE+AR_TRACK_SEARCH*2)
+
+#if (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_ARGB)
+#  define  GRAY(p)  ((p)[1] + (p)[2] + (p)[3])
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_ABGR)
+#  define  GRAY(p)  ((p)[1] + (p)[2] + (p)[3])
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_BGRA)
+#  define  GRAY(p)  ((p)[0] + (p)[1] + (p)[2])
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_BGR)
+#  define  GRAY(p)  ((p)[0] + (p)[1] + (p)[2])
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_RGBA)
+#  define  GRAY(p)  ((p)[0] + (p)[1] + (p)[2])
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_RGB)
+#  define  GRAY(p)  ((p)[0] + (p)[1] + (p)[2])
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_MONO)
+#  define  GRAY(p)  ((p)[0] * 3)
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_2vuy)
+#  define  GRAY(p)  ((p)[1] * 3)
+#elif (AR_DEFAULT_PIXEL_FORMAT == AR_PIXEL_FORMAT_yuvs)
+#  define  GRAY(p)  ((p)[0] * 3)
+#else
+#  error Unknown default pixel format defined in config.h
+#endif
+
+/* the patches of the corners of marker_info[i] of the tracker are patch[i] */
+typedef struct {
+    int     valid;
+    double  corner[4][2];
+    int     level[4];
+    int     org[4][AR_TRACK_LEVEL][2];
+    float   image[4][AR_TRACK_LEVEL][PATCH_SIZE*PATCH_SIZE];
+} TrackPatch;
+
+static ARParam *get_param( ARTracker *tracker, ARParam *wparam );
+static int    get_level( ARParam *cparam, ARUint8 *dataPtr, int level, int x0, int y0, int size, float *buf );
+static int    track_marker( ARParam *cparam, ARUint8 *dataPtr, TrackPatch *patch, ARMarkerInfo *minfo );
+static int    track_corner( ARParam *cparam, ARUint8 *dataPtr, TrackPatch *patch, int c, double d[2] );
+static double get_area( double corner[4][2] );
+
+int arTrackerSetPatch( ARTracker *tracker, ARUint8 *dataPtr )
+{
+    TrackPatch   *patch;
+    ARMarkerInfo *minfo;
+    ARParam      wparam, *cparam;
+    double       ox, oy;
+    int          i, c, l;
+
+    if( tracker->patch == NULL ) {
+        tracker->patch = malloc( sizeof(TrackPatch) * AR_SQUARE_MAX * 2 );
+        if( tracker->patch == NULL ) return -1;
+    }
+    patch = (TrackPatch *)tracker->patch;
+    cparam = get_param( tracker, &wparam );
+
+    for( i = 0; i < tracker->track_num; i++ ) {
+        minfo = &(tracker->marker_info[i]);
+        patch[i].valid = 0;
+        if( minfo->id < 0 ) continue;
+
+        for( c = 0; c < 4; c++ ) {
+            arParamIdeal2Observ( cparam->dist_factor, minfo->vertex[c][0], minfo->vertex[c][1], &ox, &oy );
+            patch[i].corner[c][0] = ox;
+            patch[i].corner[c][1] = oy;
+            /* near the border of the image only the finer levels fit */
+            for( l = 0; l < AR_TRACK_LEVEL; l++ ) {
+                patch[i].org[c][l][0] = (int)floor( ox / (1 << l) ) - AR_TRACK_WIN - 1;
+                patch[i].org[c][l][1] = (int)floor( oy / (1 << l) ) - AR_TRACK_WIN - 1;
+                if( get_level( cparam, dataPtr, l, patch[i].org[c][l][0], patch[i].org[c][l][1],
+                               PATCH_SIZE, patch[i].image[c][l] ) < 0 ) break;
+            }
+            patch[i].level[c] = l;
+            if( l == 0 ) break;
+        }
+        if( c == 4 ) patch[i].valid = 1;
+    }
+
+    return 0;
+}
+
+int arTrackerTrackMarker( ARTracker *tracker, ARUint8 *dataPtr )
+{
+    TrackPatch   *patch;
+    ARParam      wparam, *cparam;
+    int          num, lost, i;
+
+    if( tracker->patch == NULL ) return -1;
+    patch = (TrackPatch *)tracker->patch;
+    cparam = get_param( tracker, &wparam );
+
+    num = lost = 0;
+    for( i = 0; i < tracker->track_num; i++ ) {
+        if( tracker->marker_info[i].id < 0 ) continue;
+        if( track_marker( cparam, dataPtr, &patch[i], &(tracker->marker_info[i]) ) < 0 ) {
+            lost++;
+            continue;
+        }
+        if( num < i ) tracker->marker_info[num] = tracker->marker_info[i];
+        num++;
+    }
+    if( num + lost == 0 ) return -1;
+
+    tracker->marker_num = num;
+    tracker->track_num  = num;
+
+    return lost;
+}
+
+/* the marker moved with its corners; -1 when it is lost */
+static int track_marker( ARParam *cparam, ARUint8 *dataPtr, TrackPatch *patch, ARMarkerInfo *minfo )
+{
+    double       corner[4][2], d[4][2];
+    double       ix, iy, s, area0, area1;
+    int          c;
+
+    if( !patch->valid ) return -1;
+
+    for( c = 0; c < 4; c++ ) {
+        if( track_corner( cparam, dataPtr, patch, c, d[c] ) < 0 ) return -1;
+        corner[c][0] = patch->corner[c][0] + d[c][0];
+        corner[c][1] = patch->corner[c][1] + d[c][1];
+    }
+
+    /* the corners must still make a convex quadrangle of about the same size */
+    area0 = get_area( patch->corner );
+    area1 = get_area( corner );
+    for( c = 0; c < 4; c++ ) {
+        s = (corner[(c+1)%4][0] - corner[c][0]) * (corner[(c+2)%4][1] - corner[(c+1)%4][1])
+          - (corner[(c+1)%4][1] - corner[c][1]) * (corner[(c+2)%4][0] - corner[(c+1)%4][0]);
+        if( s * area0 <= 0.0 ) return -1;
+    }
+    if( area1 / area0 < 0.7 || area1 / area0 > 1.43 ) return -1;
+
+    for( c = 0; c < 4; c++ ) {
+        arParamObserv2Ideal( cparam->dist_factor, corner[c][0], corner[c][1], &ix, &iy );
+        minfo->vertex[c][0] = ix;
+        minfo->vertex[c][1] = iy;
+    }
+    for( c = 0; c < 4; c++ ) {
+        minfo->line[c][0] = minfo->vertex[c][1] - minfo->vertex[(c+1)%4][1];
+        minfo->line[c][1] = minfo->vertex[(c+1)%4][0] - minfo->vertex[c][0];
+        s = sqrt( minfo->line[c][0] * minfo->line[c][0] + minfo->line[c][1] * minfo->line[c][1] );
+        minfo->line[c][0] /= s;
+        minfo->line[c][1] /= s;
+        minfo->line[c][2] = -( minfo->line[c][0] * minfo->vertex[c][0] + minfo->line[c][1] * minfo->vertex[c][1] );
+    }
+    minfo->pos[0] += (d[0][0] + d[1][0] + d[2][0] + d[3][0]) / 4.0;
+    minfo->pos[1] += (d[0][1] + d[1][1] + d[2][1] + d[3][1]) / 4.0;
+    minfo->area = (int)(minfo->area * area1 / area0 + 0.5);
+
+    return 0;
+}
+
+/* the camera of the tracker, that of its handle or of the globals */
+static ARParam *get_param( ARTracker *tracker, ARParam *wparam )
+{
+    if( tracker->handle != NULL ) return &(tracker->handle->param);
+
+    *wparam = arParam;
+    wparam->xsize = arImXsize;
+    wparam->ysize = arImYsize;
+
+    return wparam;
+}
+
+/*
+ *  buf[j*size+i] is the pixel (x0+i, y0+j) of the level, the mean of a
+ *  2^level square of the image; -1 when it leaves the image.
+ */
+static int get_level( ARParam *cparam, ARUint8 *dataPtr, int level, int x0, int y0, int size, float *buf )
+{
+    ARUint8   *p;
+    int       step, x, y, i, j, u, v, sum;
+    float     norm;
+
+    step = 1 << level;
+    if( x0 < 0 || y0 < 0 ) return -1;
+    if( (x0 + size) * step > cparam->xsize || (y0 + size) * step > cparam->ysize ) return -1;
+
+    norm = 1.0f / (float)(step * step);
+    for( j = 0; j < size; j++ ) {
+        y = (y0 + j) * step;
+        for( i = 0; i < size; i++ ) {
+            x = (x0 + i) * step;
+            sum = 0;
+            for( v = 0; v < step; v++ ) {
+                p = &(dataPtr[((y+v)*cparam->xsize + x)*AR_PIX_SIZE_DEFAULT]);
+                for( u = 0; u < step; u++, p += AR_PIX_SIZE_DEFAULT ) sum += GRAY(p);
+            }
+            buf[j*size+i] = sum * norm;
+        }
+    }
+
+    return 0;
+}
+
+/* displacement d of corner c from its patch into the image, in pixels of the image */
+static int track_corner( ARParam *cparam, ARUint8 *dataPtr, TrackPatch *patch, int c, double d[2] )
+{
+    float     search[SEARCH_SIZE*SEARCH_SIZE];
+    float     gx[PATCH_SIZE*PATCH_SIZE], gy[PATCH_SIZE*PATCH_SIZE];
+    float     *t, *s;
+    double    g[2], b[2], a[3], det, dx, dy, px, py, fx, fy, e, res;
+    int       sx, sy, ix, iy, i, j, k, l;
+
+    g[0] = g[1] = 0.0;
+    res = 0.0;
+    for( l = patch->level[c]-1; l >= 0; l-- ) {
+        if( l < patch->level[c]-1 ) {
+            g[0] *= 2.0;
+            g[1] *= 2.0;
+        }
+
+        /* a level whose search window leaves the image is skipped */
+        sx = patch->org[c][l][0] + (int)floor( g[0] + 0.5 ) - AR_TRACK_SEARCH;
+        sy = patch->org[c][l][1] + (int)floor( g[1] + 0.5 ) - AR_TRACK_SEARCH;
+        if( get_level( cparam, dataPtr, l, sx, sy, SEARCH_SIZE, search ) < 0 ) {
+            if( l == 0 ) return -1;
+            continue;
+        }
+        t = patch->image[c][l];
+
+        a[0] = a[1] = a[2] = 0.0;
+        for( j = 1; j < PATCH_SIZE-1; j++ ) {
+            for( i = 1; i < PATCH_SIZE-1; i++ ) {
+                k = j*PATCH_SIZE+i;
+                gx[k] = (t[k+1] - t[k-1]) * 0.5f;
+                gy[k] = (t[k+PATCH_SIZE] - t[k-PATCH_SIZE]) * 0.5f;
+                a[0] += gx[k] * gx[k];
+                a[1] += gx[k] * gy[k];
+                a[2] += gy[k] * gy[k];
+            }
+        }
+        /* a patch without texture in both directions cannot be tracked */
+        e = (a[0] + a[2]) / 2.0 - sqrt( (a[0] - a[2]) * (a[0] - a[2]) / 4.0 + a[1] * a[1] );
+        if( e < AR_TRACK_MIN_EIGEN * (PATCH_SIZE-2) * (PATCH_SIZE-2) ) return -1;
+        det = a[0] * a[2] - a[1] * a[1];
+
+        for( k = 0; k < AR_TRACK_LOOP_COUNT; k++ ) {
+            b[0] = b[1] = 0.0;
+            res = 0.0;
+            for( j = 1; j < PATCH_SIZE-1; j++ ) {
+                py = patch->org[c][l][1] + j + g[1] - sy;
+                iy = (int)floor( py );
+                if( iy < 0 || iy >= SEARCH_SIZE-1 ) return -1;
+                fy = py - iy;
+                for( i = 1; i < PATCH_SIZE-1; i++ ) {
+                    px = patch->org[c][l][0] + i + g[0] - sx;
+                    ix = (int)floor( px );
+                    if( ix < 0 || ix >= SEARCH_SIZE-1 ) return -1;
+                    fx = px - ix;
+                    s = &(search[iy*SEARCH_SIZE+ix]);
+                    e = (1.0-fy) * ((1.0-fx) * s[0] + fx * s[1])
+                      + fy * ((1.0-fx) * s[SEARCH_SIZE] + fx * s[SEARCH_SIZE+1])
+                      - t[j*PATCH_SIZE+i];
+                    b[0] += gx[j*PATCH_SIZE+i] * e;
+                    b[1] += gy[j*PATCH_SIZE+i] * e;
+                    res += fabs( e );
+                }
+            }
+            dx = ( a[2] * b[0] - a[1] * b[1]) / det;
+            dy = (-a[1] * b[0] + a[0] * b[1]) / det;
+            g[0] -= dx;
+            g[1] -= dy;
+            if( dx*dx + dy*dy < 0.01 * 0.01 ) break;
+        }
+    }
+    if( res / ((PATCH_SIZE-2) * (PATCH_SIZE-2)) > AR_TRACK_MAX_RESIDUAL ) return -1;
+
+    d[0] = g[0];
+    d[1] = g[1];
+
+    return 0;
+}
+
+/* signed area of the quadrangle */
+static double get_area( double corner[4][2] )
+{
+    double  area;
+    int     c;
+
+    area = 0.0;
+    for( c = 0; c < 4; c++ ) {
+        area += corner[c][0] * corner[(c+1)%4][1] - corner[(c+1)%4][0] * corner[c][1];
+    }
+
+    return area / 2.0;
+}
@@ -10,6 +10,7 @@
 *******************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #ifdef _WIN32
@@ -31,12 +32,32 @@ ARParam    arParam;
 int        arImXsize, arImYsize;
 int        arTemplateMatchingMode  = DEFAULT_TEMPLATE_MATCHING_MODE;
 int        arMatchingPCAMode       = DEFAULT_MATCHING_PCA_MODE;
+int        arMatchingCascadeMode   = DEFAULT_MATCHING_CASCADE_MODE;
+int        arPattDetectionMode     = DEFAULT_PATT_DETECTION_MODE;
+int        arMatrixCodeType        = DEFAULT_MATRIX_CODE_TYPE;
+int        arPoseRefineMode        = DEFAULT_POSE_REFINE_MODE;
+int        arInitRotMode           = DEFAULT_INIT_ROT_MODE;
+int        arLineFitMode           = DEFAULT_LINE_FIT_MODE;
+int        arDetectInterval        = DEFAULT_DETECT_INTERVAL;
+int        arDetectAsync           = DEFAULT_DETECT_ASYNC;
+ARTransMatSetting arTransMatSetting = { AR_GET_TRANS_MAT_MAX_LOOP_COUNT,
+                                        AR_GET_TRANS_MAT_MAX_FIT_ERROR,
+                                        AR_GET_TRANS_CONT_MAT_MAX_FIT_ERROR,
+                                        AR_GET_TRANS_MAT_MIN_IMPROVEMENT,
+                                        AR_GET_TRANS_MAT_MIN_STEP_ROT,
+                                        AR_GET_TRANS_MAT_MIN_STEP_TRANS,
+                                        AR_GET_TRANS_MAT_LM_LOOP_COUNT,
+                                        AR_GET_TRANS_MAT_MAX_TIME };
 
 ARUint8*   arImageL                = NULL;
 ARUint8*   arImageR                = NULL;
 ARSParam   arsParam;
 double     arsMatR2L[3][4];
 
+/* the handles of the functions without one, set from the globals at each call */
+static ARHandle handleL;
+static ARHandle handleR;
+
 ARUint32 arGetVersion(char **versionStringRef)
 {
 	const char version[] = AR_HEADER_VERSION_STRING;
@@ -60,8 +81,13 @@ ARUint32 arGetVersion(char **versionStringRef)
 			);
 }
 
+/* iterations of the undistortion, as in arParamObserv2Ideal */
+#define  PD_LOOP   3
+
 static int arGetLine2(int x_coord[], int y_coord[], int coord_num,
                       int vertex[], double line[4][3], double v[4][2], double *dist_factor);
+static int fit_line_f( int x_coord[], int y_coord[], int n,
+                       double *dist_factor, double line[3] );
 
 int arInitCparam( ARParam *param )
 {
@@ -83,6 +109,87 @@ int arsInitCparam( ARSParam *sparam )
     return(0);
 }
 
+ARHandle *arCreateHandle( ARParam *param )
+{
+    ARHandle   *handle;
+
+    handle = (ARHandle *)calloc( 1, sizeof(ARHandle) );
+    if( handle == NULL ) return NULL;
+    handle->param                = *param;
+    handle->imageProcMode        = arImageProcMode;
+    handle->templateMatchingMode = arTemplateMatchingMode;
+    handle->debug                = arDebug;
+    handle->tracker = arCreateTracker();
+    if( handle->tracker == NULL ) {
+        free( handle );
+        return NULL;
+    }
+    handle->tracker->handle = handle;
+
+    return handle;
+}
+
+int arDeleteHandle( ARHandle *handle )
+{
+    arFreeTracker( handle->tracker );
+    free( handle->image );
+    free( handle->label_image );
+    free( handle->label_work );
+    free( handle->label_work2 );
+    free( handle->label_area );
+    free( handle->label_clip );
+    free( handle->label_pos );
+    free( handle->chain );
+    free( handle->marker_info2 );
+    free( handle->marker_info );
+    free( handle );
+
+    return 0;
+}
+
+ARHandle *arGetHandle( void )
+{
+    handleL.param                = arParam;
+    handleL.param.xsize          = arImXsize;
+    handleL.param.ysize          = arImYsize;
+    handleL.imageProcMode        = arImageProcMode;
+    handleL.templateMatchingMode = arTemplateMatchingMode;
+    handleL.debug                = arDebug;
+    handleL.image                = arImageL;
+
+    return &handleL;
+}
+
+ARHandle *arsGetHandle( int LorR )
+{
+    ARHandle   *handle;
+    int        i, j;
+
+    handle = (LorR)? &handleL: &handleR;
+    handle->param.xsize = arImXsize;
+    handle->param.ysize = arImYsize;
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 4; i++ ) {
+            handle->param.mat[j][i] = (LorR)? arsParam.matL[j][i]: arsParam.matR[j][i];
+        }
+    }
+    for( i = 0; i < 4; i++ ) {
+        handle->param.dist_factor[i] = (LorR)? arsParam.dist_factorL[i]: arsParam.dist_factorR[i];
+    }
+    handle->imageProcMode        = arImageProcMode;
+    handle->templateMatchingMode = arTemplateMatchingMode;
+    handle->debug                = arDebug;
+    handle->image                = (LorR)? arImageL: arImageR;
+
+    return handle;
+}
+
+int arHandleGetLine( ARHandle *handle, int x_coord[], int y_coord[], int coord_num,
+                     int vertex[], double line[4][3], double v[4][2] )
+{
+    return arGetLine2( x_coord, y_coord, coord_num, vertex, line, v, handle->param.dist_factor );
+}
+
 int arGetLine(int x_coord[], int y_coord[], int coord_num,
               int vertex[], double line[4][3], double v[4][2])
 {
@@ -107,34 +214,45 @@ static int arGetLine2(int x_coord[], int y_coord[], int coord_num,
     int      st, ed, n;
     int      i, j;
 
-    ev     = arVecAlloc( 2 );
-    mean   = arVecAlloc( 2 );
-    evec   = arMatrixAlloc( 2, 2 );
-    for( i = 0; i < 4; i++ ) {
-        w1 = (double)(vertex[i+1]-vertex[i]+1) * 0.05 + 0.5;
-        st = (int)(vertex[i]   + w1);
-        ed = (int)(vertex[i+1] - w1);
-        n = ed - st + 1;
-        input  = arMatrixAlloc( n, 2 );
-        for( j = 0; j < n; j++ ) {
-            arParamObserv2Ideal( dist_factor, x_coord[st+j], y_coord[st+j],
-                                 &(input->m[j*2+0]), &(input->m[j*2+1]) );
+    if( arLineFitMode == AR_LINE_FIT_FLOAT ) {
+        for( i = 0; i < 4; i++ ) {
+            w1 = (double)(vertex[i+1]-vertex[i]+1) * 0.05 + 0.5;
+            st = (int)(vertex[i]   + w1);
+            ed = (int)(vertex[i+1] - w1);
+            if( fit_line_f( &x_coord[st], &y_coord[st], ed - st + 1,
+                            dist_factor, line[i] ) < 0 ) return(-1);
         }
-        if( arMatrixPCA(input, evec, ev, mean) < 0 ) {
+    }
+    else {
+        ev     = arVecAlloc( 2 );
+        mean   = arVecAlloc( 2 );
+        evec   = arMatrixAlloc( 2, 2 );
+        for( i = 0; i < 4; i++ ) {
+            w1 = (double)(vertex[i+1]-vertex[i]+1) * 0.05 + 0.5;
+            st = (int)(vertex[i]   + w1);
+            ed = (int)(vertex[i+1] - w1);
+            n = ed - st + 1;
+            input  = arMatrixAlloc( n, 2 );
+            for( j = 0; j < n; j++ ) {
+                arParamObserv2Ideal( dist_factor, x_coord[st+j], y_coord[st+j],
+                                     &(input->m[j*2+0]), &(input->m[j*2+1]) );
+            }
+            if( arMatrixPCA(input, evec, ev, mean) < 0 ) {
+                arMatrixFree( input );
+                arMatrixFree( evec );
+                arVecFree( mean );
+                arVecFree( ev );
+                return(-1);
+            }
+            line[i][0] =  evec->m[1];
+            line[i][1] = -evec->m[0];
+            line[i][2] = -(line[i][0]*mean->v[0] + line[i][1]*mean->v[1]);
             arMatrixFree( input );
-            arMatrixFree( evec );
-            arVecFree( mean );
-            arVecFree( ev );
-            return(-1);
         }
-        line[i][0] =  evec->m[1];
-        line[i][1] = -evec->m[0];
-        line[i][2] = -(line[i][0]*mean->v[0] + line[i][1]*mean->v[1]);
-        arMatrixFree( input );
+        arMatrixFree( evec );
+        arVecFree( mean );
+        arVecFree( ev );
     }
-    arMatrixFree( evec );
-    arVecFree( mean );
-    arVecFree( ev );
 
     for( i = 0; i < 4; i++ ) {
         w1 = line[(i+3)%4][0] * line[i][1] - line[i][0] * line[(i+3)%4][1];
@@ -148,6 +266,77 @@ static int arGetLine2(int x_coord[], int y_coord[], int coord_num,
     return(0);
 }
 
+/*
+ *  Single precision edge fit: the points are undistorted as
+ *  arParamObserv2Ideal does, with a fixed number of steps, and the line
+ *  is the principal axis of their scatter, found in closed form. The
+ *  sums are taken relative to the first point to keep their precision.
+ */
+static int fit_line_f( int x_coord[], int y_coord[], int n,
+                       double *dist_factor, double line[3] )
+{
+    float    cx, cy, p, s;
+    float    px, py, z02, z0, z, q;
+    float    x0, y0, x, y;
+    float    sx, sy, sxx, sxy, syy;
+    double   th, mx, my;
+    int      i, k;
+
+    if( n < 2 ) return(-1);
+
+    cx = (float)dist_factor[0];
+    cy = (float)dist_factor[1];
+    p  = (float)(dist_factor[2] / 100000000.0);
+    s  = (float)dist_factor[3];
+
+    x0 = y0 = 0.0f;
+    sx = sy = sxx = sxy = syy = 0.0f;
+    for( i = 0; i < n; i++ ) {
+        px = (float)x_coord[i] - cx;
+        py = (float)y_coord[i] - cy;
+        z02 = px*px + py*py;
+        q = z0 = (float)sqrt( z02 );
+        if( z0 != 0.0f ) {
+            for( k = 1; ; k++ ) {
+                z = z0 - ((1.0f - p*z02)*z0 - q) / (1.0f - 3.0f*p*z02);
+                px = px * z / z0;
+                py = py * z / z0;
+                if( k == PD_LOOP ) break;
+                z02 = px*px + py*py;
+                z0 = (float)sqrt( z02 );
+            }
+        }
+        x = px / s;
+        y = py / s;
+        if( i == 0 ) {
+            x0 = x;
+            y0 = y;
+        }
+        x -= x0;
+        y -= y0;
+        sx  += x;
+        sy  += y;
+        sxx += x*x;
+        sxy += x*y;
+        syy += y*y;
+    }
+    sx  /= n;
+    sy  /= n;
+    sxx = sxx / n - sx*sx;
+    sxy = sxy / n - sx*sy;
+    syy = syy / n - sy*sy;
+    if( sxx + syy <= 0.0f ) return(-1);
+
+    th = 0.5 * atan2( 2.0*sxy, (double)(sxx - syy) );
+    line[0] =  sin( th );
+    line[1] = -cos( th );
+    mx = (double)x0 + sx + dist_factor[0];
+    my = (double)y0 + sy + dist_factor[1];
+    line[2] = -(line[0]*mx + line[1]*my);
+
+    return(0);
+}
+
 int arUtilMatMul( double s1[3][4], double s2[3][4], double d[3][4] )
 {
     int     i, j;
@@ -245,6 +434,37 @@ int arUtilQuatPos2Mat( double q[4], double p[3], double m[3][4] )
     return 0;
 }
 
+int arUtilSquareToQuad( double vertex[4][2], double para[3][3] )
+{
+    double    sx, sy, dx1, dx2, dy1, dy2;
+    double    g, h, d;
+
+    sx = vertex[0][0] - vertex[1][0] + vertex[2][0] - vertex[3][0];
+    sy = vertex[0][1] - vertex[1][1] + vertex[2][1] - vertex[3][1];
+    dx1 = vertex[1][0] - vertex[2][0];
+    dx2 = vertex[3][0] - vertex[2][0];
+    dy1 = vertex[1][1] - vertex[2][1];
+    dy2 = vertex[3][1] - vertex[2][1];
+    d = dx1 * dy2 - dx2 * dy1;
+    if( d == 0.0 ) return -1;
+
+    /* zero for a parallelogram, the transformation is then affine */
+    g = (sx * dy2 - dx2 * sy) / d;
+    h = (dx1 * sy - sx * dy1) / d;
+
+    para[0][0] = vertex[1][0] - vertex[0][0] + g * vertex[1][0];
+    para[0][1] = vertex[3][0] - vertex[0][0] + h * vertex[3][0];
+    para[0][2] = vertex[0][0];
+    para[1][0] = vertex[1][1] - vertex[0][1] + g * vertex[1][1];
+    para[1][1] = vertex[3][1] - vertex[0][1] + h * vertex[3][1];
+    para[1][2] = vertex[0][1];
+    para[2][0] = g;
+    para[2][1] = h;
+    para[2][2] = 1.0;
+
+    return 0;
+}
+
 
 static int      ss, sms;
 
@@ -277,6 +497,25 @@ double arUtilTimer(void)
     return( tt );
 }
 
+double arUtilGetTime(void)
+{
+#ifdef _WIN32
+    struct _timeb sys_time;
+
+    _ftime(&sys_time);
+    return (double)sys_time.time + (double)sys_time.millitm / 1000.0;
+#else
+    struct timeval     time;
+
+#if defined(__linux) || defined(__APPLE__)
+    gettimeofday( &time, NULL );
+#else
+    gettimeofday( &time );
+#endif
+    return (double)time.tv_sec + (double)time.tv_usec / 1000000.0;
+#endif
+}
+
 void arUtilTimerReset(void)
 {
 #ifdef _WIN32
@@ -303,8 +542,8 @@ void arUtilSleep( int msec )
 #ifndef _WIN32
     struct timespec  req;
 
-    req.tv_sec = 0;
-    req.tv_nsec = msec* 1000;
+    req.tv_sec = msec / 1000;
+    req.tv_nsec = (msec % 1000) * 1000000;
     nanosleep( &req, NULL );
 #else
 	Sleep(msec);
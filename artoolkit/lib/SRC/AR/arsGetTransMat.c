@@ -0,0 +1,479 @@
+/*******************************************************
+ *
+ *  Pose of a marker seen by a stereo pair.
+ *
+ *  The pose is solved in the left camera coordinates over the corners
+ *  found in both images at once: the right camera is at arsParam.matL2R
+ *  from the left one, so its projection in left camera coordinates is
+ *  matR * matL2R. transR follows from transL by the same transform.
+ *  Either marker may be NULL when it was found in one image only.
+ *
+*******************************************************/
+
+#include <stdlib.h>
+#include <math.h>
+#include <AR/ar.h>
+
+/* points handled with scratch on the stack, more are allocated */
+#define WORK_NUM    64
+
+static double arsGetTransMatSub( double rot[3][3], double cparaR[3][4],
+                                 double pos3dL[][3], double pos2dL[][2], int numL,
+                                 double pos3dR[][3], double pos2dR[][2], int numR,
+                                 double conv[3][4] );
+static int    get_init_rot( ARMarkerInfo *marker_info, double cpara[3][4],
+                            double r2l[3][4], double rot[][3][3] );
+static double get_init_err( double rot[3][3], double cparaR[3][4],
+                            double ppos2dL[][2], double ppos3dL[][3], int numL,
+                            double ppos2dR[][2], double ppos3dR[][3], int numR );
+static int    get_trans( double rot[3][3], double cparaR[3][4],
+                         double pos3dL[][3], double pos2dL[][2], int numL,
+                         double pos3dR[][3], double pos2dR[][2], int numR,
+                         double trans[3] );
+static void   add_trans( double rot[3][3], double cpara[3][4],
+                         double pos3d[][3], double pos2d[][2], int num,
+                         double a[3][3], double b[3] );
+static double get_err( double rot[3][3], double trans[3], double cpara[3][4],
+                       double pos3d[][3], double pos2d[][2], int num );
+static void   get_square( ARMarkerInfo *marker_info, double center[2], double width,
+                          double ppos2d[4][2], double ppos3d[4][3] );
+static void   get_fit_pos( double ppos2d[][2], int num, double *dist_factor,
+                           double pos2d[][2] );
+
+double arsGetTransMat( ARMarkerInfo *marker_infoL, ARMarkerInfo *marker_infoR,
+                       double center[2], double width,
+                       double transL[3][4], double transR[3][4] )
+{
+    double  rot[4][3][3], cparaR[3][4];
+    double  ppos2dL[4][2], ppos3dL[4][3];
+    double  ppos2dR[4][2], ppos3dR[4][3];
+    double  err, minerr;
+    int     numL, numR, rnum, k;
+
+    numL = numR = 0;
+    rnum = 0;
+    if( marker_infoL != NULL ) {
+        get_square( marker_infoL, center, width, ppos2dL, ppos3dL );
+        numL = 4;
+        rnum += get_init_rot( marker_infoL, arsParam.matL, NULL, &rot[rnum] );
+    }
+    if( marker_infoR != NULL ) {
+        get_square( marker_infoR, center, width, ppos2dR, ppos3dR );
+        numR = 4;
+        rnum += get_init_rot( marker_infoR, arsParam.matR, arsMatR2L, &rot[rnum] );
+    }
+    if( rnum == 0 ) return -1;
+
+    /* the views see different sides of the ambiguity, settled by both at once */
+    arUtilMatMul( arsParam.matR, arsParam.matL2R, cparaR );
+    k = 0;
+    minerr = -1.0;
+    for( rnum--; rnum >= 0; rnum-- ) {
+        err = get_init_err( rot[rnum], cparaR, ppos2dL, ppos3dL, numL,
+                                               ppos2dR, ppos3dR, numR );
+        if( err >= 0.0 && (minerr < 0.0 || err < minerr) ) {
+            minerr = err;
+            k = rnum;
+        }
+    }
+
+    return arsGetTransMat2( rot[k], ppos2dL, ppos3dL, numL,
+                                    ppos2dR, ppos3dR, numR, transL, transR );
+}
+
+double arsGetTransMatCont( ARMarkerInfo *marker_infoL, ARMarkerInfo *marker_infoR,
+                           double prev_conv[3][4],
+                           double center[2], double width,
+                           double transL[3][4], double transR[3][4] )
+{
+    double  rot[3][3];
+    double  ppos2dL[4][2], ppos3dL[4][3];
+    double  ppos2dR[4][2], ppos3dR[4][3];
+    double  wtransL[3][4], wtransR[3][4];
+    double  err1, err2, start;
+    int     numL, numR;
+    int     i, j;
+
+    start = (arTransMatSetting.time_max > 0.0)? arUtilGetTime(): 0.0;
+
+    numL = numR = 0;
+    if( marker_infoL != NULL ) {
+        get_square( marker_infoL, center, width, ppos2dL, ppos3dL );
+        numL = 4;
+    }
+    if( marker_infoR != NULL ) {
+        get_square( marker_infoR, center, width, ppos2dR, ppos3dR );
+        numR = 4;
+    }
+    if( numL + numR == 0 ) return -1;
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) rot[j][i] = prev_conv[j][i];
+    }
+    err1 = arsGetTransMat2( rot, ppos2dL, ppos3dL, numL,
+                                 ppos2dR, ppos3dR, numR, transL, transR );
+    if( arTransMatSetting.time_max > 0.0
+     && (arUtilGetTime() - start) * 1000000.0 >= arTransMatSetting.time_max ) return err1;
+    if( err1 < 0.0 || err1 > arTransMatSetting.cont_fit_error ) {
+        err2 = arsGetTransMat( marker_infoL, marker_infoR, center, width, wtransL, wtransR );
+        if( err2 >= 0.0 && (err1 < 0.0 || err2 < err1) ) {
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 4; i++ ) {
+                    transL[j][i] = wtransL[j][i];
+                    transR[j][i] = wtransR[j][i];
+                }
+            }
+            err1 = err2;
+        }
+    }
+
+    return err1;
+}
+
+/*
+ *  Refinement from the rotation rot, as arGetTransMatIter does for one
+ *  camera: rounds of translation and pose refinement under
+ *  arTransMatSetting. ppos2dL and ppos2dR are ideal screen coordinates.
+ */
+double arsGetTransMat2( double rot[3][3],
+                        double ppos2dL[][2], double ppos3dL[][3], int numL,
+                        double ppos2dR[][2], double ppos3dR[][3], int numR,
+                        double transL[3][4], double transR[3][4] )
+{
+    ARTransMatSetting  *set = &arTransMatSetting;
+    double  wwork[WORK_NUM*5];
+    double  *work;
+    double  (*pos2dL)[2], (*pos3dL)[3];
+    double  (*pos2dR)[2], (*pos3dR)[3];
+    double  cparaR[3][4], conv[3][4], prev[3][4];
+    double  off[3], pmax[3], pmin[3];
+    double  start, err, prev_err, c, d;
+    int     num, i, j, loop;
+
+    num = numL + numR;
+    if( num < 3 ) return -1;
+    if( num > WORK_NUM ) {
+        arMalloc( work, double, num*5 );
+    }
+    else {
+        work = wwork;
+    }
+    pos3dL = (double (*)[3])work;
+    pos3dR = (double (*)[3])(work + numL*3);
+    pos2dL = (double (*)[2])(work + num*3);
+    pos2dR = (double (*)[2])(work + num*3 + numL*2);
+
+    pmax[0]=pmax[1]=pmax[2] = -10000000000.0;
+    pmin[0]=pmin[1]=pmin[2] =  10000000000.0;
+    for( i = 0; i < num; i++ ) {
+        for( j = 0; j < 3; j++ ) {
+            d = (i < numL)? ppos3dL[i][j]: ppos3dR[i-numL][j];
+            if( d > pmax[j] ) pmax[j] = d;
+            if( d < pmin[j] ) pmin[j] = d;
+        }
+    }
+    for( j = 0; j < 3; j++ ) off[j] = -(pmax[j] + pmin[j]) / 2.0;
+    for( i = 0; i < numL; i++ ) {
+        for( j = 0; j < 3; j++ ) pos3dL[i][j] = ppos3dL[i][j] + off[j];
+    }
+    for( i = 0; i < numR; i++ ) {
+        for( j = 0; j < 3; j++ ) pos3dR[i][j] = ppos3dR[i][j] + off[j];
+    }
+    get_fit_pos( ppos2dL, numL, arsParam.dist_factorL, pos2dL );
+    get_fit_pos( ppos2dR, numR, arsParam.dist_factorR, pos2dR );
+    arUtilMatMul( arsParam.matR, arsParam.matL2R, cparaR );
+
+    start = (set->time_max > 0.0)? arUtilGetTime(): 0.0;
+    prev_err = -1.0;
+    for( loop = 0;; loop++ ) {
+        err = arsGetTransMatSub( rot, cparaR, pos3dL, pos2dL, numL,
+                                 pos3dR, pos2dR, numR, conv );
+        if( err < 0.0 ) {
+            if( prev_err < 0.0 ) break;
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 4; i++ ) conv[j][i] = prev[j][i];
+            }
+            err = prev_err;
+            break;
+        }
+        if( err < set->fit_error ) break;
+
+        if( prev_err >= 0.0 ) {
+            if( err > prev_err ) {
+                for( j = 0; j < 3; j++ ) {
+                    for( i = 0; i < 4; i++ ) conv[j][i] = prev[j][i];
+                }
+                err = prev_err;
+                break;
+            }
+            if( prev_err - err < prev_err * set->min_improvement ) break;
+
+            c = 0.0;
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 3; i++ ) c += prev[j][i] * conv[j][i];
+            }
+            c = (c - 1.0) / 2.0;
+            d = (prev[0][3]-conv[0][3]) * (prev[0][3]-conv[0][3])
+              + (prev[1][3]-conv[1][3]) * (prev[1][3]-conv[1][3])
+              + (prev[2][3]-conv[2][3]) * (prev[2][3]-conv[2][3]);
+            if( c >= cos(set->min_step_rot)
+             && d <= set->min_step_trans * set->min_step_trans ) break;
+        }
+
+        if( loop+1 >= set->loop_max ) break;
+        if( set->time_max > 0.0
+         && (arUtilGetTime() - start) * 1000000.0 >= set->time_max ) break;
+
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 4; i++ ) prev[j][i] = conv[j][i];
+        }
+        prev_err = err;
+    }
+
+    if( num > WORK_NUM ) free( work );
+    if( err < 0.0 ) return -1;
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) transL[j][i] = conv[j][i];
+        transL[j][3] = conv[j][0]*off[0] + conv[j][1]*off[1] + conv[j][2]*off[2] + conv[j][3];
+    }
+    arUtilMatMul( arsParam.matL2R, transL, transR );
+
+    return err;
+}
+
+static double arsGetTransMatSub( double rot[3][3], double cparaR[3][4],
+                                 double pos3dL[][3], double pos2dL[][2], int numL,
+                                 double pos3dR[][3], double pos2dR[][2], int numR,
+                                 double conv[3][4] )
+{
+    double  trans[3];
+    double  ret;
+    int     i, j;
+
+    if( get_trans( rot, cparaR, pos3dL, pos2dL, numL,
+                   pos3dR, pos2dR, numR, trans ) < 0 ) return -1;
+
+    if( arPoseRefineMode == AR_POSE_REFINE_LM ) {
+        ret = arsModifyMatrixLM( rot, trans, &arsParam, pos3dL, pos2dL, numL,
+                                                        pos3dR, pos2dR, numR );
+    }
+    else {
+        ret = arsModifyMatrix( rot, trans, &arsParam, pos3dL, pos2dL, numL,
+                                                      pos3dR, pos2dR, numR );
+        if( get_trans( rot, cparaR, pos3dL, pos2dL, numL,
+                       pos3dR, pos2dR, numR, trans ) < 0 ) return -1;
+        ret = arsModifyMatrix( rot, trans, &arsParam, pos3dL, pos2dL, numL,
+                                                      pos3dR, pos2dR, numR );
+    }
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) conv[j][i] = rot[j][i];
+        conv[j][3] = trans[j];
+    }
+
+    return ret;
+}
+
+/* initial rotations from one view, turned into left camera coordinates by r2l */
+static int get_init_rot( ARMarkerInfo *marker_info, double cpara[3][4],
+                         double r2l[3][4], double rot[][3][3] )
+{
+    double  wrot[3][3];
+    int     num, k, i, j;
+
+    if( arInitRotMode == AR_INIT_ROT_IPPE ) {
+        if( arGetInitRotIPPE( marker_info, cpara, rot[0], rot[1] ) < 0 ) return 0;
+        num = 2;
+    }
+    else {
+        if( arGetInitRot( marker_info, cpara, rot[0] ) < 0 ) return 0;
+        num = 1;
+    }
+    if( r2l == NULL ) return num;
+
+    for( k = 0; k < num; k++ ) {
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) wrot[j][i] = rot[k][j][i];
+        }
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) {
+                rot[k][j][i] = r2l[j][0] * wrot[0][i]
+                             + r2l[j][1] * wrot[1][i]
+                             + r2l[j][2] * wrot[2][i];
+            }
+        }
+    }
+
+    return num;
+}
+
+static double get_init_err( double rot[3][3], double cparaR[3][4],
+                            double ppos2dL[][2], double ppos3dL[][3], int numL,
+                            double ppos2dR[][2], double ppos3dR[][3], int numR )
+{
+    double  pos2dL[4][2], pos2dR[4][2];
+    double  trans[3];
+    double  errL, errR;
+
+    get_fit_pos( ppos2dL, numL, arsParam.dist_factorL, pos2dL );
+    get_fit_pos( ppos2dR, numR, arsParam.dist_factorR, pos2dR );
+    if( get_trans( rot, cparaR, ppos3dL, pos2dL, numL,
+                   ppos3dR, pos2dR, numR, trans ) < 0 ) return -1;
+
+    errL = get_err( rot, trans, arsParam.matL, ppos3dL, pos2dL, numL );
+    errR = get_err( rot, trans, cparaR, ppos3dR, pos2dR, numR );
+    if( errL < 0.0 || errR < 0.0 ) return -1;
+
+    return (errL + errR) / (numL + numR);
+}
+
+/*
+ *  Least squares translation for a fixed rotation over both views,
+ *  solved from the 3x3 normal equations by Cholesky.
+ */
+static int get_trans( double rot[3][3], double cparaR[3][4],
+                      double pos3dL[][3], double pos2dL[][2], int numL,
+                      double pos3dR[][3], double pos2dR[][2], int numR,
+                      double trans[3] )
+{
+    double  a[3][3], b[3], l[3][3];
+    double  w;
+    int     i, j, k;
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) a[j][i] = 0.0;
+        b[j] = 0.0;
+    }
+    add_trans( rot, arsParam.matL, pos3dL, pos2dL, numL, a, b );
+    add_trans( rot, cparaR, pos3dR, pos2dR, numR, a, b );
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i <= j; i++ ) {
+            w = a[j][i];
+            for( k = 0; k < i; k++ ) w -= l[j][k] * l[i][k];
+            if( i == j ) {
+                if( w <= 0.0 ) return -1;
+                l[j][j] = sqrt( w );
+            }
+            else {
+                l[j][i] = w / l[i][i];
+            }
+        }
+    }
+    for( j = 0; j < 3; j++ ) {
+        w = b[j];
+        for( k = 0; k < j; k++ ) w -= l[j][k] * trans[k];
+        trans[j] = w / l[j][j];
+    }
+    for( j = 2; j >= 0; j-- ) {
+        w = trans[j];
+        for( k = j+1; k < 3; k++ ) w -= l[k][j] * trans[k];
+        trans[j] = w / l[j][j];
+    }
+
+    return 0;
+}
+
+/*
+ *  Each point gives two equations linear in trans: with q = rot * X,
+ *  (cpara[0] - x cpara[2]) . trans = x (cpara[2] . q) - cpara[0] . q
+ *  and the same for y, cpara being a full 3x4 projection here.
+ */
+static void add_trans( double rot[3][3], double cpara[3][4],
+                       double pos3d[][3], double pos2d[][2], int num,
+                       double a[3][3], double b[3] )
+{
+    double  q[3], r0[3], r1[3], c0, c1;
+    double  hx, hy, h;
+    int     i, j, k;
+
+    for( k = 0; k < num; k++ ) {
+        for( j = 0; j < 3; j++ ) {
+            q[j] = rot[j][0] * pos3d[k][0]
+                 + rot[j][1] * pos3d[k][1]
+                 + rot[j][2] * pos3d[k][2];
+        }
+        hx = cpara[0][0]*q[0] + cpara[0][1]*q[1] + cpara[0][2]*q[2] + cpara[0][3];
+        hy = cpara[1][0]*q[0] + cpara[1][1]*q[1] + cpara[1][2]*q[2] + cpara[1][3];
+        h  = cpara[2][0]*q[0] + cpara[2][1]*q[1] + cpara[2][2]*q[2] + cpara[2][3];
+        for( j = 0; j < 3; j++ ) {
+            r0[j] = cpara[0][j] - pos2d[k][0] * cpara[2][j];
+            r1[j] = cpara[1][j] - pos2d[k][1] * cpara[2][j];
+        }
+        c0 = pos2d[k][0] * h - hx;
+        c1 = pos2d[k][1] * h - hy;
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i <= j; i++ ) a[j][i] += r0[j]*r0[i] + r1[j]*r1[i];
+            b[j] += r0[j]*c0 + r1[j]*c1;
+        }
+    }
+}
+
+/* sum of the squared reprojection errors, -1 for a point behind the camera */
+static double get_err( double rot[3][3], double trans[3], double cpara[3][4],
+                       double pos3d[][3], double pos2d[][2], int num )
+{
+    double  q[3], h, x, y, err;
+    int     i, j;
+
+    err = 0.0;
+    for( i = 0; i < num; i++ ) {
+        for( j = 0; j < 3; j++ ) {
+            q[j] = rot[j][0] * pos3d[i][0]
+                 + rot[j][1] * pos3d[i][1]
+                 + rot[j][2] * pos3d[i][2]
+                 + trans[j];
+        }
+        h = cpara[2][0]*q[0] + cpara[2][1]*q[1] + cpara[2][2]*q[2] + cpara[2][3];
+        if( h <= 0.0 ) return -1;
+        x = (cpara[0][0]*q[0] + cpara[0][1]*q[1] + cpara[0][2]*q[2] + cpara[0][3]) / h;
+        y = (cpara[1][0]*q[0] + cpara[1][1]*q[1] + cpara[1][2]*q[2] + cpara[1][3]) / h;
+        err += (pos2d[i][0] - x) * (pos2d[i][0] - x)
+             + (pos2d[i][1] - y) * (pos2d[i][1] - y);
+    }
+
+    return err;
+}
+
+/* corners in the order of the marker direction and their position on the marker */
+static void get_square( ARMarkerInfo *marker_info, double center[2], double width,
+                        double ppos2d[4][2], double ppos3d[4][3] )
+{
+    int     dir, i;
+
+    dir = marker_info->dir;
+    for( i = 0; i < 4; i++ ) {
+        ppos2d[i][0] = marker_info->vertex[(4+i-dir)%4][0];
+        ppos2d[i][1] = marker_info->vertex[(4+i-dir)%4][1];
+        ppos3d[i][2] = 0.0;
+    }
+    ppos3d[0][0] = center[0] - width/2.0;
+    ppos3d[0][1] = center[1] + width/2.0;
+    ppos3d[1][0] = center[0] + width/2.0;
+    ppos3d[1][1] = center[1] + width/2.0;
+    ppos3d[2][0] = center[0] + width/2.0;
+    ppos3d[2][1] = center[1] - width/2.0;
+    ppos3d[3][0] = center[0] - width/2.0;
+    ppos3d[3][1] = center[1] - width/2.0;
+}
+
+/* image positions in the coordinates the pose is fitted in */
+static void get_fit_pos( double ppos2d[][2], int num, double *dist_factor,
+                         double pos2d[][2] )
+{
+    int     i;
+
+    if( arFittingMode == AR_FITTING_TO_INPUT ) {
+        for( i = 0; i < num; i++ ) {
+            arParamIdeal2Observ(dist_factor, ppos2d[i][0], ppos2d[i][1],
+                                             &pos2d[i][0], &pos2d[i][1]);
+        }
+    }
+    else {
+        for( i = 0; i < num; i++ ) {
+            pos2d[i][0] = ppos2d[i][0];
+            pos2d[i][1] = ppos2d[i][1];
+        }
+    }
+}
@@ -115,6 +115,10 @@ SOURCE=.\arGetTransMat3.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\arGetTransMatBatch.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\arGetTransMatCont.c
 # End Source File
 # Begin Source File
@@ -123,6 +127,30 @@ SOURCE=.\arLabeling.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\arMatrixCode.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\arMotion.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\arsGetTransMat.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\arTrackMarker.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\arPipeline.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\arRunJob.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\arUtil.c
 # End Source File
 # Begin Source File
@@ -35,7 +35,7 @@ int arMultiDeactivate(ARMultiMarkerInfoT *config)
     config->prevF = 0;
 
     for(i = 0; i < config->marker_num; i++) {
-        if (arDeactivatePatt(config->marker[i].patt_id)) return (-1);
+        if (arDeactivatePatt(config->marker[i].patt_id) != 1) return (-1);
     }
 
     return 0;
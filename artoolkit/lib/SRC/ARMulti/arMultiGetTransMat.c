@@ -23,6 +23,14 @@
 #define  AR_MULTI_GET_TRANS_MAT_MAX_LOOP_COUNT   2
 #define  AR_MULTI_GET_TRANS_MAT_MAX_FIT_ERROR    10.0
 
+/* inlier threshold of a member (mean squared corner error, pixel^2) and
+   the confidence of having drawn an inlier hypothesis */
+#define  AR_MULTI_RANSAC_THRESH     64.0
+#define  AR_MULTI_RANSAC_CONF       0.99
+
+/* members handled with scratch on the stack, more are allocated */
+#define  WORK_MARKER_NUM     32
+
 typedef struct {
     double   pos[4][2];
     double   thresh;
@@ -31,26 +39,88 @@ typedef struct {
     int      dir;
 } arMultiEachMarkerInternalInfoT;
 
-static int verify_markers(ARMarkerInfo *marker_info, int marker_num,
-                          ARMultiMarkerInfoT *config);
+/*
+ *  Scratch, per member of the configuration (AR_MULTI_WORK_SIZE):
+ *  the pose of the member (12), its order for hypotheses (1), its
+ *  reassociation info (WINFO_SIZE) and the points of the joint fit
+ *  (8 + 12 + 20).
+ */
+#define  WINFO_SIZE          12
+
+static double get_trans_mat(ARMarkerInfo *marker_info, ARMultiMarkerInfoT *config,
+                            double *work);
+static void   get_index(ARMarkerInfo *marker_info, int marker_num,
+                        double cx[], double cy[], int id[]);
+static int    verify_markers(ARMarkerInfo *marker_info, int marker_num,
+                             ARMultiMarkerInfoT *config,
+                             arMultiEachMarkerInternalInfoT *winfo,
+                             double cx[], double cy[], int id[]);
+/* the patterns of arMultiGetTransMatAll, shared out by arRunJob */
+typedef struct {
+    ARMarkerInfo       *marker_info;
+    ARMultiRegistryT   *registry;
+} MultiJob;
+
+static void   get_pattern_trans_mat(void *context, int c);
+
+static double get_member_err(ARMarkerInfo *marker_info, ARMultiEachMarkerInfoT *marker,
+                             double trans[3][4]);
+static double get_cost(ARMarkerInfo *marker_info, ARMultiMarkerInfoT *config,
+                       double trans[3][4], int *inum);
 
 
 double arMultiGetTransMat(ARMarkerInfo *marker_info, int marker_num,
                           ARMultiMarkerInfoT *config)
 {
-    double                *pos2d, *pos3d;
-    double                rot[3][3], trans1[3][4], trans2[3][4];
-    double                err, err2;
-    int                   max, max_area, max_marker, vnum;
-    int                   dir;
+    double                wwork[AR_MULTI_WORK_SIZE(WORK_MARKER_NUM)];
+    double                *work;
+    double                ret;
+
+    if( config->marker_num > WORK_MARKER_NUM ) {
+        arMalloc(work, double, AR_MULTI_WORK_SIZE(config->marker_num));
+    }
+    else {
+        work = wwork;
+    }
+
+    ret = arMultiGetTransMatWork( marker_info, marker_num, config, work );
+
+    if( config->marker_num > WORK_MARKER_NUM ) free(work);
+
+    return ret;
+}
+
+double arMultiGetTransMatWork(ARMarkerInfo *marker_info, int marker_num,
+                              ARMultiMarkerInfoT *config, double *work)
+{
+    double                wcx[AR_SQUARE_MAX], wcy[AR_SQUARE_MAX];
+    int                   wid[AR_SQUARE_MAX];
+    double                *cx, *cy;
+    int                   *id;
     int                   i, j, k;
 
     if( config->prevF ) {
-        verify_markers( marker_info, marker_num, config );
+        if( marker_num > AR_SQUARE_MAX ) {
+            arMalloc(cx, double, marker_num);
+            arMalloc(cy, double, marker_num);
+            arMalloc(id, int, marker_num);
+        }
+        else {
+            cx = wcx;
+            cy = wcy;
+            id = wid;
+        }
+        get_index( marker_info, marker_num, cx, cy, id );
+        verify_markers( marker_info, marker_num, config,
+                        (arMultiEachMarkerInternalInfoT *)(work + config->marker_num*13),
+                        cx, cy, id );
+        if( marker_num > AR_SQUARE_MAX ) {
+            free(id);
+            free(cy);
+            free(cx);
+        }
     }
 
-    max = -1;
-    vnum = 0;
     for( i = 0; i < config->marker_num; i++ ) {
         k = -1;
         for( j = 0; j < marker_num; j++ ) {
@@ -60,108 +130,250 @@ double arMultiGetTransMat(ARMarkerInfo *marker_info, int marker_num,
             if( k == -1 ) k = j;
             else if( marker_info[k].cf < marker_info[j].cf ) k = j;
         }
-        if( (config->marker[i].visible=k) == -1) continue;
+        config->marker[i].visible = k;
+    }
+
+    return get_trans_mat( marker_info, config, work );
+}
+
+int arMultiGetTransMatAll(ARMarkerInfo *marker_info, int marker_num,
+                          ARMultiRegistryT *registry)
+{
+    ARMultiMarkerInfoT    *config;
+    ARMultiEachMarkerInfoT *member;
+    double                wcx[AR_SQUARE_MAX], wcy[AR_SQUARE_MAX];
+    int                   wid[AR_SQUARE_MAX];
+    double                *cx, *cy;
+    int                   *id;
+    MultiJob              job;
+    int                   found, c, e, i, j, k;
+
+    if( marker_num > AR_SQUARE_MAX ) {
+        arMalloc(cx, double, marker_num);
+        arMalloc(cy, double, marker_num);
+        arMalloc(id, int, marker_num);
+    }
+    else {
+        cx = wcx;
+        cy = wcy;
+        id = wid;
+    }
+    get_index( marker_info, marker_num, cx, cy, id );
+    for( c = 0; c < registry->config_num; c++ ) {
+        config = registry->config[c];
+        if( config->prevF == 0 ) continue;
+        verify_markers( marker_info, marker_num, config,
+                        (arMultiEachMarkerInternalInfoT *)(registry->work[c] + config->marker_num*13),
+                        cx, cy, id );
+    }
+    if( marker_num > AR_SQUARE_MAX ) {
+        free(id);
+        free(cy);
+        free(cx);
+    }
+
+    for( c = 0; c < registry->config_num; c++ ) {
+        config = registry->config[c];
+        for( i = 0; i < config->marker_num; i++ ) config->marker[i].visible = -1;
+    }
+    for( j = 0; j < marker_num; j++ ) {
+        if( marker_info[j].id < 0 || marker_info[j].cf < 0.70 ) continue;
+        for( e = registry->hash[marker_info[j].id & (AR_MULTI_HASH_SIZE-1)]; e >= 0;
+             e = registry->entry[e][3] ) {
+            if( registry->entry[e][0] != marker_info[j].id ) continue;
+            member = &(registry->config[registry->entry[e][1]]->marker[registry->entry[e][2]]);
+            k = member->visible;
+            if( k == -1 || marker_info[k].cf < marker_info[j].cf ) member->visible = j;
+        }
+    }
+
+    job.marker_info = marker_info;
+    job.registry    = registry;
+    arRunJob( get_pattern_trans_mat, &job, registry->config_num );
+
+    found = 0;
+    for( c = 0; c < registry->config_num; c++ ) {
+        if( registry->err[c] >= 0.0 ) found++;
+    }
+
+    return found;
+}
+
+static void get_pattern_trans_mat(void *context, int c)
+{
+    MultiJob   *job = (MultiJob *)context;
+
+    job->registry->err[c] = get_trans_mat( job->marker_info, job->registry->config[c],
+                                           job->registry->work[c] );
+}
+
+/*
+ *  The members are gated by the error of their initial pose, which bounds
+ *  that of arGetTransMat from above: only those above THRESH_1 get the
+ *  full pose to decide. Each gated member then gives a hypothesis of the
+ *  pose of the whole pattern, tried from the largest one down after the
+ *  previous pose (PROSAC order) until one with enough inliers is found
+ *  with AR_MULTI_RANSAC_CONF confidence. The best is refined over its
+ *  inliers only, which are checked once more after the fit.
+ */
+static double get_trans_mat(ARMarkerInfo *marker_info, ARMultiMarkerInfoT *config,
+                            double *work)
+{
+    double                (*mtrans)[3][4], *order;
+    double                *pos2d, *pos3d;
+    double                rot[3][3], trans[3][4], best[3][4];
+    double                err, cost, mincost, area, w;
+    int                   vnum, inum, hnum, hmax, round;
+    int                   dir;
+    int                   i, j, k;
+
+    mtrans = (double (*)[3][4])work;
+    order  = work + config->marker_num*12;
+    pos2d  = work + config->marker_num*(13+WINFO_SIZE);
+    pos3d  = pos2d + config->marker_num*8;
+
+    /* members sharing a pattern cannot also share its detection */
+    for( i = 1; i < config->marker_num; i++ ) {
+        if( (k=config->marker[i].visible) == -1 ) continue;
+        for( j = 0; j < i; j++ ) {
+            if( config->marker[j].visible == k ) {
+                config->marker[i].visible = -1;
+                break;
+            }
+        }
+    }
+
+    vnum = 0;
+    for( i = 0; i < config->marker_num; i++ ) {
+        if( (k=config->marker[i].visible) == -1) continue;
 
-        err = arGetTransMat(&marker_info[k], config->marker[i].center,
-                            config->marker[i].width, trans1);
+        err = arGetTransMatInit(&marker_info[k], config->marker[i].center,
+                                config->marker[i].width, mtrans[i]);
+        if( err < 0.0 || err > THRESH_1 ) {
+            err = arGetTransMat(&marker_info[k], config->marker[i].center,
+                                config->marker[i].width, mtrans[i]);
+        }
 #if debug
 printf("##err = %10.5f %d %10.5f %10.5f\n", err, marker_info[k].dir, marker_info[k].pos[0], marker_info[k].pos[1]);
 #endif
-        if( err > THRESH_1 ) {
+        if( err < 0.0 || err > THRESH_1 ) {
             config->marker[i].visible = -1;
             continue;
         }
-
+        order[i] = marker_info[k].area;
         vnum++;
-        if( max == -1 
-         || marker_info[k].area > max_area ) {
-            max = i;
-            max_marker = k;
-            max_area   = marker_info[k].area;
-            for( j = 0; j < 3; j++ ) {
-                for( k = 0; k < 4; k++ ) {
-                    trans2[j][k] = trans1[j][k];
-                }
-            }
-        }
     }
-    if( max == -1 ) {
+    if( vnum == 0 ) {
         config->prevF = 0;
         return -1;
     }
 
-    arMalloc(pos2d, double, vnum*4*2);
-    arMalloc(pos3d, double, vnum*4*3);
+    /* hypotheses: the previous pose, then one per member */
+    mincost = -1.0;
+    hmax = vnum;
+    for( hnum = (config->prevF)? -1: 0; hnum < hmax; hnum++ ) {
+        if( hnum < 0 ) {
+            for( j = 0; j < 3; j++ ) {
+                for( i = 0; i < 4; i++ ) trans[j][i] = config->trans[j][i];
+            }
+        }
+        else {
+            k = -1;
+            area = -1.0;
+            for( i = 0; i < config->marker_num; i++ ) {
+                if( config->marker[i].visible < 0 || order[i] < 0.0 ) continue;
+                if( order[i] > area ) {
+                    area = order[i];
+                    k = i;
+                }
+            }
+            if( k < 0 ) break;
+            order[k] = -1.0;
+            arUtilMatMul( mtrans[k], config->marker[k].itrans, trans );
+        }
 
-    j = 0;
-    for( i = 0; i < config->marker_num; i++ ) {
-        if( (k=config->marker[i].visible) < 0 ) continue;
-
-        dir = marker_info[k].dir;
-        pos2d[j*8+0] = marker_info[k].vertex[(4-dir)%4][0];
-        pos2d[j*8+1] = marker_info[k].vertex[(4-dir)%4][1];
-        pos2d[j*8+2] = marker_info[k].vertex[(5-dir)%4][0];
-        pos2d[j*8+3] = marker_info[k].vertex[(5-dir)%4][1];
-        pos2d[j*8+4] = marker_info[k].vertex[(6-dir)%4][0];
-        pos2d[j*8+5] = marker_info[k].vertex[(6-dir)%4][1];
-        pos2d[j*8+6] = marker_info[k].vertex[(7-dir)%4][0];
-        pos2d[j*8+7] = marker_info[k].vertex[(7-dir)%4][1];
-        pos3d[j*12+0] = config->marker[i].pos3d[0][0];
-        pos3d[j*12+1] = config->marker[i].pos3d[0][1];
-        pos3d[j*12+2] = config->marker[i].pos3d[0][2];
-        pos3d[j*12+3] = config->marker[i].pos3d[1][0];
-        pos3d[j*12+4] = config->marker[i].pos3d[1][1];
-        pos3d[j*12+5] = config->marker[i].pos3d[1][2];
-        pos3d[j*12+6] = config->marker[i].pos3d[2][0];
-        pos3d[j*12+7] = config->marker[i].pos3d[2][1];
-        pos3d[j*12+8] = config->marker[i].pos3d[2][2];
-        pos3d[j*12+9] = config->marker[i].pos3d[3][0];
-        pos3d[j*12+10] = config->marker[i].pos3d[3][1];
-        pos3d[j*12+11] = config->marker[i].pos3d[3][2];
-        j++;
+        cost = get_cost( marker_info, config, trans, &inum );
+        if( mincost >= 0.0 && cost >= mincost ) continue;
+        mincost = cost;
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 4; i++ ) best[j][i] = trans[j][i];
+        }
+
+        /* hypotheses needed to draw an inlier one with AR_MULTI_RANSAC_CONF */
+        w = (double)inum / vnum;
+        if( w >= 1.0 ) hmax = hnum + 1;
+        else if( w > 0.0 ) {
+            k = (int)ceil( log(1.0 - AR_MULTI_RANSAC_CONF) / log(1.0 - w) );
+            if( k < hmax ) hmax = k;
+        }
     }
 
-    if( config->prevF ) {
+    for( round = 0; round < 2; round++ ) {
+        j = 0;
+        inum = 0;
+        for( i = 0; i < config->marker_num; i++ ) {
+            if( (k=config->marker[i].visible) < 0 ) continue;
+            w = (get_member_err( &marker_info[k], &config->marker[i], best )
+                 <= AR_MULTI_RANSAC_THRESH)? 1.0: 0.0;
+            if( round > 0 && w != order[i] ) inum = 1;
+            order[i] = w;
+            if( w == 0.0 ) continue;
+
+            dir = marker_info[k].dir;
+            pos2d[j*8+0] = marker_info[k].vertex[(4-dir)%4][0];
+            pos2d[j*8+1] = marker_info[k].vertex[(4-dir)%4][1];
+            pos2d[j*8+2] = marker_info[k].vertex[(5-dir)%4][0];
+            pos2d[j*8+3] = marker_info[k].vertex[(5-dir)%4][1];
+            pos2d[j*8+4] = marker_info[k].vertex[(6-dir)%4][0];
+            pos2d[j*8+5] = marker_info[k].vertex[(6-dir)%4][1];
+            pos2d[j*8+6] = marker_info[k].vertex[(7-dir)%4][0];
+            pos2d[j*8+7] = marker_info[k].vertex[(7-dir)%4][1];
+            pos3d[j*12+0] = config->marker[i].pos3d[0][0];
+            pos3d[j*12+1] = config->marker[i].pos3d[0][1];
+            pos3d[j*12+2] = config->marker[i].pos3d[0][2];
+            pos3d[j*12+3] = config->marker[i].pos3d[1][0];
+            pos3d[j*12+4] = config->marker[i].pos3d[1][1];
+            pos3d[j*12+5] = config->marker[i].pos3d[1][2];
+            pos3d[j*12+6] = config->marker[i].pos3d[2][0];
+            pos3d[j*12+7] = config->marker[i].pos3d[2][1];
+            pos3d[j*12+8] = config->marker[i].pos3d[2][2];
+            pos3d[j*12+9] = config->marker[i].pos3d[3][0];
+            pos3d[j*12+10] = config->marker[i].pos3d[3][1];
+            pos3d[j*12+11] = config->marker[i].pos3d[3][2];
+            j++;
+        }
+        if( j == 0 ) {
+            config->prevF = 0;
+            return -1;
+        }
+        /* refitted only when the inliers of the refined pose differ */
+        if( round > 0 && inum == 0 ) break;
+        inum = j;
+
         for( j = 0; j < 3; j++ ) {
-            for( i = 0; i < 3; i++ ) {
-                rot[j][i] = config->trans[j][i];
-            }
+            for( i = 0; i < 3; i++ ) rot[j][i] = best[j][i];
         }
         for( i = 0; i < AR_MULTI_GET_TRANS_MAT_MAX_LOOP_COUNT; i++ ) {
-            err = arGetTransMat4( rot, (double (*)[2])pos2d,
-                                       (double (*)[3])pos3d,
-                                        vnum*4, config->trans );
+            err = arGetTransMatWork( rot, (double (*)[2])pos2d, (double (*)[3])pos3d,
+                                     inum*4, best,
+                                     arParam.dist_factor, arParam.mat, pos3d + inum*12 );
             if( err < AR_MULTI_GET_TRANS_MAT_MAX_FIT_ERROR ) break;
         }
-
-        if( err < THRESH_2 ) {
-            config->prevF = 1;
-            free(pos3d);
-            free(pos2d);
-            return err;
+        if( err < 0.0 ) {
+            config->prevF = 0;
+            return -1;
         }
     }
 
-    arUtilMatMul( trans2, config->marker[max].itrans, trans1 );
-    for( j = 0; j < 3; j++ ) {
-        for( i = 0; i < 3; i++ ) {
-            rot[j][i] = trans1[j][i];
+    for( i = 0; i < config->marker_num; i++ ) {
+        if( config->marker[i].visible < 0 ) continue;
+        if( get_member_err( &marker_info[config->marker[i].visible],
+                            &config->marker[i], best ) > AR_MULTI_RANSAC_THRESH ) {
+            config->marker[i].visible = -1;
         }
     }
-
-    for( i = 0; i < AR_MULTI_GET_TRANS_MAT_MAX_LOOP_COUNT; i++ ) {
-        err2 = arGetTransMat4( rot, (double (*)[2])pos2d, (double (*)[3])pos3d,
-                              vnum*4, trans2 );
-        if( err2 < AR_MULTI_GET_TRANS_MAT_MAX_FIT_ERROR ) break;
-    }
-
-    if( config->prevF == 0 || err2 < err ) {
-        for( j = 0; j < 3; j++ ) {
-            for( i = 0; i < 4; i++ ) {
-                config->trans[j][i] = trans2[j][i];
-            }
-        }
-        err = err2;
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 4; i++ ) config->trans[j][i] = best[j][i];
     }
 
     if( err < THRESH_3 ) {
@@ -171,15 +383,110 @@ printf("##err = %10.5f %d %10.5f %10.5f\n", err, marker_info[k].dir, marker_info
         config->prevF = 0;
     }
 
-    free(pos3d);
-    free(pos2d);
     return err;
 }
 
+/* MSAC cost of a pose of the pattern over the visible members, and its inliers */
+static double get_cost(ARMarkerInfo *marker_info, ARMultiMarkerInfoT *config,
+                       double trans[3][4], int *inum)
+{
+    double    err, cost;
+    int       i;
+
+    cost = 0.0;
+    *inum = 0;
+    for( i = 0; i < config->marker_num; i++ ) {
+        if( config->marker[i].visible < 0 ) continue;
+        err = get_member_err( &marker_info[config->marker[i].visible],
+                              &config->marker[i], trans );
+        if( err < AR_MULTI_RANSAC_THRESH ) {
+            cost += err;
+            (*inum)++;
+        }
+        else {
+            cost += AR_MULTI_RANSAC_THRESH;
+        }
+    }
+
+    return cost;
+}
+
+/* mean squared error of the corners of a member projected with the pose of the pattern */
+static double get_member_err(ARMarkerInfo *marker_info, ARMultiEachMarkerInfoT *marker,
+                             double trans[3][4])
+{
+    double    combo[3][4];
+    double    hx, hy, h, x, y, err;
+    int       dir, i, j;
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 4; i++ ) {
+            combo[j][i] = arParam.mat[j][0] * trans[0][i]
+                        + arParam.mat[j][1] * trans[1][i]
+                        + arParam.mat[j][2] * trans[2][i];
+        }
+        combo[j][3] += arParam.mat[j][3];
+    }
+
+    dir = marker_info->dir;
+    err = 0.0;
+    for( i = 0; i < 4; i++ ) {
+        hx = combo[0][0] * marker->pos3d[i][0]
+           + combo[0][1] * marker->pos3d[i][1]
+           + combo[0][2] * marker->pos3d[i][2]
+           + combo[0][3];
+        hy = combo[1][0] * marker->pos3d[i][0]
+           + combo[1][1] * marker->pos3d[i][1]
+           + combo[1][2] * marker->pos3d[i][2]
+           + combo[1][3];
+        h  = combo[2][0] * marker->pos3d[i][0]
+           + combo[2][1] * marker->pos3d[i][1]
+           + combo[2][2] * marker->pos3d[i][2]
+           + combo[2][3];
+        if( h <= 0.0 ) return AR_MULTI_RANSAC_THRESH * 2.0;
+        x = hx / h - marker_info->vertex[(4+i-dir)%4][0];
+        y = hy / h - marker_info->vertex[(4+i-dir)%4][1];
+        err += x*x + y*y;
+    }
+
+    return err / 4.0;
+}
+
+/* detected markers sorted by the x of their center, for verify_markers */
+static void get_index(ARMarkerInfo *marker_info, int marker_num,
+                      double cx[], double cy[], int id[])
+{
+    double    px, py;
+    int       j, l;
+
+    for( j = 0; j < marker_num; j++ ) {
+        px = (marker_info[j].vertex[0][0] + marker_info[j].vertex[1][0]
+            + marker_info[j].vertex[2][0] + marker_info[j].vertex[3][0]) / 4.0;
+        py = (marker_info[j].vertex[0][1] + marker_info[j].vertex[1][1]
+            + marker_info[j].vertex[2][1] + marker_info[j].vertex[3][1]) / 4.0;
+        for( l = j; l > 0 && cx[l-1] > px; l-- ) {
+            cx[l] = cx[l-1];
+            cy[l] = cy[l-1];
+            id[l] = id[l-1];
+        }
+        cx[l] = px;
+        cy[l] = py;
+        id[l] = j;
+    }
+}
+
+/*
+ *  A detected marker can only match a member whose predicted center is
+ *  within sqrt(err/4) of its own, err being the sum of the squared corner
+ *  distances, so only those are taken from the index.
+ */
 static int verify_markers(ARMarkerInfo *marker_info, int marker_num,
-                          ARMultiMarkerInfoT *config)
+                          ARMultiMarkerInfoT *config,
+                          arMultiEachMarkerInternalInfoT *winfo,
+                          double cx[], double cy[], int id[])
 {
-    arMultiEachMarkerInternalInfoT *winfo;
+    double                         px, py, r, d;
+    int                            l, m, n;
     double                         wtrans[3][4];
     double                         pos3d[4][2];
     double                         wx, wy, wz, hx, hy, h;
@@ -189,8 +496,6 @@ static int verify_markers(ARMarkerInfo *marker_info, int marker_num,
     int                            w1, w2;
     int                            i, j, k;
 
-    arMalloc(winfo,arMultiEachMarkerInternalInfoT,config->marker_num);
-
     for( i = 0; i < config->marker_num; i++ ) {
         arUtilMatMul(config->trans, config->marker[i].trans, wtrans);
         pos3d[0][0] = config->marker[i].center[0] - config->marker[i].width/2.0;
@@ -261,7 +566,24 @@ printf("\n");
     for( i = 0; i < config->marker_num; i++ ) {
         marker2 = -1;
         err2 = winfo[i].thresh;
-        for( j = 0; j < marker_num; j++ ) {
+        if( err2 <= 0.0 ) {
+            winfo[i].marker = -1;
+            continue;
+        }
+        px = (winfo[i].pos[0][0] + winfo[i].pos[1][0] + winfo[i].pos[2][0] + winfo[i].pos[3][0]) / 4.0;
+        py = (winfo[i].pos[0][1] + winfo[i].pos[1][1] + winfo[i].pos[2][1] + winfo[i].pos[3][1]) / 4.0;
+        r = sqrt( err2 / 4.0 );
+        l = 0;
+        n = marker_num;
+        while( l < n ) {
+            m = (l + n) / 2;
+            if( cx[m] < px - r ) l = m + 1;
+            else                 n = m;
+        }
+        for( m = l; m < marker_num && cx[m] <= px + r; m++ ) {
+            d = (cx[m] - px) * (cx[m] - px) + (cy[m] - py) * (cy[m] - py);
+            if( d * 4.0 > err2 ) continue;
+            j = id[m];
             if( marker_info[j].id != -1
              && marker_info[j].id != config->marker[i].patt_id
              && marker_info[j].cf > 0.7 ) continue;
@@ -292,7 +614,7 @@ printf("\n");
 #if debug
 printf("%f\n", err1);
 #endif
-            if( err1 < err2 ) {
+            if( err1 < err2 || (err1 == err2 && marker2 != -1 && j < marker2) ) {
                 err2 = err1;
                 dir2 = dir1;
                 marker2 = j;
@@ -317,10 +639,7 @@ printf("%3d<=>%3d, err = %f(%f)\n", i+1, marker2+1, err2, winfo[i].thresh);
 #if debug
 printf("w1,w2 = %d,%d\n", w1, w2);
 #endif
-    if( w2 >= w1 ) {
-        free(winfo);
-        return -1;
-    }
+    if( w2 >= w1 ) return -1;
 
     for( i = 0; i < config->marker_num; i++ ) {
         for( j = 0; j < marker_num; j++ ) {
@@ -333,7 +652,5 @@ printf("w1,w2 = %d,%d\n", w1, w2);
         }
     }
 
-    free(winfo);
-
     return 0;
 }
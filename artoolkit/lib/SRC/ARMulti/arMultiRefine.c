@@ -0,0 +1,693 @@
+/*******************************************************
+ *
+ *  Refinement of the member transforms of a multi-marker pattern from
+ *  the frames it is tracked in (bundle adjustment).
+ *
+ *  The frames are kept with the ideal corners of their inlier members.
+ *  Every refinement is a Levenberg-Marquardt over the pose of each frame
+ *  and the transform of each member but the most seen one, which fixes
+ *  the coordinates of the pattern. A corner depends on one frame and one
+ *  member only, so the frames are eliminated frame by frame (Schur
+ *  complement) and the system left is that of the members.
+ *
+*******************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <AR/ar.h>
+#include <AR/param.h>
+#include <AR/arMulti.h>
+#if AR_POSE_THREAD_MAX > 0
+#include <pthread.h>
+#endif
+
+#define MD_PI                          3.14159265358979323846
+#define LM_LAMBDA                      0.001
+
+/* iterations of one refinement */
+#define AR_MULTI_REFINE_LOOP_COUNT     20
+/* a frame is kept when the pattern moved this much since the last one
+   (degrees, and fraction of its distance) */
+#define AR_MULTI_REFINE_MIN_ANGLE      2.0
+#define AR_MULTI_REFINE_MIN_MOVE       0.02
+
+typedef double  Trans[3][4];
+
+struct _ARMultiRefineT {
+    ARMultiMarkerInfoT  *config;
+    int                 frame_max;
+    /* frames of arMultiRefineAddFrame, oldest replaced first */
+    Trans               *frame;
+    double              *obs;
+    char                *seen;
+    int                 frame_num;
+    int                 frame_next;
+    int                 frame_new;
+    /* copy the refinement works on */
+    Trans               *wframe;
+    double              *wobs;
+    char                *wseen;
+    int                 wframe_num;
+    Trans               *mtrans;
+    double              err;
+    /* scratch of the refinement */
+    Trans               *tframe;
+    Trans               *tmtrans;
+    double              *u, *bf, *w, *v, *bm, *s, *bs;
+    int                 *pidx;
+    int                 busy;
+    int                 ready;
+#if AR_POSE_THREAD_MAX > 0
+    int                 quit;
+    int                 thread_f;
+    pthread_t           thread;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+#endif
+};
+
+static double bundle_adjust( ARMultiRefineT *refine );
+static double get_err( ARMultiRefineT *refine, double (*frame)[3][4], double (*mtrans)[3][4] );
+static void   get_corner( ARMultiEachMarkerInfoT *marker, double pos[4][3] );
+static void   set_member( ARMultiEachMarkerInfoT *marker, double trans[3][4] );
+static void   update_rot( double rot[3][4], double d[3], double wrot[3][4] );
+static int    chol_decomp( double *a, int n );
+static void   chol_solve( double *l, int n, double *b );
+#if AR_POSE_THREAD_MAX > 0
+static void   *worker( void *arg );
+#endif
+
+
+ARMultiRefineT *arMultiCreateRefine( ARMultiMarkerInfoT *config, int frame_max )
+{
+    ARMultiRefineT  *refine;
+    int             n, f;
+
+    if( frame_max < 2 ) return NULL;
+    n = config->marker_num;
+    f = frame_max;
+
+    arMalloc( refine, ARMultiRefineT, 1 );
+    refine->config     = config;
+    refine->frame_max  = f;
+    refine->frame_num  = 0;
+    refine->frame_next = 0;
+    refine->frame_new  = 0;
+    refine->wframe_num = 0;
+    refine->err        = -1.0;
+    refine->busy       = 0;
+    refine->ready      = 0;
+    arMalloc( refine->frame,   Trans,  f );
+    arMalloc( refine->obs,     double, f*n*8 );
+    arMalloc( refine->seen,    char,   f*n );
+    arMalloc( refine->wframe,  Trans,  f );
+    arMalloc( refine->wobs,    double, f*n*8 );
+    arMalloc( refine->wseen,   char,   f*n );
+    arMalloc( refine->mtrans,  Trans,  n );
+    arMalloc( refine->tframe,  Trans,  f );
+    arMalloc( refine->tmtrans, Trans,  n );
+    arMalloc( refine->u,       double, f*36 );
+    arMalloc( refine->bf,      double, f*6 );
+    arMalloc( refine->w,       double, f*n*36 );
+    arMalloc( refine->v,       double, n*36 );
+    arMalloc( refine->bm,      double, n*6 );
+    arMalloc( refine->s,       double, n*n*36 );
+    arMalloc( refine->bs,      double, n*6 );
+    arMalloc( refine->pidx,    int,    n );
+
+#if AR_POSE_THREAD_MAX > 0
+    refine->quit = 0;
+    pthread_mutex_init( &refine->mutex, NULL );
+    pthread_cond_init( &refine->cond, NULL );
+    refine->thread_f = (pthread_create( &refine->thread, NULL, worker, refine ) == 0);
+#endif
+
+    return refine;
+}
+
+int arMultiRefineAddFrame( ARMultiRefineT *refine, ARMarkerInfo *marker_info )
+{
+    ARMultiMarkerInfoT  *config;
+    double              *obs, *last;
+    double              d, t;
+    int                 num, f, i, j, k, dir;
+
+    config = refine->config;
+    if( config->prevF == 0 ) return 0;
+
+    num = 0;
+    for( i = 0; i < config->marker_num; i++ ) {
+        if( config->marker[i].visible >= 0 ) num++;
+    }
+    if( num < 2 ) return 0;
+
+    /* only the first of a run of frames from about the same view */
+    if( refine->frame_num > 0 ) {
+        f = (refine->frame_next + refine->frame_max - 1) % refine->frame_max;
+        last = &refine->frame[f][0][0];
+        d = 0.0;
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) d += config->trans[j][i] * last[j*4+i];
+        }
+        d = (d - 1.0) / 2.0;
+        if( d > 1.0 ) d = 1.0;
+        d = acos( d ) * 180.0 / MD_PI;
+        t = 0.0;
+        for( j = 0; j < 3; j++ ) {
+            t += (config->trans[j][3] - last[j*4+3]) * (config->trans[j][3] - last[j*4+3]);
+        }
+        if( d < AR_MULTI_REFINE_MIN_ANGLE
+         && sqrt(t) < AR_MULTI_REFINE_MIN_MOVE * fabs(config->trans[2][3]) ) return 0;
+    }
+
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_lock( &refine->mutex );
+#endif
+    f = refine->frame_next;
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 4; i++ ) refine->frame[f][j][i] = config->trans[j][i];
+    }
+    for( i = 0; i < config->marker_num; i++ ) {
+        k = config->marker[i].visible;
+        refine->seen[f*config->marker_num+i] = (k >= 0);
+        if( k < 0 ) continue;
+        obs = &refine->obs[(f*config->marker_num+i)*8];
+        dir = marker_info[k].dir;
+        /* the vertices are in ideal coordinates already */
+        for( j = 0; j < 4; j++ ) {
+            obs[j*2+0] = marker_info[k].vertex[(4+j-dir)%4][0];
+            obs[j*2+1] = marker_info[k].vertex[(4+j-dir)%4][1];
+        }
+    }
+    refine->frame_next = (f + 1) % refine->frame_max;
+    if( refine->frame_num < refine->frame_max ) refine->frame_num++;
+    refine->frame_new++;
+
+    /* a new refinement once a quarter of the frames are new */
+    if( !refine->busy && !refine->ready && refine->frame_num >= 2
+     && refine->frame_new * 4 >= refine->frame_max ) {
+        memcpy( refine->wframe, refine->frame, refine->frame_num*12*sizeof(double) );
+        memcpy( refine->wobs, refine->obs, refine->frame_num*config->marker_num*8*sizeof(double) );
+        memcpy( refine->wseen, refine->seen, refine->frame_num*config->marker_num );
+        refine->wframe_num = refine->frame_num;
+        for( i = 0; i < config->marker_num; i++ ) {
+            for( j = 0; j < 3; j++ ) {
+                for( k = 0; k < 4; k++ ) refine->mtrans[i][j][k] = config->marker[i].trans[j][k];
+            }
+        }
+        refine->frame_new = 0;
+        refine->busy = 1;
+#if AR_POSE_THREAD_MAX > 0
+        if( refine->thread_f ) pthread_cond_signal( &refine->cond );
+#endif
+    }
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_unlock( &refine->mutex );
+#endif
+
+    return 1;
+}
+
+int arMultiRefineUpdate( ARMultiRefineT *refine, double *err )
+{
+    ARMultiMarkerInfoT  *config;
+    int                 i;
+
+    config = refine->config;
+
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_lock( &refine->mutex );
+    if( !refine->thread_f && refine->busy ) {
+#else
+    if( refine->busy ) {
+#endif
+        refine->err = bundle_adjust( refine );
+        refine->busy = 0;
+        refine->ready = (refine->err >= 0.0);
+    }
+    if( !refine->ready ) {
+#if AR_POSE_THREAD_MAX > 0
+        pthread_mutex_unlock( &refine->mutex );
+#endif
+        return 0;
+    }
+
+    for( i = 0; i < config->marker_num; i++ ) {
+        set_member( &config->marker[i], refine->mtrans[i] );
+    }
+    if( err != NULL ) *err = refine->err;
+    refine->ready = 0;
+#if AR_POSE_THREAD_MAX > 0
+    pthread_mutex_unlock( &refine->mutex );
+#endif
+
+    return 1;
+}
+
+int arMultiFreeRefine( ARMultiRefineT *refine )
+{
+#if AR_POSE_THREAD_MAX > 0
+    if( refine->thread_f ) {
+        pthread_mutex_lock( &refine->mutex );
+        refine->quit = 1;
+        pthread_cond_signal( &refine->cond );
+        pthread_mutex_unlock( &refine->mutex );
+        pthread_join( refine->thread, NULL );
+    }
+    pthread_cond_destroy( &refine->cond );
+    pthread_mutex_destroy( &refine->mutex );
+#endif
+
+    free( refine->pidx );
+    free( refine->bs );
+    free( refine->s );
+    free( refine->bm );
+    free( refine->v );
+    free( refine->w );
+    free( refine->bf );
+    free( refine->u );
+    free( refine->tmtrans );
+    free( refine->tframe );
+    free( refine->mtrans );
+    free( refine->wseen );
+    free( refine->wobs );
+    free( refine->wframe );
+    free( refine->seen );
+    free( refine->obs );
+    free( refine->frame );
+    free( refine );
+
+    return 0;
+}
+
+#if AR_POSE_THREAD_MAX > 0
+static void *worker( void *arg )
+{
+    ARMultiRefineT  *refine;
+    double          err;
+
+    refine = (ARMultiRefineT *)arg;
+    pthread_mutex_lock( &refine->mutex );
+    for(;;) {
+        while( !refine->busy && !refine->quit ) pthread_cond_wait( &refine->cond, &refine->mutex );
+        if( refine->quit ) break;
+        pthread_mutex_unlock( &refine->mutex );
+
+        err = bundle_adjust( refine );
+
+        pthread_mutex_lock( &refine->mutex );
+        refine->err = err;
+        refine->busy = 0;
+        refine->ready = (err >= 0.0);
+    }
+    pthread_mutex_unlock( &refine->mutex );
+
+    return NULL;
+}
+#endif
+
+/*
+ *  A corner p of member m seen in frame f is at q = Rm p + tm on the
+ *  pattern and at X' = Rf q + tf in the camera. With the updates
+ *  R <- exp([w]x) R and g the derivative of the projection by X', its
+ *  derivatives are (Rf q) x g and g for the frame, and
+ *  (Rm p) x (Rf^T g) and Rf^T g for the member.
+ */
+static double bundle_adjust( ARMultiRefineT *refine )
+{
+    ARMultiMarkerInfoT  *config;
+    double              (*cpara)[4];
+    double              pos[4][3], qm[3], xb[3], qf[3], gx[3], gy[3], rgx[3], rgy[3];
+    double              jfx[6], jfy[6], jmx[6], jmy[6];
+    double              ufi[36], uw[36], y[6], *u, *w, *wn;
+    double              hx, hy, h, x, yy, ex, ey;
+    double              err, err2, lambda;
+    int                 n, fnum, pnum, gauge, cnt, maxcnt;
+    int                 loop, f, m, mm, c, i, j, k, l;
+
+    config = refine->config;
+    cpara  = arParam.mat;
+    n      = config->marker_num;
+    fnum   = refine->wframe_num;
+
+    /* the most seen member stays, the others never seen are left out */
+    gauge = -1;
+    maxcnt = 0;
+    for( m = 0; m < n; m++ ) {
+        cnt = 0;
+        for( f = 0; f < fnum; f++ ) cnt += refine->wseen[f*n+m];
+        refine->pidx[m] = (cnt > 0)? 0: -1;
+        if( cnt > maxcnt ) {
+            maxcnt = cnt;
+            gauge = m;
+        }
+    }
+    if( gauge < 0 ) return -1.0;
+    refine->pidx[gauge] = -1;
+    pnum = 0;
+    for( m = 0; m < n; m++ ) {
+        if( refine->pidx[m] == 0 ) refine->pidx[m] = pnum++;
+    }
+    if( pnum == 0 ) return -1.0;
+
+    err = get_err( refine, refine->wframe, refine->mtrans );
+    lambda = LM_LAMBDA;
+    for( loop = 0; loop < AR_MULTI_REFINE_LOOP_COUNT && err > 0.0; loop++ ) {
+        /* normal equations: U per frame, V per member, W per frame and member */
+        memset( refine->u,  0, fnum*36*sizeof(double) );
+        memset( refine->bf, 0, fnum*6*sizeof(double) );
+        memset( refine->w,  0, fnum*n*36*sizeof(double) );
+        memset( refine->v,  0, n*36*sizeof(double) );
+        memset( refine->bm, 0, n*6*sizeof(double) );
+        for( f = 0; f < fnum; f++ ) {
+            for( m = 0; m < n; m++ ) {
+                if( !refine->wseen[f*n+m] ) continue;
+                get_corner( &config->marker[m], pos );
+                for( c = 0; c < 4; c++ ) {
+                    for( j = 0; j < 3; j++ ) {
+                        qm[j] = refine->mtrans[m][j][0] * pos[c][0]
+                              + refine->mtrans[m][j][1] * pos[c][1]
+                              + refine->mtrans[m][j][2] * pos[c][2];
+                        xb[j] = qm[j] + refine->mtrans[m][j][3];
+                    }
+                    for( j = 0; j < 3; j++ ) {
+                        qf[j] = refine->wframe[f][j][0] * xb[0]
+                              + refine->wframe[f][j][1] * xb[1]
+                              + refine->wframe[f][j][2] * xb[2];
+                    }
+                    hx = hy = h = 0.0;
+                    for( j = 0; j < 3; j++ ) {
+                        hx += cpara[0][j] * (qf[j] + refine->wframe[f][j][3]);
+                        hy += cpara[1][j] * (qf[j] + refine->wframe[f][j][3]);
+                        h  += cpara[2][j] * (qf[j] + refine->wframe[f][j][3]);
+                    }
+                    hx += cpara[0][3];
+                    hy += cpara[1][3];
+                    h  += cpara[2][3];
+                    if( h <= 0.0 ) continue;
+                    x  = hx / h;
+                    yy = hy / h;
+                    ex = refine->wobs[((f*n+m)*4+c)*2+0] - x;
+                    ey = refine->wobs[((f*n+m)*4+c)*2+1] - yy;
+                    for( j = 0; j < 3; j++ ) {
+                        gx[j] = (cpara[0][j] - x  * cpara[2][j]) / h;
+                        gy[j] = (cpara[1][j] - yy * cpara[2][j]) / h;
+                    }
+                    jfx[0] = qf[1]*gx[2] - qf[2]*gx[1];
+                    jfx[1] = qf[2]*gx[0] - qf[0]*gx[2];
+                    jfx[2] = qf[0]*gx[1] - qf[1]*gx[0];
+                    jfy[0] = qf[1]*gy[2] - qf[2]*gy[1];
+                    jfy[1] = qf[2]*gy[0] - qf[0]*gy[2];
+                    jfy[2] = qf[0]*gy[1] - qf[1]*gy[0];
+                    for( j = 0; j < 3; j++ ) {
+                        jfx[j+3] = gx[j];
+                        jfy[j+3] = gy[j];
+                    }
+                    u = &refine->u[f*36];
+                    for( j = 0; j < 6; j++ ) {
+                        for( i = 0; i < 6; i++ ) u[j*6+i] += jfx[j]*jfx[i] + jfy[j]*jfy[i];
+                        refine->bf[f*6+j] += jfx[j]*ex + jfy[j]*ey;
+                    }
+                    if( refine->pidx[m] < 0 ) continue;
+
+                    for( j = 0; j < 3; j++ ) {
+                        rgx[j] = refine->wframe[f][0][j] * gx[0]
+                               + refine->wframe[f][1][j] * gx[1]
+                               + refine->wframe[f][2][j] * gx[2];
+                        rgy[j] = refine->wframe[f][0][j] * gy[0]
+                               + refine->wframe[f][1][j] * gy[1]
+                               + refine->wframe[f][2][j] * gy[2];
+                    }
+                    jmx[0] = qm[1]*rgx[2] - qm[2]*rgx[1];
+                    jmx[1] = qm[2]*rgx[0] - qm[0]*rgx[2];
+                    jmx[2] = qm[0]*rgx[1] - qm[1]*rgx[0];
+                    jmy[0] = qm[1]*rgy[2] - qm[2]*rgy[1];
+                    jmy[1] = qm[2]*rgy[0] - qm[0]*rgy[2];
+                    jmy[2] = qm[0]*rgy[1] - qm[1]*rgy[0];
+                    for( j = 0; j < 3; j++ ) {
+                        jmx[j+3] = rgx[j];
+                        jmy[j+3] = rgy[j];
+                    }
+                    w = &refine->w[(f*n+m)*36];
+                    for( j = 0; j < 6; j++ ) {
+                        for( i = 0; i < 6; i++ ) {
+                            refine->v[m*36+j*6+i] += jmx[j]*jmx[i] + jmy[j]*jmy[i];
+                            w[j*6+i] += jfx[j]*jmx[i] + jfy[j]*jmy[i];
+                        }
+                        refine->bm[m*6+j] += jmx[j]*ex + jmy[j]*ey;
+                    }
+                }
+            }
+        }
+
+        for(;;) {
+            /* S = V - sum W^T U^-1 W over the frames, and its right side */
+            memset( refine->s, 0, pnum*pnum*36*sizeof(double) );
+            for( m = 0; m < n; m++ ) {
+                if( (k=refine->pidx[m]) < 0 ) continue;
+                for( j = 0; j < 6; j++ ) {
+                    for( i = 0; i < 6; i++ ) {
+                        refine->s[(k*6+j)*pnum*6 + k*6+i] = refine->v[m*36+j*6+i];
+                    }
+                    refine->s[(k*6+j)*pnum*6 + k*6+j] *= 1.0 + lambda;
+                    refine->bs[k*6+j] = refine->bm[m*6+j];
+                }
+            }
+            for( f = 0; f < fnum; f++ ) {
+                u = &refine->u[f*36];
+                for( i = 0; i < 36; i++ ) ufi[i] = u[i];
+                for( j = 0; j < 6; j++ ) ufi[j*6+j] *= 1.0 + lambda;
+                if( chol_decomp( ufi, 6 ) < 0 ) return -1.0;
+                for( j = 0; j < 6; j++ ) y[j] = refine->bf[f*6+j];
+                chol_solve( ufi, 6, y );
+                for( m = 0; m < n; m++ ) {
+                    if( (k=refine->pidx[m]) < 0 || !refine->wseen[f*n+m] ) continue;
+                    w = &refine->w[(f*n+m)*36];
+                    for( j = 0; j < 6; j++ ) {
+                        for( i = 0; i < 6; i++ ) refine->bs[k*6+j] -= w[i*6+j] * y[i];
+                    }
+                    /* U^-1 W of member m, column by column */
+                    for( i = 0; i < 6; i++ ) {
+                        for( j = 0; j < 6; j++ ) uw[i*6+j] = w[j*6+i];
+                        chol_solve( ufi, 6, &uw[i*6] );
+                    }
+                    for( mm = 0; mm < n; mm++ ) {
+                        if( (l=refine->pidx[mm]) < 0 || !refine->wseen[f*n+mm] ) continue;
+                        wn = &refine->w[(f*n+mm)*36];
+                        for( j = 0; j < 6; j++ ) {
+                            for( i = 0; i < 6; i++ ) {
+                                hx = 0.0;
+                                for( c = 0; c < 6; c++ ) hx += wn[c*6+j] * uw[i*6+c];
+                                refine->s[(l*6+j)*pnum*6 + k*6+i] -= hx;
+                            }
+                        }
+                    }
+                }
+            }
+            if( chol_decomp( refine->s, pnum*6 ) < 0 ) {
+                lambda *= 10.0;
+                if( lambda > 1.0e6 ) break;
+                continue;
+            }
+            chol_solve( refine->s, pnum*6, refine->bs );
+
+            /* the members, then each frame from them */
+            for( m = 0; m < n; m++ ) {
+                if( (k=refine->pidx[m]) < 0 ) {
+                    for( j = 0; j < 3; j++ ) {
+                        for( i = 0; i < 4; i++ ) refine->tmtrans[m][j][i] = refine->mtrans[m][j][i];
+                    }
+                    continue;
+                }
+                update_rot( refine->mtrans[m], &refine->bs[k*6], refine->tmtrans[m] );
+                for( j = 0; j < 3; j++ ) {
+                    refine->tmtrans[m][j][3] = refine->mtrans[m][j][3] + refine->bs[k*6+3+j];
+                }
+            }
+            for( f = 0; f < fnum; f++ ) {
+                u = &refine->u[f*36];
+                for( i = 0; i < 36; i++ ) ufi[i] = u[i];
+                for( j = 0; j < 6; j++ ) ufi[j*6+j] *= 1.0 + lambda;
+                chol_decomp( ufi, 6 );
+                for( j = 0; j < 6; j++ ) y[j] = refine->bf[f*6+j];
+                for( m = 0; m < n; m++ ) {
+                    if( (k=refine->pidx[m]) < 0 || !refine->wseen[f*n+m] ) continue;
+                    w = &refine->w[(f*n+m)*36];
+                    for( j = 0; j < 6; j++ ) {
+                        for( i = 0; i < 6; i++ ) y[j] -= w[j*6+i] * refine->bs[k*6+i];
+                    }
+                }
+                chol_solve( ufi, 6, y );
+                update_rot( refine->wframe[f], y, refine->tframe[f] );
+                for( j = 0; j < 3; j++ ) {
+                    refine->tframe[f][j][3] = refine->wframe[f][j][3] + y[3+j];
+                }
+            }
+
+            err2 = get_err( refine, refine->tframe, refine->tmtrans );
+            if( err2 < err ) break;
+            lambda *= 10.0;
+            if( lambda > 1.0e6 ) break;
+        }
+        if( lambda > 1.0e6 ) break;
+
+        memcpy( refine->wframe, refine->tframe, fnum*12*sizeof(double) );
+        memcpy( refine->mtrans, refine->tmtrans, n*12*sizeof(double) );
+        lambda *= 0.1;
+        if( err - err2 < err * 1.0e-6 ) {
+            err = err2;
+            break;
+        }
+        err = err2;
+    }
+
+    return err;
+}
+
+/* mean squared reprojection error over the corners of the frames */
+static double get_err( ARMultiRefineT *refine, double (*frame)[3][4], double (*mtrans)[3][4] )
+{
+    ARMultiMarkerInfoT  *config;
+    double              pos[4][3], xb[3], xc[3];
+    double              hx, hy, h, x, y, err;
+    int                 n, num, f, m, c, j;
+
+    config = refine->config;
+    n = config->marker_num;
+    err = 0.0;
+    num = 0;
+    for( f = 0; f < refine->wframe_num; f++ ) {
+        for( m = 0; m < n; m++ ) {
+            if( !refine->wseen[f*n+m] ) continue;
+            get_corner( &config->marker[m], pos );
+            for( c = 0; c < 4; c++ ) {
+                for( j = 0; j < 3; j++ ) {
+                    xb[j] = mtrans[m][j][0] * pos[c][0]
+                          + mtrans[m][j][1] * pos[c][1]
+                          + mtrans[m][j][2] * pos[c][2]
+                          + mtrans[m][j][3];
+                }
+                for( j = 0; j < 3; j++ ) {
+                    xc[j] = frame[f][j][0] * xb[0]
+                          + frame[f][j][1] * xb[1]
+                          + frame[f][j][2] * xb[2]
+                          + frame[f][j][3];
+                }
+                hx = arParam.mat[0][0] * xc[0] + arParam.mat[0][1] * xc[1]
+                   + arParam.mat[0][2] * xc[2] + arParam.mat[0][3];
+                hy = arParam.mat[1][0] * xc[0] + arParam.mat[1][1] * xc[1]
+                   + arParam.mat[1][2] * xc[2] + arParam.mat[1][3];
+                h  = arParam.mat[2][0] * xc[0] + arParam.mat[2][1] * xc[1]
+                   + arParam.mat[2][2] * xc[2] + arParam.mat[2][3];
+                if( h <= 0.0 ) return 1.0e30;
+                x = hx / h - refine->wobs[((f*n+m)*4+c)*2+0];
+                y = hy / h - refine->wobs[((f*n+m)*4+c)*2+1];
+                err += x*x + y*y;
+                num++;
+            }
+        }
+    }
+
+    return (num > 0)? err / num: 0.0;
+}
+
+/* corners of a member in its own coordinates, as arMultiReadConfigFile sets them */
+static void get_corner( ARMultiEachMarkerInfoT *marker, double pos[4][3] )
+{
+    pos[0][0] = marker->center[0] - marker->width/2.0;
+    pos[0][1] = marker->center[1] + marker->width/2.0;
+    pos[1][0] = marker->center[0] + marker->width/2.0;
+    pos[1][1] = marker->center[1] + marker->width/2.0;
+    pos[2][0] = marker->center[0] + marker->width/2.0;
+    pos[2][1] = marker->center[1] - marker->width/2.0;
+    pos[3][0] = marker->center[0] - marker->width/2.0;
+    pos[3][1] = marker->center[1] - marker->width/2.0;
+    pos[0][2] = pos[1][2] = pos[2][2] = pos[3][2] = 0.0;
+}
+
+static void set_member( ARMultiEachMarkerInfoT *marker, double trans[3][4] )
+{
+    double    pos[4][3];
+    int       i, j;
+
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 4; i++ ) marker->trans[j][i] = trans[j][i];
+    }
+    arUtilMatInv( marker->trans, marker->itrans );
+
+    get_corner( marker, pos );
+    for( i = 0; i < 4; i++ ) {
+        for( j = 0; j < 3; j++ ) {
+            marker->pos3d[i][j] = trans[j][0] * pos[i][0]
+                                + trans[j][1] * pos[i][1]
+                                + trans[j][3];
+        }
+    }
+}
+
+/* wrot = exp([d]x) rot, on the rotation part only */
+static void update_rot( double rot[3][4], double d[3], double wrot[3][4] )
+{
+    double    drot[3][3], th, s, c, k[3];
+    int       i, j;
+
+    th = sqrt( d[0]*d[0] + d[1]*d[1] + d[2]*d[2] );
+    if( th > 0.0 ) {
+        k[0] = d[0] / th; k[1] = d[1] / th; k[2] = d[2] / th;
+    }
+    else {
+        k[0] = 1.0; k[1] = k[2] = 0.0;
+    }
+    s = sin( th );
+    c = cos( th );
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) drot[j][i] = (1.0 - c) * k[j] * k[i];
+        drot[j][j] += c;
+    }
+    drot[0][1] -= s*k[2]; drot[1][0] += s*k[2];
+    drot[0][2] += s*k[1]; drot[2][0] -= s*k[1];
+    drot[1][2] -= s*k[0]; drot[2][1] += s*k[0];
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) {
+            wrot[j][i] = drot[j][0] * rot[0][i]
+                       + drot[j][1] * rot[1][i]
+                       + drot[j][2] * rot[2][i];
+        }
+    }
+}
+
+/* Cholesky factor of a symmetric n x n matrix in place, lower triangle */
+static int chol_decomp( double *a, int n )
+{
+    double    sum;
+    int       i, j, k;
+
+    for( j = 0; j < n; j++ ) {
+        sum = a[j*n+j];
+        for( k = 0; k < j; k++ ) sum -= a[j*n+k] * a[j*n+k];
+        if( sum <= 0.0 ) return -1;
+        a[j*n+j] = sqrt( sum );
+        for( i = j+1; i < n; i++ ) {
+            sum = a[i*n+j];
+            for( k = 0; k < j; k++ ) sum -= a[i*n+k] * a[j*n+k];
+            a[i*n+j] = sum / a[j*n+j];
+        }
+    }
+
+    return 0;
+}
+
+static void chol_solve( double *l, int n, double *b )
+{
+    int       i, k;
+
+    for( i = 0; i < n; i++ ) {
+        for( k = 0; k < i; k++ ) b[i] -= l[i*n+k] * b[k];
+        b[i] /= l[i*n+i];
+    }
+    for( i = n-1; i >= 0; i-- ) {
+        for( k = i+1; k < n; k++ ) b[i] -= l[k*n+i] * b[k];
+        b[i] /= l[i*n+i];
+    }
+}
@@ -0,0 +1,144 @@
+/*******************************************************
+ *
+ *  Set of multi-marker patterns tracked from the same detection.
+ *
+ *  Every member of every pattern is an entry { patt_id, config, member,
+ *  next } chained from the bucket patt_id % AR_MULTI_HASH_SIZE, so that
+ *  arMultiGetTransMatAll finds the members a detected marker belongs to
+ *  without scanning the patterns. Each pattern also gets its scratch for
+ *  arMultiGetTransMatWork.
+ *
+*******************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <AR/ar.h>
+#include <AR/arMulti.h>
+
+static void make_index( ARMultiRegistryT *registry );
+
+ARMultiRegistryT *arMultiCreateRegistry( void )
+{
+    ARMultiRegistryT   *registry;
+    int                i;
+
+    registry = (ARMultiRegistryT *)malloc( sizeof(ARMultiRegistryT) );
+    if( registry == NULL ) return NULL;
+
+    registry->config     = NULL;
+    registry->err        = NULL;
+    registry->work       = NULL;
+    registry->config_num = 0;
+    registry->config_max = 0;
+    registry->entry      = NULL;
+    registry->entry_num  = 0;
+    registry->entry_max  = 0;
+    for( i = 0; i < AR_MULTI_HASH_SIZE; i++ ) registry->hash[i] = -1;
+
+    return registry;
+}
+
+int arMultiAddConfig( ARMultiRegistryT *registry, ARMultiMarkerInfoT *config )
+{
+    ARMultiMarkerInfoT   **wconfig;
+    double               *werr, **wwork;
+    int                  (*wentry)[4];
+    int                  num, c, i;
+
+    if( registry->config_num == registry->config_max ) {
+        num = (registry->config_max == 0)? 8: registry->config_max * 2;
+        wconfig = (ARMultiMarkerInfoT **)realloc( registry->config, num*sizeof(ARMultiMarkerInfoT *) );
+        if( wconfig == NULL ) return -1;
+        registry->config = wconfig;
+        werr = (double *)realloc( registry->err, num*sizeof(double) );
+        if( werr == NULL ) return -1;
+        registry->err = werr;
+        wwork = (double **)realloc( registry->work, num*sizeof(double *) );
+        if( wwork == NULL ) return -1;
+        registry->work = wwork;
+        registry->config_max = num;
+    }
+    if( registry->entry_num + config->marker_num > registry->entry_max ) {
+        num = registry->entry_max;
+        if( num == 0 ) num = 64;
+        while( num < registry->entry_num + config->marker_num ) num *= 2;
+        wentry = (int (*)[4])realloc( registry->entry, num*sizeof(int[4]) );
+        if( wentry == NULL ) return -1;
+        registry->entry = wentry;
+        registry->entry_max = num;
+    }
+
+    c = registry->config_num;
+    registry->work[c] = (double *)malloc( AR_MULTI_WORK_SIZE(config->marker_num)*sizeof(double) );
+    if( registry->work[c] == NULL ) return -1;
+    registry->config[c] = config;
+    registry->err[c]    = -1.0;
+    registry->config_num++;
+
+    for( i = 0; i < config->marker_num; i++ ) {
+        num = registry->entry_num++;
+        registry->entry[num][0] = config->marker[i].patt_id;
+        registry->entry[num][1] = c;
+        registry->entry[num][2] = i;
+        registry->entry[num][3] = registry->hash[config->marker[i].patt_id & (AR_MULTI_HASH_SIZE-1)];
+        registry->hash[config->marker[i].patt_id & (AR_MULTI_HASH_SIZE-1)] = num;
+    }
+
+    return c;
+}
+
+int arMultiRemoveConfig( ARMultiRegistryT *registry, ARMultiMarkerInfoT *config )
+{
+    int     c;
+
+    for( c = 0; c < registry->config_num; c++ ) {
+        if( registry->config[c] == config ) break;
+    }
+    if( c == registry->config_num ) return -1;
+
+    free( registry->work[c] );
+    for( c++; c < registry->config_num; c++ ) {
+        registry->config[c-1] = registry->config[c];
+        registry->err[c-1]    = registry->err[c];
+        registry->work[c-1]   = registry->work[c];
+    }
+    registry->config_num--;
+    make_index( registry );
+
+    return 0;
+}
+
+int arMultiFreeRegistry( ARMultiRegistryT *registry )
+{
+    int     c;
+
+    for( c = 0; c < registry->config_num; c++ ) free( registry->work[c] );
+    free( registry->work );
+    free( registry->err );
+    free( registry->config );
+    free( registry->entry );
+    free( registry );
+
+    return 0;
+}
+
+/* the entries are rebuilt from the patterns; there are never more than before */
+static void make_index( ARMultiRegistryT *registry )
+{
+    ARMultiMarkerInfoT   *config;
+    int                  num, c, i;
+
+    for( i = 0; i < AR_MULTI_HASH_SIZE; i++ ) registry->hash[i] = -1;
+    num = 0;
+    for( c = 0; c < registry->config_num; c++ ) {
+        config = registry->config[c];
+        for( i = 0; i < config->marker_num; i++ ) {
+            registry->entry[num][0] = config->marker[i].patt_id;
+            registry->entry[num][1] = c;
+            registry->entry[num][2] = i;
+            registry->entry[num][3] = registry->hash[config->marker[i].patt_id & (AR_MULTI_HASH_SIZE-1)];
+            registry->hash[config->marker[i].patt_id & (AR_MULTI_HASH_SIZE-1)] = num;
+            num++;
+        }
+    }
+    registry->entry_num = num;
+}
@@ -97,6 +97,14 @@ SOURCE=.\arMultiGetTransMat.c
 
 SOURCE=.\arMultiReadConfigFile.c
 # End Source File
+# Begin Source File
+
+SOURCE=.\arMultiRefine.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\arMultiRegistry.c
+# End Source File
 # End Group
 # Begin Group "Header Files"
 
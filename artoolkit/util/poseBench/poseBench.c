@@ -0,0 +1,382 @@
+/*
+ *  Compares the pose refinement methods of arGetTransMat on synthetic
+ *  markers: random poses are projected with the camera parameters,
+ *  the corners are disturbed by noise and the pose is estimated again
+ *  with each value of arInitRotMode and arPoseRefineMode. The spread
+ *  predicted by arGetTransMatEx is compared with the actual errors, and
+ *  frames of FRAME_NUM markers are solved one by one and with
+ *  arGetTransMatBatch. Last the marker edges are drawn as pixel contours
+ *  and fitted by arGetLine with each arLineFitMode, to compare the
+ *  single precision fit with the double one. Finally the markers are
+ *  also seen by a right camera STEREO_BASE mm aside and solved by
+ *  arsGetTransMat with each refinement.
+ *
+ *  usage: poseBench [trials] [noise(pixel)]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <AR/param.h>
+#include <AR/ar.h>
+
+#define  MARKER_WIDTH   80.0
+#define  FRAME_NUM      30
+#define  STEREO_BASE    120.0
+
+char           *cparam_name = "Data/camera_para.dat";
+ARParam         cparam;
+
+typedef struct {
+    ARMarkerInfo   info;
+    double         conv[3][4];
+} Sample;
+
+static double uniform( void );
+static void   make_sample( Sample *s, double noise );
+static void   make_view( ARMarkerInfo *info, double conv[3][4], double noise );
+static double rot_error( double a[3][4], double b[3][4] );
+static int    make_contour( Sample *s, int x_coord[], int y_coord[], int vertex[5] );
+
+int main( int argc, char **argv )
+{
+    static char  *name[2] = { "angle search", "LM" };
+    static int   mode[2] = { AR_POSE_REFINE_ANGLE_SEARCH, AR_POSE_REFINE_LM };
+    static char  *iname[2] = { "vanishing pt", "IPPE" };
+    static int   imode[2] = { AR_INIT_ROT_VANISHING_POINT, AR_INIT_ROT_IPPE };
+    ARParam      wparam;
+    Sample       *sample;
+    double       conv[3][4], center[2] = { 0.0, 0.0 };
+    double       err, serr, srot, strans, maxerr, t;
+    int          trials, fail;
+    double       noise;
+    int          i, j, m, n;
+
+    trials = (argc > 1)? atoi(argv[1]): 10000;
+    noise  = (argc > 2)? atof(argv[2]): 0.3;
+    if( trials <= 0 ) trials = 10000;
+
+    if( arParamLoad(cparam_name, 1, &wparam) < 0 ) {
+        printf("Camera parameter load error !!\n");
+        exit(0);
+    }
+    arParamChangeSize( &wparam, 640, 480, &cparam );
+    arInitCparam( &cparam );
+
+    arMalloc( sample, Sample, trials );
+    srand( 1 );
+    for( i = 0; i < trials; i++ ) make_sample( &sample[i], noise );
+
+    printf("%d markers, %.2f pixel noise\n", trials, noise);
+    for( n = 0; n < 2; n++ ) for( m = 0; m < 2; m++ ) {
+        arInitRotMode = imode[n];
+        arPoseRefineMode = mode[m];
+        serr = srot = strans = maxerr = 0.0;
+        fail = 0;
+        arUtilTimerReset();
+        for( i = 0; i < trials; i++ ) {
+            err = arGetTransMat( &sample[i].info, center, MARKER_WIDTH, conv );
+            if( err < 0.0 ) { fail++; continue; }
+            serr += err;
+            if( err > maxerr ) maxerr = err;
+            srot += rot_error( conv, sample[i].conv );
+            strans += sqrt( (conv[0][3]-sample[i].conv[0][3])*(conv[0][3]-sample[i].conv[0][3])
+                          + (conv[1][3]-sample[i].conv[1][3])*(conv[1][3]-sample[i].conv[1][3])
+                          + (conv[2][3]-sample[i].conv[2][3])*(conv[2][3]-sample[i].conv[2][3]) );
+        }
+        t = arUtilTimer();
+        i = trials - fail;
+        if( i == 0 ) i = 1;
+        printf("%-12s + %-12s %8.2f usec/marker  err %8.5f (max %8.5f)  rot %7.4f deg  trans %7.3f mm  failed %d\n",
+               iname[n], name[m], t * 1000000.0 / trials, serr / i, maxerr, srot / i, strans / i, fail);
+    }
+
+    {
+        double         cov[6][6], prot, ptrans, t1;
+        int            flip;
+
+        arInitRotMode = DEFAULT_INIT_ROT_MODE;
+        arPoseRefineMode = DEFAULT_POSE_REFINE_MODE;
+        prot = ptrans = srot = strans = 0.0;
+        fail = flip = 0;
+        arUtilTimerReset();
+        for( i = 0; i < trials; i++ ) {
+            err = arGetTransMatEx( &sample[i].info, center, MARKER_WIDTH, conv, cov );
+            if( err < 0.0 ) { fail++; continue; }
+            /* the mirrored pose is not a small error, leave it out */
+            t = rot_error( conv, sample[i].conv );
+            if( t > 10.0 ) { flip++; continue; }
+            t *= 3.14159265358979323846 / 180.0;
+            prot   += cov[0][0] + cov[1][1] + cov[2][2];
+            ptrans += cov[3][3] + cov[4][4] + cov[5][5];
+            srot += t * t;
+            strans += (conv[0][3]-sample[i].conv[0][3])*(conv[0][3]-sample[i].conv[0][3])
+                    + (conv[1][3]-sample[i].conv[1][3])*(conv[1][3]-sample[i].conv[1][3])
+                    + (conv[2][3]-sample[i].conv[2][3])*(conv[2][3]-sample[i].conv[2][3]);
+        }
+        t1 = arUtilTimer();
+        i = trials - fail - flip;
+        if( i == 0 ) i = 1;
+        printf("with covariance %8.2f usec/marker  rms rot %7.4f deg (predicted %7.4f)  rms trans %7.3f mm (predicted %7.3f)  flipped %d\n",
+               t1 * 1000000.0 / trials,
+               sqrt(srot / i) * 180.0 / 3.14159265358979323846,
+               sqrt(prot / i) * 180.0 / 3.14159265358979323846,
+               sqrt(strans / i), sqrt(ptrans / i), flip);
+    }
+
+    {
+        ARMarkerInfo   info[FRAME_NUM];
+        double         fcenter[FRAME_NUM][2], fwidth[FRAME_NUM];
+        double         fconv[FRAME_NUM][3][4], ferr[FRAME_NUM];
+        double         t1, t2;
+        int            frames, f;
+
+        arInitRotMode = DEFAULT_INIT_ROT_MODE;
+        arPoseRefineMode = DEFAULT_POSE_REFINE_MODE;
+        frames = trials / FRAME_NUM;
+        for( i = 0; i < FRAME_NUM; i++ ) {
+            fcenter[i][0] = fcenter[i][1] = 0.0;
+            fwidth[i] = MARKER_WIDTH;
+        }
+        if( frames > 0 ) {
+            arUtilTimerReset();
+            for( f = 0; f < frames; f++ ) {
+                for( i = 0; i < FRAME_NUM; i++ ) {
+                    ferr[i] = arGetTransMat( &sample[f*FRAME_NUM+i].info,
+                                             fcenter[i], fwidth[i], fconv[i] );
+                }
+            }
+            t1 = arUtilTimer();
+            arUtilTimerReset();
+            for( f = 0; f < frames; f++ ) {
+                for( i = 0; i < FRAME_NUM; i++ ) info[i] = sample[f*FRAME_NUM+i].info;
+                arGetTransMatBatch( info, FRAME_NUM, fcenter, fwidth, fconv, ferr );
+            }
+            t2 = arUtilTimer();
+            printf("%d markers/frame: one by one %.1f usec/frame, batch (%d threads) %.1f usec/frame\n",
+                   FRAME_NUM, t1 * 1000000.0 / frames, AR_POSE_THREAD_MAX, t2 * 1000000.0 / frames);
+        }
+    }
+
+    {
+        static int     x_coord[AR_CHAIN_MAX], y_coord[AR_CHAIN_MAX];
+        static double  fline[2][4][3];
+        ARMarkerInfo   info;
+        double         fvertex[2][4][2], fconv[2][3][4];
+        double         tfit[2], dv, mdv, sdv, dr, mdr, sdr, dt, mdt, sdt;
+        int            vertex[5], num, ok, k;
+
+        sdv = mdv = sdr = mdr = sdt = mdt = 0.0;
+        tfit[0] = tfit[1] = 0.0;
+        ok = 0;
+        for( i = 0; i < trials; i++ ) {
+            num = make_contour( &sample[i], x_coord, y_coord, vertex );
+            if( num < 0 ) continue;
+            for( k = 0; k < 2; k++ ) {
+                arLineFitMode = (k == 0)? AR_LINE_FIT_DOUBLE: AR_LINE_FIT_FLOAT;
+                t = arUtilGetTime();
+                if( arGetLine( x_coord, y_coord, num, vertex, fline[k], fvertex[k] ) < 0 ) break;
+                tfit[k] += arUtilGetTime() - t;
+                info = sample[i].info;
+                for( m = 0; m < 4; m++ ) {
+                    info.vertex[m][0] = fvertex[k][m][0];
+                    info.vertex[m][1] = fvertex[k][m][1];
+                }
+                if( arGetTransMat( &info, center, MARKER_WIDTH, fconv[k] ) < 0 ) break;
+            }
+            if( k < 2 ) continue;
+            ok++;
+            for( m = 0; m < 4; m++ ) {
+                dv = sqrt( (fvertex[0][m][0]-fvertex[1][m][0])*(fvertex[0][m][0]-fvertex[1][m][0])
+                         + (fvertex[0][m][1]-fvertex[1][m][1])*(fvertex[0][m][1]-fvertex[1][m][1]) );
+                sdv += dv / 4.0;
+                if( dv > mdv ) mdv = dv;
+            }
+            dr = rot_error( fconv[0], fconv[1] );
+            dt = sqrt( (fconv[0][0][3]-fconv[1][0][3])*(fconv[0][0][3]-fconv[1][0][3])
+                     + (fconv[0][1][3]-fconv[1][1][3])*(fconv[0][1][3]-fconv[1][1][3])
+                     + (fconv[0][2][3]-fconv[1][2][3])*(fconv[0][2][3]-fconv[1][2][3]) );
+            sdr += dr; if( dr > mdr ) mdr = dr;
+            sdt += dt; if( dt > mdt ) mdt = dt;
+        }
+        arLineFitMode = DEFAULT_LINE_FIT_MODE;
+        if( ok == 0 ) ok = 1;
+        printf("line fit: double %.2f usec/marker, float %.2f usec/marker\n",
+               tfit[0] * 1000000.0 / ok, tfit[1] * 1000000.0 / ok);
+        printf("float - double: vertex %.6f (max %.6f) pixel  rot %.6f (max %.6f) deg  trans %.5f (max %.5f) mm\n",
+               sdv / ok, mdv, sdr / ok, mdr, sdt / ok, mdt);
+    }
+
+    {
+        ARSParam       sparam;
+        ARMarkerInfo   *infoR;
+        double         convR[3][4], transR[3][4], th;
+
+        /* a right camera like the left one, turned a little towards it */
+        sparam.xsize = cparam.xsize;
+        sparam.ysize = cparam.ysize;
+        th = 3.0 * 3.14159265358979323846 / 180.0;
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 4; i++ ) {
+                sparam.matL[j][i] = sparam.matR[j][i] = cparam.mat[j][i];
+                sparam.matL2R[j][i] = (i == j)? 1.0: 0.0;
+            }
+        }
+        sparam.matL2R[0][0] =  cos(th); sparam.matL2R[0][2] = -sin(th);
+        sparam.matL2R[2][0] =  sin(th); sparam.matL2R[2][2] =  cos(th);
+        sparam.matL2R[0][3] = -STEREO_BASE;
+        for( i = 0; i < 4; i++ ) {
+            sparam.dist_factorL[i] = sparam.dist_factorR[i] = cparam.dist_factor[i];
+        }
+        arsInitCparam( &sparam );
+
+        arMalloc( infoR, ARMarkerInfo, trials );
+        for( i = 0; i < trials; i++ ) {
+            arUtilMatMul( sparam.matL2R, sample[i].conv, convR );
+            make_view( &infoR[i], convR, noise );
+        }
+
+        arInitRotMode = DEFAULT_INIT_ROT_MODE;
+        for( m = 0; m < 2; m++ ) {
+            arPoseRefineMode = (m == 0)? AR_POSE_REFINE_ANGLE_SEARCH: AR_POSE_REFINE_LM;
+            serr = srot = strans = 0.0;
+            fail = 0;
+            arUtilTimerReset();
+            for( i = 0; i < trials; i++ ) {
+                err = arsGetTransMat( &sample[i].info, &infoR[i], center, MARKER_WIDTH, conv, transR );
+                if( err < 0.0 ) { fail++; continue; }
+                serr += err;
+                srot += rot_error( conv, sample[i].conv );
+                strans += sqrt( (conv[0][3]-sample[i].conv[0][3])*(conv[0][3]-sample[i].conv[0][3])
+                              + (conv[1][3]-sample[i].conv[1][3])*(conv[1][3]-sample[i].conv[1][3])
+                              + (conv[2][3]-sample[i].conv[2][3])*(conv[2][3]-sample[i].conv[2][3]) );
+            }
+            t = arUtilTimer();
+            n = trials - fail;
+            if( n == 0 ) n = 1;
+            printf("stereo %-12s %8.2f usec/marker  err %8.5f  rot %7.4f deg  trans %7.3f mm  failed %d\n",
+                   name[m], t * 1000000.0 / trials, serr / n, srot / n, strans / n, fail);
+        }
+        arPoseRefineMode = DEFAULT_POSE_REFINE_MODE;
+        free( infoR );
+    }
+
+    free( sample );
+    return 0;
+}
+
+static double uniform( void )
+{
+    return rand() / (double)RAND_MAX * 2.0 - 1.0;
+}
+
+static void make_sample( Sample *s, double noise )
+{
+    double   a, b, c, rot[3][3];
+    int      i, j;
+
+    /* marker facing the camera, tilted up to about 60 degrees */
+    a = uniform() * 3.14;
+    b = 3.14159265358979323846 - fabs(uniform());
+    c = uniform() * 3.14;
+    arGetRot( a, b, c, rot );
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) s->conv[j][i] = rot[j][i];
+    }
+    s->conv[2][3] = 400.0 + (uniform() + 1.0) * 300.0;
+    s->conv[0][3] = uniform() * s->conv[2][3] * 0.25;
+    s->conv[1][3] = uniform() * s->conv[2][3] * 0.2;
+
+    make_view( &s->info, s->conv, noise );
+}
+
+/* as arGetMarkerInfo: vertices in ideal coordinates and the lines through them */
+static void make_view( ARMarkerInfo *info, double conv[3][4], double noise )
+{
+    double   v[4][2], p[4][2], x, y, z, d;
+    int      i;
+
+    p[0][0] = -MARKER_WIDTH/2.0; p[0][1] =  MARKER_WIDTH/2.0;
+    p[1][0] =  MARKER_WIDTH/2.0; p[1][1] =  MARKER_WIDTH/2.0;
+    p[2][0] =  MARKER_WIDTH/2.0; p[2][1] = -MARKER_WIDTH/2.0;
+    p[3][0] = -MARKER_WIDTH/2.0; p[3][1] = -MARKER_WIDTH/2.0;
+    for( i = 0; i < 4; i++ ) {
+        x = conv[0][0]*p[i][0] + conv[0][1]*p[i][1] + conv[0][3];
+        y = conv[1][0]*p[i][0] + conv[1][1]*p[i][1] + conv[1][3];
+        z = conv[2][0]*p[i][0] + conv[2][1]*p[i][1] + conv[2][3];
+        v[i][0] = (cparam.mat[0][0]*x + cparam.mat[0][1]*y + cparam.mat[0][2]*z) / z
+                + uniform() * noise;
+        v[i][1] = (cparam.mat[1][1]*y + cparam.mat[1][2]*z) / z
+                + uniform() * noise;
+    }
+
+    info->dir = rand() % 4;
+    for( i = 0; i < 4; i++ ) {
+        info->vertex[(4-info->dir+i)%4][0] = v[i][0];
+        info->vertex[(4-info->dir+i)%4][1] = v[i][1];
+    }
+    for( i = 0; i < 4; i++ ) {
+        info->line[i][0] = info->vertex[(i+1)%4][1] - info->vertex[i][1];
+        info->line[i][1] = info->vertex[i][0] - info->vertex[(i+1)%4][0];
+        d = sqrt( info->line[i][0]*info->line[i][0]
+                + info->line[i][1]*info->line[i][1] );
+        info->line[i][0] /= d;
+        info->line[i][1] /= d;
+        info->line[i][2] = -(info->line[i][0]*info->vertex[i][0]
+                          + info->line[i][1]*info->vertex[i][1]);
+    }
+    info->id = 0;
+    info->cf = 1.0;
+}
+
+static double rot_error( double a[3][4], double b[3][4] )
+{
+    double   t;
+    int      i, j;
+
+    t = 0.0;
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) t += a[j][i] * b[j][i];
+    }
+    t = (t - 1.0) / 2.0;
+    if( t >  1.0 ) t =  1.0;
+    if( t < -1.0 ) t = -1.0;
+
+    return acos( t ) * 180.0 / 3.14159265358979323846;
+}
+
+/*
+ *  The edges between the (noisy) corners of a sample, distorted into
+ *  observed coordinates and rounded to pixels, as a contour for arGetLine.
+ */
+static int make_contour( Sample *s, int x_coord[], int y_coord[], int vertex[5] )
+{
+    double   ox, oy, len, t;
+    double   *p1, *p2;
+    int      num, x, y, n, i, j;
+
+    num = 0;
+    for( i = 0; i < 4; i++ ) {
+        vertex[i] = num;
+        p1 = s->info.vertex[i];
+        p2 = s->info.vertex[(i+1)%4];
+        len = sqrt( (p2[0]-p1[0])*(p2[0]-p1[0]) + (p2[1]-p1[1])*(p2[1]-p1[1]) );
+        n = (int)(len * 2.0) + 1;
+        for( j = 0; j < n; j++ ) {
+            t = (double)j / n;
+            arParamIdeal2Observ( cparam.dist_factor, p1[0] + (p2[0]-p1[0])*t,
+                                 p1[1] + (p2[1]-p1[1])*t, &ox, &oy );
+            x = (int)(ox + 0.5);
+            y = (int)(oy + 0.5);
+            if( num > 0 && x == x_coord[num-1] && y == y_coord[num-1] ) continue;
+            if( num >= AR_CHAIN_MAX-1 ) return -1;
+            x_coord[num] = x;
+            y_coord[num] = y;
+            num++;
+        }
+    }
+    x_coord[num] = x_coord[0];
+    y_coord[num] = y_coord[0];
+    vertex[4] = num;
+
+    return num + 1;
+}
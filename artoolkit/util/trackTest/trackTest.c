@@ -0,0 +1,748 @@
+/*
+ *  Checks the tracking of the markers over frames on synthetic images:
+ *  markers are drawn with the camera parameters as they move, and the
+ *  results of each way of following them are compared with the drawn
+ *  corners or with those of the plain detection.
+ *
+ *    history   a marker hidden for a few frames is still reported by
+ *              the history of its tracker, then dropped
+ *    interval  with arDetectInterval the markers are tracked by their
+ *              corners between full detections, as precisely, and the
+ *              history reports the same markers as detecting every frame
+ *    async     with arDetectAsync each marker is reported once, with
+ *              its id, while the detections run on their thread
+ *    handles   two cameras detected from two threads at the same time
+ *              give the results of one after the other
+ *    pipeline  an ARPipeline gives the frames in order, stamped in the
+ *              order of the stages, with the poses of a sequential run,
+ *              and poses matrix codes of any id
+ *    refine    arMultiRefine brings the members of a multi-marker
+ *              pattern measured with errors back within 0.3 degree
+ *              and 0.5 mm of their transforms
+ *
+ *  Each check prints ok or FAILED; the exit status is the number of
+ *  checks failed.
+ *
+ *  usage: trackTest
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <AR/param.h>
+#include <AR/ar.h>
+#include <AR/arMulti.h>
+#if AR_POSE_THREAD_MAX > 0
+#include <pthread.h>
+#endif
+
+#define  XSIZE          640
+#define  YSIZE          480
+#define  THRESH         100
+#define  MARKER_WIDTH   80.0
+#define  MARKER_NUM     3
+#define  FRAME_NUM      40
+#define  HIDE_FROM      20
+#define  HIDE_TO        24
+#define  CODE_ID        1234
+
+char           *cparam_name = "Data/camera_para.dat";
+char           *patt_name[MARKER_NUM] = { "Data/patt.hiro", "Data/patt.kanji", "Data/multi/patt.a" };
+ARParam         cparam;
+
+typedef struct {
+    int      patt;
+    double   width;
+    double   conv[3][4];
+} Marker;
+
+static int      patt_id[MARKER_NUM];
+/* the patterns as drawn, and a matrix code after them */
+static int      patt_gray[MARKER_NUM+1][AR_PATT_SIZE_Y][AR_PATT_SIZE_X];
+/* ideal coordinates of each pixel */
+static double   *ideal;
+
+static int    check_history( void );
+static int    check_interval( void );
+static int    check_async( void );
+static int    check_handles( void );
+static int    check_pipeline( void );
+static int    check_refine( void );
+
+static int    load_gray( char *name, int gray[AR_PATT_SIZE_Y][AR_PATT_SIZE_X] );
+static void   make_scene( Marker m[MARKER_NUM], int f );
+static void   make_conv( double conv[3][4], double a, double b, double c,
+                         double x, double y, double z );
+static void   render( ARUint8 *image, Marker *m, int num );
+static void   get_corner( Marker *m, double v[4][2] );
+static double vertex_error( ARMarkerInfo *info, double v[4][2] );
+static int    find_id( ARMarkerInfo *info, int num, int id );
+static int    stream( ARTracker *tracker, int sleep_msec, char seen[FRAME_NUM],
+                      int *tracked, double *err, int *dup );
+static double uniform( void );
+
+int main( void )
+{
+    ARParam      wparam;
+    int          fail, x, y, i;
+
+    if( arParamLoad(cparam_name, 1, &wparam) < 0 ) {
+        printf("Camera parameter load error !!\n");
+        exit(-1);
+    }
+    arParamChangeSize( &wparam, XSIZE, YSIZE, &cparam );
+    arInitCparam( &cparam );
+
+    for( i = 0; i < MARKER_NUM; i++ ) {
+        if( load_gray( patt_name[i], patt_gray[i] ) < 0
+         || (patt_id[i] = arLoadPatt( patt_name[i] )) < 0 ) {
+            printf("Pattern load error !!\n");
+            exit(-1);
+        }
+    }
+
+    arMalloc( ideal, double, XSIZE*YSIZE*2 );
+    for( y = 0; y < YSIZE; y++ ) {
+        for( x = 0; x < XSIZE; x++ ) {
+            arParamObserv2Ideal( cparam.dist_factor, x, y,
+                                 &ideal[(y*XSIZE+x)*2], &ideal[(y*XSIZE+x)*2+1] );
+        }
+    }
+
+    fail = 0;
+    if( check_history()  < 0 ) fail++;
+    if( check_interval() < 0 ) fail++;
+    if( check_async()    < 0 ) fail++;
+    if( check_handles()  < 0 ) fail++;
+    if( check_pipeline() < 0 ) fail++;
+    if( check_refine()   < 0 ) fail++;
+
+    free( ideal );
+    return fail;
+}
+
+static int check_history( void )
+{
+    ARTracker    *tracker;
+    ARMarkerInfo *info;
+    Marker       m[MARKER_NUM];
+    ARUint8      *image;
+    char         seen[FRAME_NUM];
+    int          num, lite, keep, ok, f;
+
+    arDetectInterval = 1;
+    tracker = arCreateTracker();
+    stream( tracker, 0, seen, NULL, NULL, NULL );
+    arFreeTracker( tracker );
+
+    arMalloc( image, ARUint8, XSIZE*YSIZE*AR_PIX_SIZE_DEFAULT );
+    make_scene( m, HIDE_FROM );
+    render( image, m, MARKER_NUM-1 );
+    arDetectMarkerLite( image, THRESH, &info, &num );
+    lite = (find_id( info, num, patt_id[MARKER_NUM-1] ) >= 0);
+    free( image );
+
+    /* kept from the first frame it is hidden, and not past HIDE_TO */
+    for( keep = 0; HIDE_FROM + keep < HIDE_TO && seen[HIDE_FROM+keep]; keep++ );
+    ok = (!lite && keep > 0 && keep < HIDE_TO - HIDE_FROM && seen[HIDE_TO]);
+    for( f = HIDE_FROM + keep; f < HIDE_TO; f++ ) if( seen[f] ) ok = 0;
+
+    printf("history:  hidden marker kept %d frames (%d hidden), not detected %s  %s\n",
+           keep, HIDE_TO - HIDE_FROM, lite? "NO": "yes", ok? "ok": "FAILED");
+    return ok? 0: -1;
+}
+
+static int check_interval( void )
+{
+    ARTracker    *tracker;
+    char         seen[2][FRAME_NUM];
+    double       err[2];
+    int          tracked, dup, ok, f;
+
+    arDetectInterval = 1;
+    tracker = arCreateTracker();
+    stream( tracker, 0, seen[0], NULL, &err[0], NULL );
+    arFreeTracker( tracker );
+
+    arDetectInterval = 5;
+    tracker = arCreateTracker();
+    stream( tracker, 0, seen[1], &tracked, &err[1], &dup );
+    arFreeTracker( tracker );
+    arDetectInterval = DEFAULT_DETECT_INTERVAL;
+
+    /* a marker coming back waits for the next full detection, the history does not */
+    for( f = 0; f < HIDE_TO; f++ ) if( seen[0][f] != seen[1][f] ) break;
+    ok = (tracked >= FRAME_NUM/2 && err[1] < 1.0 && err[1] < err[0] + 0.5 && dup == 0 && f == HIDE_TO);
+
+    printf("interval: %d of %d frames tracked, vertex error %.3f pixel (%.3f detected), history %s  %s\n",
+           tracked, FRAME_NUM, err[1], err[0], (f == HIDE_TO)? "as detected": "DIFFERS", ok? "ok": "FAILED");
+    return ok? 0: -1;
+}
+
+static int check_async( void )
+{
+#if AR_POSE_THREAD_MAX > 0
+    ARTracker    *tracker;
+    char         seen[FRAME_NUM];
+    double       err;
+    int          dup, ok;
+
+    arDetectAsync = 1;
+    tracker = arCreateTracker();
+    arDetectAsync = DEFAULT_DETECT_ASYNC;
+    /* time for the detection of each frame to finish */
+    ok = (stream( tracker, 20, seen, NULL, &err, &dup ) == 0);
+    arFreeTracker( tracker );
+
+    ok = (ok && err < 1.5 && dup == 0);
+    printf("async:    all markers reported, vertex error %.3f pixel, %d duplicated  %s\n",
+           err, dup, ok? "ok": "FAILED");
+    return ok? 0: -1;
+#else
+    printf("async:    no threads, skipped\n");
+    return 0;
+#endif
+}
+
+#if AR_POSE_THREAD_MAX > 0
+typedef struct {
+    ARHandle     *handle;
+    ARUint8      **image;
+    ARMarkerInfo info[FRAME_NUM][AR_SQUARE_MAX*2];
+    int          num[FRAME_NUM];
+} HandleRun;
+
+static void *run_handle( void *arg )
+{
+    HandleRun    *run;
+    ARMarkerInfo *info;
+    int          f, i;
+
+    run = (HandleRun *)arg;
+    for( f = 0; f < FRAME_NUM; f++ ) {
+        if( arHandleDetectMarker( run->handle, run->image[f], THRESH, &info, &run->num[f] ) < 0 ) {
+            run->num[f] = -1;
+            continue;
+        }
+        for( i = 0; i < run->num[f]; i++ ) run->info[f][i] = info[i];
+    }
+    return NULL;
+}
+
+static int same_marker( ARMarkerInfo *a, ARMarkerInfo *b )
+{
+    return( a->id == b->id && a->dir == b->dir && a->cf == b->cf && a->area == b->area
+         && memcmp(a->vertex, b->vertex, sizeof(a->vertex)) == 0
+         && memcmp(a->line, b->line, sizeof(a->line)) == 0 );
+}
+#endif
+
+static int check_handles( void )
+{
+#if AR_POSE_THREAD_MAX > 0
+    static HandleRun  run[2][2];
+    pthread_t         thread[2];
+    Marker            m[MARKER_NUM];
+    int               diff, c, f, i, k;
+
+    for( c = 0; c < 2; c++ ) {
+        arMalloc( run[0][c].image, ARUint8 *, FRAME_NUM );
+        for( f = 0; f < FRAME_NUM; f++ ) {
+            arMalloc( run[0][c].image[f], ARUint8, XSIZE*YSIZE*AR_PIX_SIZE_DEFAULT );
+            make_scene( m, f + c*FRAME_NUM/2 );
+            render( run[0][c].image[f], m, MARKER_NUM );
+        }
+        run[1][c].image = run[0][c].image;
+    }
+
+    /* one camera after the other, then both at the same time */
+    for( k = 0; k < 2; k++ ) {
+        for( c = 0; c < 2; c++ ) run[k][c].handle = arCreateHandle( &cparam );
+        if( k == 0 ) {
+            for( c = 0; c < 2; c++ ) run_handle( &run[k][c] );
+        }
+        else {
+            for( c = 0; c < 2; c++ ) pthread_create( &thread[c], NULL, run_handle, &run[k][c] );
+            for( c = 0; c < 2; c++ ) pthread_join( thread[c], NULL );
+        }
+        for( c = 0; c < 2; c++ ) arDeleteHandle( run[k][c].handle );
+    }
+
+    diff = 0;
+    for( c = 0; c < 2; c++ ) {
+        for( f = 0; f < FRAME_NUM; f++ ) {
+            if( run[0][c].num[f] < MARKER_NUM || run[0][c].num[f] != run[1][c].num[f] ) {
+                diff++;
+                continue;
+            }
+            for( i = 0; i < run[0][c].num[f]; i++ ) {
+                if( !same_marker( &run[0][c].info[f][i], &run[1][c].info[f][i] ) ) diff++;
+            }
+        }
+        for( f = 0; f < FRAME_NUM; f++ ) free( run[0][c].image[f] );
+        free( run[0][c].image );
+    }
+
+    printf("handles:  2 cameras on 2 threads, %d frames differ from one after the other  %s\n",
+           diff, (diff == 0)? "ok": "FAILED");
+    return (diff == 0)? 0: -1;
+#else
+    printf("handles:  no threads, skipped\n");
+    return 0;
+#endif
+}
+
+typedef struct {
+    ARUint8  **image;
+    int      num;
+    int      next;
+} Camera;
+
+static ARUint8 *capture( void *userdata )
+{
+    Camera   *camera;
+
+    camera = (Camera *)userdata;
+    if( camera->next >= camera->num ) return NULL;
+    return camera->image[camera->next];
+}
+
+static int capture_next( void *userdata )
+{
+    ((Camera *)userdata)->next++;
+    return 0;
+}
+
+static int check_pipeline( void )
+{
+    static double    conv[FRAME_NUM][AR_SQUARE_MAX*2][3][4];
+    static double    err[FRAME_NUM][AR_SQUARE_MAX*2];
+    static int       num[FRAME_NUM];
+    ARPipeline       *pipeline;
+    ARPipelineFrame  *frame;
+    ARHandle         *handle;
+    ARMarkerInfo     *info;
+    Camera           camera;
+    Marker           m[MARKER_NUM];
+    double           center[2] = { 0.0, 0.0 };
+    double           last, depth;
+    int              order, diff, ok, f, i;
+
+    camera.num = FRAME_NUM;
+    arMalloc( camera.image, ARUint8 *, FRAME_NUM );
+    for( f = 0; f < FRAME_NUM; f++ ) {
+        arMalloc( camera.image[f], ARUint8, XSIZE*YSIZE*AR_PIX_SIZE_DEFAULT );
+        make_scene( m, f );
+        render( camera.image[f], m, MARKER_NUM );
+    }
+
+    handle = arCreateHandle( &cparam );
+    for( f = 0; f < FRAME_NUM; f++ ) {
+        if( arHandleDetectMarker( handle, camera.image[f], THRESH, &info, &num[f] ) < 0 ) num[f] = 0;
+        for( i = 0; i < num[f]; i++ ) {
+            err[f][i] = -1.0;
+            if( info[i].id == patt_id[0] || info[i].id == patt_id[1] ) {
+                err[f][i] = arHandleGetTransMat( handle, &info[i], center, MARKER_WIDTH, conv[f][i] );
+            }
+        }
+    }
+    arDeleteHandle( handle );
+
+    handle = arCreateHandle( &cparam );
+    camera.next = 0;
+    pipeline = arCreatePipeline( handle, THRESH, 0, capture, capture_next, &camera );
+    arPipelineSetPatt( pipeline, patt_id[0], center, MARKER_WIDTH );
+    arPipelineSetPatt( pipeline, patt_id[1], center, MARKER_WIDTH );
+    order = diff = 0;
+    last = 0.0;
+    for( f = 0; f < FRAME_NUM; f++ ) {
+        frame = arPipelineGetFrame( pipeline, 1 );
+        if( frame == NULL ) break;
+        if( frame->serial != f || frame->time_capture < last
+         || frame->time_detect < frame->time_capture || frame->time_pose < frame->time_detect ) order++;
+        last = frame->time_capture;
+        if( frame->marker_num != num[f] ) diff++;
+        else {
+            for( i = 0; i < num[f]; i++ ) {
+                if( frame->err[i] != err[f][i]
+                 || (err[f][i] >= 0.0 && memcmp(frame->conv[i], conv[f][i], sizeof(conv[f][i])) != 0) ) diff++;
+            }
+        }
+        arPipelineReleaseFrame( pipeline, frame );
+    }
+    arDeletePipeline( pipeline );
+    arDeleteHandle( handle );
+    ok = (f == FRAME_NUM && order == 0 && diff == 0);
+    printf("pipeline: %d frames, %d out of order, %d differ from the sequential run  %s\n",
+           f, order, diff, ok? "ok": "FAILED");
+
+    /* a matrix code of an id beyond the patterns */
+    {
+        ARUint8   cells[25];
+        int       size, x, y;
+
+        size = arMatrixCodeEncode( AR_MATRIX_CODE_5x5_BCH_22_12_5, CODE_ID, cells );
+        for( y = 0; y < AR_PATT_SIZE_Y; y++ ) {
+            for( x = 0; x < AR_PATT_SIZE_X; x++ ) {
+                patt_gray[MARKER_NUM][y][x] = cells[(y*size/AR_PATT_SIZE_Y)*size + x*size/AR_PATT_SIZE_X]? 20: 230;
+            }
+        }
+        m[0].patt = MARKER_NUM;
+        render( camera.image[0], m, 1 );
+        camera.num  = 1;
+        camera.next = 0;
+        arPattDetectionMode = AR_MATRIX_CODE_DETECTION;
+        arMatrixCodeType = AR_MATRIX_CODE_5x5_BCH_22_12_5;
+        handle = arCreateHandle( &cparam );
+        pipeline = arCreatePipeline( handle, THRESH, 0, capture, capture_next, &camera );
+        arPipelineSetPatt( pipeline, CODE_ID, center, MARKER_WIDTH );
+        depth = -1.0;
+        frame = arPipelineGetFrame( pipeline, 1 );
+        if( frame != NULL ) {
+            i = find_id( frame->marker_info, frame->marker_num, CODE_ID );
+            if( i >= 0 && frame->err[i] >= 0.0 ) depth = frame->conv[i][2][3];
+            arPipelineReleaseFrame( pipeline, frame );
+        }
+        arDeletePipeline( pipeline );
+        arDeleteHandle( handle );
+        arPattDetectionMode = DEFAULT_PATT_DETECTION_MODE;
+        arMatrixCodeType = DEFAULT_MATRIX_CODE_TYPE;
+    }
+    for( f = 0; f < FRAME_NUM; f++ ) free( camera.image[f] );
+    free( camera.image );
+
+    i = (fabs(depth - m[0].conv[2][3]) < 0.02 * m[0].conv[2][3]);
+    printf("pipeline: matrix code %d posed at %.1f mm (drawn at %.1f mm)  %s\n",
+           CODE_ID, depth, m[0].conv[2][3], i? "ok": "FAILED");
+    return (ok && i)? 0: -1;
+}
+
+/* the members of a pattern relative to the first one, mean rotation (deg) and translation (mm) */
+static void map_error( ARMultiMarkerInfoT *a, ARMultiMarkerInfoT *b, double *rot, double *trans )
+{
+    double   ra[3][4], rb[3][4], t;
+    int      i, j, k;
+
+    *rot = *trans = 0.0;
+    for( i = 1; i < a->marker_num; i++ ) {
+        arUtilMatMul( a->marker[0].itrans, a->marker[i].trans, ra );
+        arUtilMatMul( b->marker[0].itrans, b->marker[i].trans, rb );
+        t = 0.0;
+        for( j = 0; j < 3; j++ ) for( k = 0; k < 3; k++ ) t += ra[j][k] * rb[j][k];
+        t = (t - 1.0) / 2.0;
+        if( t > 1.0 ) t = 1.0;
+        *rot += acos( t ) * 180.0 / 3.14159265358979323846;
+        *trans += sqrt( (ra[0][3]-rb[0][3])*(ra[0][3]-rb[0][3])
+                      + (ra[1][3]-rb[1][3])*(ra[1][3]-rb[1][3])
+                      + (ra[2][3]-rb[2][3])*(ra[2][3]-rb[2][3]) );
+    }
+    *rot   /= a->marker_num - 1;
+    *trans /= a->marker_num - 1;
+}
+
+static void set_member( ARMultiEachMarkerInfoT *member, double trans[3][4] )
+{
+    double   hw;
+    int      i, j;
+
+    hw = member->width / 2.0;
+    for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) member->trans[j][i] = trans[j][i];
+    arUtilMatInv( member->trans, member->itrans );
+    for( i = 0; i < 4; i++ ) {
+        for( j = 0; j < 3; j++ ) {
+            member->pos3d[i][j] = trans[j][0] * ((i == 0 || i == 3)? -hw: hw)
+                                + trans[j][1] * ((i < 2)? hw: -hw) + trans[j][3];
+        }
+    }
+}
+
+static int check_refine( void )
+{
+    ARMultiMarkerInfoT      truth, config;
+    ARMultiRefineT          *refine;
+    ARMarkerInfo            info[12];
+    double                  rot[3][3], trans[3][4], conv[3][4];
+    double                  rot0, trans0, rot1, trans1, err, x, y, z;
+    int                     update, ok, f, i, j, k;
+
+    truth.marker_num = config.marker_num = 12;
+    truth.prevF = config.prevF = 0;
+    arMalloc( truth.marker, ARMultiEachMarkerInfoT, 12 );
+    arMalloc( config.marker, ARMultiEachMarkerInfoT, 12 );
+    srand( 3 );
+    for( i = 0; i < 12; i++ ) {
+        truth.marker[i].patt_id = config.marker[i].patt_id = i;
+        truth.marker[i].width = config.marker[i].width = 40.0;
+        truth.marker[i].center[0] = config.marker[i].center[0] = 0.0;
+        truth.marker[i].center[1] = config.marker[i].center[1] = 0.0;
+        for( j = 0; j < 3; j++ ) for( k = 0; k < 4; k++ ) trans[j][k] = (j == k)? 1.0: 0.0;
+        trans[0][3] = (i % 4 - 1.5) * 60.0;
+        trans[1][3] = (i / 4 - 1.0) * 60.0;
+        set_member( &truth.marker[i], trans );
+        /* measured by hand: about 1 degree and 3 mm off */
+        if( i > 0 ) {
+            arGetRot( 0.03*uniform(), 0.03*uniform(), 0.03*uniform(), rot );
+            for( j = 0; j < 3; j++ ) for( k = 0; k < 3; k++ ) trans[j][k] = rot[j][k];
+            for( j = 0; j < 3; j++ ) trans[j][3] += 3.0 * uniform();
+        }
+        set_member( &config.marker[i], trans );
+    }
+    map_error( &config, &truth, &rot0, &trans0 );
+
+    refine = arMultiCreateRefine( &config, 100 );
+    update = 0;
+    for( f = 0; f < 600; f++ ) {
+        if( arMultiRefineUpdate( refine, &err ) == 1 ) update++;
+        arGetRot( 0.4*sin(f*0.013) + 0.1*uniform(), 3.14159 - 0.5 + 0.4*sin(f*0.021), 0.5*sin(f*0.007), rot );
+        for( j = 0; j < 3; j++ ) for( k = 0; k < 3; k++ ) conv[j][k] = rot[j][k];
+        conv[0][3] = 40.0 * sin(f*0.03);
+        conv[1][3] = 30.0 * cos(f*0.04);
+        conv[2][3] = 700.0 + 150.0 * sin(f*0.02);
+        for( i = 0; i < 12; i++ ) {
+            info[i].id = i;
+            info[i].cf = 1.0;
+            info[i].dir = 0;
+            for( j = 0; j < 4; j++ ) {
+                x = conv[0][0]*truth.marker[i].pos3d[j][0] + conv[0][1]*truth.marker[i].pos3d[j][1]
+                  + conv[0][2]*truth.marker[i].pos3d[j][2] + conv[0][3];
+                y = conv[1][0]*truth.marker[i].pos3d[j][0] + conv[1][1]*truth.marker[i].pos3d[j][1]
+                  + conv[1][2]*truth.marker[i].pos3d[j][2] + conv[1][3];
+                z = conv[2][0]*truth.marker[i].pos3d[j][0] + conv[2][1]*truth.marker[i].pos3d[j][1]
+                  + conv[2][2]*truth.marker[i].pos3d[j][2] + conv[2][3];
+                info[i].vertex[j][0] = (cparam.mat[0][0]*x + cparam.mat[0][1]*y + cparam.mat[0][2]*z) / z
+                                     + 0.2 * uniform();
+                info[i].vertex[j][1] = (cparam.mat[1][1]*y + cparam.mat[1][2]*z) / z + 0.2 * uniform();
+            }
+            info[i].area = (int)( fabs( (info[i].vertex[2][0]-info[i].vertex[0][0])
+                                      * (info[i].vertex[3][1]-info[i].vertex[1][1])
+                                      - (info[i].vertex[3][0]-info[i].vertex[1][0])
+                                      * (info[i].vertex[2][1]-info[i].vertex[0][1]) ) / 2.0 );
+            info[i].pos[0] = (info[i].vertex[0][0] + info[i].vertex[2][0]) / 2.0;
+            info[i].pos[1] = (info[i].vertex[0][1] + info[i].vertex[2][1]) / 2.0;
+        }
+        if( arMultiGetTransMat( info, 12, &config ) >= 0 ) arMultiRefineAddFrame( refine, info );
+        /* time for the refinement thread */
+        arUtilSleep( 5 );
+    }
+    arMultiFreeRefine( refine );
+    map_error( &config, &truth, &rot1, &trans1 );
+    free( truth.marker );
+    free( config.marker );
+
+    /* a map biased by the corners fed to the refinement stays further off */
+    ok = (update > 0 && rot1 < 0.3 && trans1 < 0.5);
+    printf("refine:   %d updates, members off by %.3f deg %.3f mm, were %.3f deg %.3f mm  %s\n",
+           update, rot1, trans1, rot0, trans0, ok? "ok": "FAILED");
+    return ok? 0: -1;
+}
+
+/*
+ *  Detects FRAME_NUM frames of the scene with the tracker, the last
+ *  marker being hidden from HIDE_FROM to HIDE_TO. seen tells the frames
+ *  its id was reported; err is the mean vertex error of the visible
+ *  markers and dup the number of markers reported twice. tracked counts
+ *  the frames tracked by the corners. -1 if a marker visible for 2
+ *  frames was missed.
+ */
+static int stream( ARTracker *tracker, int sleep_msec, char seen[FRAME_NUM],
+                   int *tracked, double *err, int *dup )
+{
+    ARMarkerInfo *info;
+    ARUint8      *image;
+    Marker       m[MARKER_NUM];
+    double       v[4][2], serr;
+    int          num, visible, missed, n, f, i, j;
+
+    arMalloc( image, ARUint8, XSIZE*YSIZE*AR_PIX_SIZE_DEFAULT );
+    serr = 0.0;
+    n = missed = 0;
+    if( tracked != NULL ) *tracked = 0;
+    if( dup != NULL ) *dup = 0;
+    for( f = 0; f < FRAME_NUM; f++ ) {
+        make_scene( m, f );
+        visible = (f >= HIDE_FROM && f < HIDE_TO)? MARKER_NUM-1: MARKER_NUM;
+        render( image, m, visible );
+        if( sleep_msec > 0 ) arUtilSleep( sleep_msec );
+        if( arTrackerDetectMarker( tracker, image, THRESH, &info, &num ) < 0 ) num = 0;
+        /* frame > 1: the markers of this frame were tracked by their corners */
+        if( tracked != NULL && tracker->frame > 1 ) (*tracked)++;
+
+        seen[f] = (find_id( info, num, patt_id[MARKER_NUM-1] ) >= 0);
+        for( i = 0; i < visible; i++ ) {
+            j = find_id( info, num, patt_id[i] );
+            if( j < 0 ) {
+                if( f >= 2 && (i < MARKER_NUM-1 || f < HIDE_FROM || f >= HIDE_TO + 2) ) missed++;
+                continue;
+            }
+            if( dup != NULL && find_id( &info[j+1], num-j-1, patt_id[i] ) >= 0 ) (*dup)++;
+            get_corner( &m[i], v );
+            serr += vertex_error( &info[j], v );
+            n++;
+        }
+    }
+    free( image );
+
+    if( err != NULL ) *err = (n > 0)? serr / n: -1.0;
+    return (missed == 0)? 0: -1;
+}
+
+/* the first orientation of a pattern file, in gray levels */
+static int load_gray( char *name, int gray[AR_PATT_SIZE_Y][AR_PATT_SIZE_X] )
+{
+    FILE     *fp;
+    int      c, x, y, v;
+
+    if( (fp = fopen(name, "r")) == NULL ) return -1;
+    for( y = 0; y < AR_PATT_SIZE_Y; y++ ) for( x = 0; x < AR_PATT_SIZE_X; x++ ) gray[y][x] = 0;
+    for( c = 0; c < 3; c++ ) {
+        for( y = 0; y < AR_PATT_SIZE_Y; y++ ) {
+            for( x = 0; x < AR_PATT_SIZE_X; x++ ) {
+                if( fscanf(fp, "%d", &v) != 1 ) {
+                    fclose(fp);
+                    return -1;
+                }
+                gray[y][x] += v;
+            }
+        }
+    }
+    fclose(fp);
+    for( y = 0; y < AR_PATT_SIZE_Y; y++ ) for( x = 0; x < AR_PATT_SIZE_X; x++ ) gray[y][x] /= 3;
+
+    return 0;
+}
+
+/* three markers moving slowly across the image */
+static void make_scene( Marker m[MARKER_NUM], int f )
+{
+    double   t;
+    int      i;
+
+    t = 20.0 * sin( f * 0.1 );
+    for( i = 0; i < MARKER_NUM; i++ ) {
+        m[i].patt  = i;
+        m[i].width = MARKER_WIDTH;
+    }
+    make_conv( m[0].conv, 0.1 + 0.004*t, 2.9, 0.3, -120.0 + t, -20.0, 500.0 );
+    make_conv( m[1].conv, 1.2, 2.8, -0.2, 110.0 - 0.5*t, 40.0 - 0.5*t, 600.0 );
+    make_conv( m[2].conv, 2.5, 2.9, 0.5, 0.2*t, 60.0, 450.0 );
+}
+
+static void make_conv( double conv[3][4], double a, double b, double c,
+                       double x, double y, double z )
+{
+    double   rot[3][3];
+    int      i, j;
+
+    arGetRot( a, b, c, rot );
+    for( j = 0; j < 3; j++ ) {
+        for( i = 0; i < 3; i++ ) conv[j][i] = rot[j][i];
+    }
+    conv[0][3] = x;
+    conv[1][3] = y;
+    conv[2][3] = z;
+}
+
+/*
+ *  Each pixel is brought back on the plane of the markers by the inverse
+ *  of the homography of the marker: a black square with the pattern on
+ *  its inner half, on a gray background.
+ */
+static void render( ARUint8 *image, Marker *m, int num )
+{
+    double   h[3][3], hi[AR_SQUARE_MAX][3][3], d, X, Y, W, hw;
+    int      value, x, y, u, v, i, j, k;
+
+    for( k = 0; k < num; k++ ) {
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) {
+                h[j][i] = cparam.mat[j][0] * m[k].conv[0][(i == 2)? 3: i]
+                        + cparam.mat[j][1] * m[k].conv[1][(i == 2)? 3: i]
+                        + cparam.mat[j][2] * m[k].conv[2][(i == 2)? 3: i];
+            }
+        }
+        d = h[0][0]*(h[1][1]*h[2][2]-h[1][2]*h[2][1])
+          - h[0][1]*(h[1][0]*h[2][2]-h[1][2]*h[2][0])
+          + h[0][2]*(h[1][0]*h[2][1]-h[1][1]*h[2][0]);
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) {
+                hi[k][i][j] = ( h[(j+1)%3][(i+1)%3] * h[(j+2)%3][(i+2)%3]
+                              - h[(j+1)%3][(i+2)%3] * h[(j+2)%3][(i+1)%3] ) / d;
+            }
+        }
+    }
+
+    for( y = 0; y < YSIZE; y++ ) {
+        for( x = 0; x < XSIZE; x++ ) {
+            value = 190;
+            for( k = 0; k < num; k++ ) {
+                W = hi[k][2][0]*ideal[(y*XSIZE+x)*2] + hi[k][2][1]*ideal[(y*XSIZE+x)*2+1] + hi[k][2][2];
+                X = (hi[k][0][0]*ideal[(y*XSIZE+x)*2] + hi[k][0][1]*ideal[(y*XSIZE+x)*2+1] + hi[k][0][2]) / W;
+                Y = (hi[k][1][0]*ideal[(y*XSIZE+x)*2] + hi[k][1][1]*ideal[(y*XSIZE+x)*2+1] + hi[k][1][2]) / W;
+                hw = m[k].width / 2.0;
+                if( fabs(X) > hw || fabs(Y) > hw ) continue;
+                if( fabs(X) < hw/2.0 && fabs(Y) < hw/2.0 ) {
+                    u = (int)( (X + hw/2.0) / hw * AR_PATT_SIZE_X );
+                    v = (int)( (hw/2.0 - Y) / hw * AR_PATT_SIZE_Y );
+                    if( u > AR_PATT_SIZE_X-1 ) u = AR_PATT_SIZE_X-1;
+                    if( v > AR_PATT_SIZE_Y-1 ) v = AR_PATT_SIZE_Y-1;
+                    value = patt_gray[m[k].patt][v][u];
+                }
+                else value = 10;
+            }
+            for( i = 0; i < AR_PIX_SIZE_DEFAULT; i++ ) image[(y*XSIZE+x)*AR_PIX_SIZE_DEFAULT+i] = value;
+        }
+    }
+}
+
+/* the corners of a marker in ideal coordinates, as the vertex of ARMarkerInfo */
+static void get_corner( Marker *m, double v[4][2] )
+{
+    double   x, y, z, px, py, hw;
+    int      i;
+
+    hw = m->width / 2.0;
+    for( i = 0; i < 4; i++ ) {
+        px = (i == 0 || i == 3)? -hw: hw;
+        py = (i < 2)? hw: -hw;
+        x = m->conv[0][0]*px + m->conv[0][1]*py + m->conv[0][3];
+        y = m->conv[1][0]*px + m->conv[1][1]*py + m->conv[1][3];
+        z = m->conv[2][0]*px + m->conv[2][1]*py + m->conv[2][3];
+        v[i][0] = (cparam.mat[0][0]*x + cparam.mat[0][1]*y + cparam.mat[0][2]*z) / z;
+        v[i][1] = (cparam.mat[1][1]*y + cparam.mat[1][2]*z) / z;
+    }
+}
+
+/* mean distance of the vertices to the corners, in the best of the 4 turns */
+static double vertex_error( ARMarkerInfo *info, double v[4][2] )
+{
+    double   e, emin, dx, dy;
+    int      r, i;
+
+    emin = -1.0;
+    for( r = 0; r < 4; r++ ) {
+        e = 0.0;
+        for( i = 0; i < 4; i++ ) {
+            dx = info->vertex[(i+r)%4][0] - v[i][0];
+            dy = info->vertex[(i+r)%4][1] - v[i][1];
+            e += sqrt( dx*dx + dy*dy );
+        }
+        if( emin < 0.0 || e < emin ) emin = e;
+    }
+
+    return emin / 4.0;
+}
+
+static int find_id( ARMarkerInfo *info, int num, int id )
+{
+    int      i;
+
+    for( i = 0; i < num; i++ ) {
+        if( info[i].id == id ) return i;
+    }
+    return -1;
+}
+
+static double uniform( void )
+{
+    return rand() / (double)RAND_MAX * 2.0 - 1.0;
+}